@@ -19,6 +19,7 @@
 #include <errno.h>
 #include <fcntl.h>
 #include <string.h>
+#include <global.h>
 #include <MBR.h>
 
 #define TAB "    "
@@ -38,6 +39,106 @@ long hex2dec(void* string, int length){
 	return strtol(hex, NULL, 16);
 }
 
+/// convert a little-endian number of up to 8 bytes into an unsigned long
+///
+/// hex2dec() only handles up to 4 bytes, GPT uses 8-byte LBAs
+/// @param bytes the little-endian number
+/// @param length the byte length of the number
+/// @returns the value of the number
+unsigned long le2ul(const void* bytes, int length){
+	unsigned long value = 0;
+	for(int i = length - 1;i >= 0;i--){
+		value = (value << 8) | ((const unsigned char*) bytes)[i];
+	}
+	return value;
+}
+
+/// reads the GPT of a disk (or image)
+/// @param FD the opened disk
+/// @param partitions the array in which to store the partitions
+/// @param max the size of *partitions*
+/// @returns the amount of partitions read, INEX on error
+static int read_GPT(int FD, struct partition_info* partitions, int max){
+	char header[SECTOR_SIZE];
+	if(pread(FD, header, SECTOR_SIZE, SECTOR_SIZE) != SECTOR_SIZE || memcmp(header, GPT_SIGNATURE, strlen(GPT_SIGNATURE)) != 0){
+		fprintf(stderr, "ERROR: protective MBR without a valid GPT header\n");
+		return INEX;
+	}
+	unsigned long entries_start = le2ul(header + 72, 8) * SECTOR_SIZE;
+	unsigned long entries = le2ul(header + 80, 4);
+	unsigned long entry_size = le2ul(header + 84, 4);
+	if(entry_size < 128 || entry_size > SECTOR_SIZE){
+		fprintf(stderr, "ERROR: invalid GPT entry size (%lu)\n", entry_size);
+		return INEX;
+	}
+	if(entries > GPT_MAX_ENTRIES) entries = GPT_MAX_ENTRIES; // empty entries are not counted, a bogus header could claim 2^32 of them
+	int count = 0;
+	char entry[SECTOR_SIZE];
+	for(unsigned long i = 0;i < entries && count < max;i++){
+		if(pread(FD, entry, entry_size, (off_t) (entries_start + i * entry_size)) != (ssize_t) entry_size){
+			fprintf(stderr, "ERROR: reading GPT entry %lu (%s)\n", i + 1, strerror(errno));
+			return INEX;
+		}
+		int used = FALSE;
+		for(int j = 0;j < 16;j++){
+			if(entry[j] != 0) used = TRUE; // type GUID is all zeros for unused entries
+		}
+		if(!used) continue;
+		struct partition_info* partition = &partitions[count++];
+		unsigned long first = le2ul(entry + 32, 8);
+		unsigned long last = le2ul(entry + 40, 8);
+		partition->number = (int) i + 1;
+		partition->type = GPT_PROTECTIVE_TYPE;
+		partition->bootable = FALSE;
+		partition->start = first * SECTOR_SIZE;
+		partition->size = (last - first + 1) * SECTOR_SIZE;
+		for(int j = 0;j < GPT_NAME_SIZE;j++){ // UTF-16LE -> ASCII, good enough for names like "rootfs"
+			char c = entry[56 + 2 * j];
+			partition->name[j] = (c >= ' ' && c <= '~' && entry[57 + 2 * j] == 0) ? c : (c == 0 ? '\0' : '?');
+			if(c == 0) break;
+		}
+		partition->name[GPT_NAME_SIZE] = '\0';
+	}
+	return count;
+}
+
+/// reads the partition table (MBR, or GPT if the MBR is protective) of a disk or image
+/// @param disk the disk or image to read the partition table from
+/// @param partitions the array in which to store the partitions
+/// @param max the size of *partitions*
+/// @returns the amount of partitions read, INEX on error
+int read_partition_table(const char* disk, struct partition_info* partitions, int max){
+	int FD = open(disk, O_RDONLY);
+	if(FD < 0){
+		fprintf(stderr, "ERROR: opening %s (%s)\n", disk, strerror(errno));
+		return INEX;
+	}
+	unsigned char buffer[MBR_SIZE];
+	if(read(FD, buffer, MBR_SIZE) != MBR_SIZE || buffer[510] != 0x55 || buffer[511] != 0xAA){ // boot signature
+		close(FD);
+		return 0; // no partition table
+	}
+	int count = 0;
+	for(int i = 0;i < 4 && count < max;i++){
+		struct partition* partition = (struct partition*) (buffer + BOOTSTRAP_CODE_SIZE + (i * PARTITION_SIZE));
+		unsigned long size = le2ul(partition->sector_number, 4) * SECTOR_SIZE;
+		if(size == 0) continue; // partition doesn't exist
+		if(partition->type == GPT_PROTECTIVE_TYPE){
+			count = read_GPT(FD, partitions, max);
+			break;
+		}
+		partitions[count].number = i + 1;
+		partitions[count].type = partition->type;
+		partitions[count].bootable = partition->boot_flag == 0x80;
+		partitions[count].start = le2ul(partition->sector_start, 4) * SECTOR_SIZE;
+		partitions[count].size = size;
+		strcpy(partitions[count].name, "");
+		count++;
+	}
+	close(FD);
+	return count;
+}
+
 /// prints the MBR information of the specified partition
 /// @param disk the disk to read the MBR information from
 void print_partition(const char* disk){
@@ -45,40 +146,19 @@ void print_partition(const char* disk){
 		printf("> no partition table available for files\n");
 		return;
 	}
-	struct partition* partition;
-	int FD = open(disk, O_RDONLY | O_SYNC);
-
-	if(FD < 0){
-		fprintf(stderr, "ERROR: opening %s (%s)\n", disk, strerror(errno));
-		exit(EXIT_FAILURE);
-	}
-	char buffer[MBR_SIZE];
-	ssize_t read_bytes = read(FD, buffer, MBR_SIZE);
-	if(read_bytes < 0){
-		fprintf(stderr, "ERROR: reading %s (%s)\n", disk, strerror(errno));
-		exit(EXIT_FAILURE);
-	}
-	if(close(FD) < 0){
-		fprintf(stderr, "ERROR: closing %s (%s)\n", disk, strerror(errno));
+	struct partition_info partitions[MAX_PARTITIONS];
+	int count = read_partition_table(disk, partitions, MAX_PARTITIONS);
+	if(count == INEX){
 		exit(EXIT_FAILURE);
 	}
 	// dump partition -> comparar output del dump con 'hexdump -n 512 -C /dev/sda'
-	//printf("[MBR]: hex dump of %s (%ld bytes)\n\n", disk, read_bytes);
-	//print_hex(buffer, MBR_SIZE); // dumps hex
-	// print info
 	printf("> partition table for %s:\n", disk);
-	partition = (struct partition*) (buffer + BOOTSTRAP_CODE_SIZE);
 	printf(TAB "%-15s%-10s%-20s%-20s%-10s\n", "name", "type", "size (bytes)", "first sector", "bootable");
-	char boot[5];
 	char name[20];
-	for(int i = 0;i < 4;i++){
-		long size = hex2dec(partition->sector_number, 4) * SECTOR_SIZE;
-		partition = (struct partition*) (buffer + BOOTSTRAP_CODE_SIZE + (i * PARTITION_SIZE));
-		if(size == 0) continue; // partition doesn't exist
-		if(partition->boot_flag == 0x80) sprintf(boot, "yes");
-		else sprintf(boot, "no");
-		sprintf(name, "%s%d", disk, i + 1);
-		printf(TAB "%-15s%-10lu%-20lu%-20lu%-10s\n", name, hex2dec(&partition->type, 1), size, hex2dec(partition->sector_start, 4), boot);
+	for(int i = 0;i < count;i++){
+		snprintf(name, sizeof(name), "%s%d", disk, partitions[i].number);
+		printf(TAB "%-15s%-10x%-20lu%-20lu%-10s%s\n", name, partitions[i].type, partitions[i].size,
+				partitions[i].start / SECTOR_SIZE, partitions[i].bootable ? "yes" : "no", partitions[i].name);
 	}
 	printf("\n");
 }
@@ -42,8 +42,41 @@ struct partition{
 	unsigned char sector_number[4];
 };
 
+/*
+GPT (https://en.wikipedia.org/wiki/GUID_Partition_Table), used when the only MBR partition is of type 0xEE
+pos		desc						size (B)
+LBA 1	GPT header					92
+	0		signature "EFI PART"	8
+	72		entries starting LBA	8
+	80		number of entries		4
+	84		size of each entry		4
+entry
+	0		type GUID				16
+	32		first LBA				8
+	40		last LBA (inclusive)	8
+	56		name (UTF-16LE)			72
+*/
+
+#define GPT_PROTECTIVE_TYPE 0xEE
+#define GPT_SIGNATURE "EFI PART"
+#define GPT_NAME_SIZE 36
+#define GPT_MAX_ENTRIES 128 ///< maximum amount of GPT entries read (the usual size of the entry array), whatever the header claims
+#define MAX_PARTITIONS 128 ///< maximum amount of partitions read from a partition table
+
+/// a partition, as read from either the MBR or the GPT
+struct partition_info{
+	int number; ///< partition number, starting at 1
+	int type; ///< MBR partition type (GPT_PROTECTIVE_TYPE for GPT partitions)
+	int bootable;
+	unsigned long start; ///< first byte of the partition
+	unsigned long size; ///< size of the partition (bytes)
+	char name[GPT_NAME_SIZE + 1]; ///< GPT partition name (empty for MBR partitions)
+};
+
 void print_partition(const char* disk);
+int read_partition_table(const char* disk, struct partition_info* partitions, int max);
 long hex2dec(void* string, int length);
+unsigned long le2ul(const void* bytes, int length);
 
 #endif /* MBR_H_ */
 
@@ -0,0 +1,189 @@
+/*
+ * cache.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <utime.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <global.h>
+#include <cache.h>
+
+/// obtains the cache directory, creating it if needed
+/// @returns a pointer to a string containing the cache directory, NULL if the cache is unavailable
+static char* cache_dir(){
+	static char path[PATH_MAX] = "";
+	if(strcmp(path, "") != 0) return path;
+	char* dir = getenv(CACHE_ENV);
+	if(dir != NULL){
+		snprintf(path, sizeof(path), "%s", dir);
+	}else{
+		char* home = getenv("HOME");
+		if(home == NULL) return NULL;
+		snprintf(path, sizeof(path), "%s/%s", home, CACHE_FOLDER);
+	}
+	// mkdir -p
+	for(char* slash = strchr(path + 1, '/');;slash = strchr(slash + 1, '/')){
+		if(slash != NULL) *slash = '\0';
+		if(mkdir(path, 0755) < 0 && errno != EEXIST){
+			fprintf(stderr, "ERROR: creating cache directory %s (%s)\n", path, strerror(errno));
+			strcpy(path, "");
+			return NULL;
+		}
+		if(slash == NULL) break;
+		*slash = '/';
+	}
+	return path;
+}
+
+/// builds the path of a file kept in the cache directory along with the images (e.g. session tokens)
+/// @param name the file name
+/// @param path the buffer in which the path is stored, **must be at least PATH_MAX bytes long**
+/// @returns 1 on success, 0 if the cache is unavailable
+int cache_file(const char* name, char* path){
+	char* dir = cache_dir();
+	if(dir == NULL) return FALSE;
+	snprintf(path, PATH_MAX, "%s/%s", dir, name);
+	return TRUE;
+}
+
+/// checks that a cache key is an MD5 (CACHE_KEY_LENGTH lowercase hex characters), so it can only name a file of the cache directory
+/// @param key the cache key, as reported by SERVER_FILE
+/// @returns 1 if the key is valid, 0 otherwise
+int cache_key_valid(const char* key){
+	if(key == NULL || strlen(key) != CACHE_KEY_LENGTH) return FALSE;
+	return strspn(key, "0123456789abcdef") == CACHE_KEY_LENGTH;
+}
+
+/// looks for an image in the cache
+/// @param key the cache key of the image (its MD5)
+/// @param size the size of the image (bytes)
+/// @param path the buffer in which the path of the cached image is stored (the partial image on CACHE_MISS,
+/// empty if the cache is unavailable), **must be at least PATH_MAX bytes long**
+/// @param cached where the amount of cached bytes is stored
+/// @returns CACHE_HIT, CACHE_PARTIAL or CACHE_MISS
+int cache_lookup(const char* key, unsigned long size, char* path, unsigned long* cached){
+	*cached = 0;
+	strcpy(path, "");
+	char* dir = cache_dir();
+	if(dir == NULL || !cache_key_valid(key)) return CACHE_MISS;
+	struct stat stat_struct;
+	snprintf(path, PATH_MAX, "%s/%s", dir, key);
+	if(stat(path, &stat_struct) == 0){
+		if((unsigned long) stat_struct.st_size == size){
+			utime(path, NULL); // most recently used
+			*cached = size;
+			return CACHE_HIT;
+		}
+		remove(path); // should never happen, the key is the MD5
+	}
+	snprintf(path, PATH_MAX, "%s/%s" CACHE_PART, dir, key);
+	if(stat(path, &stat_struct) == 0){
+		if((unsigned long) stat_struct.st_size <= size){
+			utime(path, NULL);
+			*cached = (unsigned long) stat_struct.st_size;
+			return CACHE_PARTIAL;
+		}
+		remove(path);
+	}
+	return CACHE_MISS;
+}
+
+/// opens a partial image to append the rest of the download to it
+///
+/// the partial image is locked, so two downloads of the same image do not fill it at the same time
+/// @param path the partial image, see cache_lookup()
+/// @returns the opened file, NULL if the image can not be cached right now
+FILE* cache_open_part(const char* path){
+	if(strcmp(path, "") == 0) return NULL;
+	FILE* file_ptr;
+	if((file_ptr = fopen(path, "ab")) == NULL){
+		fprintf(stderr, "ERROR: opening %s, image will not be cached (%s)\n", path, strerror(errno));
+		return NULL;
+	}
+	if(flock(fileno(file_ptr), LOCK_EX | LOCK_NB) < 0){
+		printf("[CLIENT]: image is being cached by another download, it will not be cached twice\n");
+		fclose(file_ptr);
+		return NULL;
+	}
+	return file_ptr;
+}
+
+/// turns a completely downloaded partial image into a cached image
+/// @param key the cache key of the image
+/// @returns 1 on success, 0 on failure
+int cache_commit(const char* key){
+	char* dir = cache_dir();
+	if(dir == NULL || !cache_key_valid(key)) return FALSE;
+	char part[PATH_MAX];
+	char path[PATH_MAX];
+	snprintf(part, sizeof(part), "%s/%s" CACHE_PART, dir, key);
+	snprintf(path, sizeof(path), "%s/%s", dir, key);
+	if(rename(part, path) < 0){
+		fprintf(stderr, "ERROR: caching %s (%s)\n", key, strerror(errno));
+		return FALSE;
+	}
+	cache_evict(key);
+	return TRUE;
+}
+
+/// removes a partial image from the cache (e.g. it did not match its MD5)
+/// @param key the cache key of the image
+void cache_discard(const char* key){
+	char* dir = cache_dir();
+	if(dir == NULL || !cache_key_valid(key)) return;
+	char part[PATH_MAX];
+	snprintf(part, sizeof(part), "%s/%s" CACHE_PART, dir, key);
+	remove(part);
+}
+
+/// removes the least recently used images until the cache is smaller than CACHE_MAX_SIZE
+///
+/// only images and partial images are counted and removed, other files of the cache directory are left alone
+/// @param keep the cache key of an image that must not be removed (NULL for none)
+void cache_evict(const char* keep){
+	char* dir = cache_dir();
+	if(dir == NULL) return;
+	while(TRUE){
+		DIR* directory;
+		struct dirent* dir_entity;
+		if((directory = opendir(dir)) == NULL){
+			fprintf(stderr, "ERROR: opening %s (%s)\n", dir, strerror(errno));
+			return;
+		}
+		unsigned long total = 0;
+		time_t oldest_time = 0;
+		char oldest[PATH_MAX] = "";
+		while((dir_entity = readdir(directory)) != NULL){
+			char key[CACHE_KEY_LENGTH + 1] = "";
+			if(strlen(dir_entity->d_name) >= CACHE_KEY_LENGTH) memcpy(key, dir_entity->d_name, CACHE_KEY_LENGTH);
+			key[CACHE_KEY_LENGTH] = '\0';
+			const char* suffix = dir_entity->d_name + strlen(key);
+			if(!cache_key_valid(key) || (strcmp(suffix, "") != 0 && strcmp(suffix, CACHE_PART) != 0)){
+				continue; // not an image, e.g. a session token of client.c
+			}
+			char path[PATH_MAX];
+			struct stat stat_struct;
+			snprintf(path, sizeof(path), "%s/%s", dir, dir_entity->d_name);
+			if(stat(path, &stat_struct) != 0) continue;
+			total += (unsigned long) stat_struct.st_size;
+			if(keep != NULL && strncmp(dir_entity->d_name, keep, strlen(keep)) == 0) continue;
+			if(strcmp(oldest, "") == 0 || stat_struct.st_mtime < oldest_time){
+				oldest_time = stat_struct.st_mtime;
+				strcpy(oldest, path);
+			}
+		}
+		closedir(directory);
+		if(total <= CACHE_MAX_SIZE || strcmp(oldest, "") == 0) return;
+		printf("[CLIENT]: cache is full, removing %s\n", oldest);
+		remove(oldest);
+	}
+}
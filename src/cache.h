@@ -0,0 +1,43 @@
+/*
+ * cache.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#ifndef CACHE_H_
+#define CACHE_H_
+
+#include <stdio.h>
+#include <limits.h>
+
+/*
+ * client side image cache, indexed by the MD5 reported by SERVER_FILE:
+ *
+ *   <cache>/<MD5>        complete image
+ *   <cache>/<MD5>.part   partial image, the download resumes from its size
+ *
+ * least recently used entries (by mtime, updated on every hit) are removed once the
+ * cache grows over CACHE_MAX_SIZE
+ */
+
+#define CACHE_FOLDER ".cache/os_image_tool" ///< cache directory, relative to $HOME
+#define CACHE_ENV "OS_IMAGE_CACHE" ///< environment variable that overrides the cache directory
+#define CACHE_MAX_SIZE (8UL * 1024 * 1024 * 1024) ///< maximum size of the cache (bytes)
+#define CACHE_PART ".part" ///< suffix of partial images
+#define CACHE_KEY_SIZE 64 ///< maximum size of a cache key
+#define CACHE_KEY_LENGTH 32 ///< length of a valid cache key (MD5 in hex), see cache_key_valid()
+
+#define CACHE_MISS 0 ///< cache_lookup(): image is not cached
+#define CACHE_PARTIAL 1 ///< cache_lookup(): image is partially cached
+#define CACHE_HIT 2 ///< cache_lookup(): image is cached
+
+int cache_file(const char* name, char* path);
+int cache_key_valid(const char* key);
+int cache_lookup(const char* key, unsigned long size, char* path, unsigned long* cached);
+FILE* cache_open_part(const char* path);
+int cache_commit(const char* key);
+void cache_discard(const char* key);
+void cache_evict(const char* keep);
+
+#endif /* CACHE_H_ */
@@ -22,29 +22,55 @@
 #include <ipcheck.h>
 #include <global.h>
 #include <MBR.h>
+#include <tee.h>
+#include <cache.h>
+#include <jobs.h>
+#include <frame.h>
+#include <token.h>
+#include <arpa/inet.h>
 #include <openssl/md5.h>
 #include <signal.h>
 #include <stdint.h>
 
 //#define debug
 #define verbose ///< verbose mode
-//#define FORK_MODE ///< creates child process for file transfer **DO NOT USE**
 #define MAX_CONNECTION_ATTEMPTS 3 ///< maximum amount of connection attempts
+#define BATCH_WINDOW 16 ///< maximum amount of pipelined commands waiting for a reply in batch mode
+#define BATCH_FAILED 2 ///< exit code of batch mode when at least one command failed
+#define TOKEN_FILE "token_%s_%d_%s" ///< session token of a user on a server (IP, port, user), kept in the cache directory
 
 char* get_MD5(const char* target);
+char** load_script(const char* script, int* count);
+void negotiate_protocol();
+void send_command(long seq, const char* command);
+ssize_t recv_more();
+char* recv_reply(long* seq, int* status);
+int run_batch(char* commands[], int count);
+int download_file(struct job* job);
+int start_download(const char* reply, const char* command);
+int local_command(const char* command);
+int token_path(const char* user, char* path);
+void save_token(const char* reply);
+int resume_session(long seq, const char* command, int echo);
 void SIGKILL_handler();
 void setup_server_connection(int argc, char* argv[]);
-void setup_file_download();
 void close_FDs();
 
 int FD_socket; ///< main sever socket file descriptor
 char server_IP[SIZE_IP]; ///< main sever IP
+uint16_t server_port; ///< main server port
+int FRAMED = 0; ///< protocol version negotiated with SERVER_MAIN, 0 for the text protocol (see frame.h)
+char* pending = NULL; ///< bytes received from SERVER_MAIN but not yet processed
+size_t pending_length = 0;
+size_t pending_size = 0;
 
 /// client program entrypoint
 ///
-/// client program entrypoint, the correct use is ./client <IP:port>
+/// client program entrypoint, the correct use is ./client <IP:port> [-f <script> | <command>...]
 /// example: ./client 192.80.80.80:1234
-/// @returns 1 on error, 0 on success
+/// example: ./client 192.80.80.80:1234 "login user pass" "file down 1 /dev/sdc"
+/// example: ./client 192.80.80.80:1234 -f provision.txt
+/// @returns 1 on error, 0 on success, 2 if a command failed in batch mode
 int main(int argc, char** argv){
 	printf("> Launching [CLIENT]\n\n");
 	// kill signal registration
@@ -59,12 +85,27 @@ int main(int argc, char** argv){
 	memset(buffer, 0, BUFFER_SIZE);
 	recv(FD_socket, buffer, BUFFER_SIZE, 0); // wait for server confirmation "OK"
 	if(strcmp(buffer, OK) != 0){
-		printf("[SERVER_MAIN]: connection refused\n");
-		exit(EXIT_SUCCESS);
+		if(strcmp(buffer, "") != 0) printf("%s", buffer); // e.g. the server is busy
+		else printf("[SERVER_MAIN]: connection refused\n");
+		exit(EXIT_FAILURE);
 	}
+	negotiate_protocol();
 	// connected
+	if(argc > 2){ // batch mode
+		int count = argc - 2;
+		char** commands = argv + 2;
+		if(strcmp(argv[2], "-f") == 0){
+			if(argc != 4){
+				fprintf(stderr, "ERROR: incorrect syntax, use %s <IP:port> -f <script>\n", argv[0]);
+				exit(EXIT_FAILURE);
+			}
+			commands = load_script(argv[3], &count);
+		}
+		exit(run_batch(commands, count));
+	}
 	// get commands and send to server:
 	printf("> connection established, use 'login <user> <password>' to login\n");
+	long seq = 0;
 	while(TRUE){
 		do{
 			// get command
@@ -76,30 +117,50 @@ int main(int argc, char** argv){
 			}
 			buffer[strlen(buffer) - 1] = '\0';
 		}while(strcmp(buffer, "") == 0);
-		ssize_t io_count = (int) send(FD_socket, buffer, strlen(buffer), 0); // send to server
-		if(io_count < 0){
-			fprintf(stderr, "ERROR: writing socket (%s)\n", strerror(errno));
-			exit(EXIT_FAILURE);
+		if(local_command(buffer) != INEX) continue; // jobs, wait, cancel
+		if(FRAMED && resume_session(seq, buffer, FALSE)){ // logged in with a saved token
+			seq++;
+			continue;
 		}
+		char command[BUFFER_SIZE];
+		strcpy(command, buffer);
+		send_command(FRAMED ? seq : INEX, buffer); // send to server
 		if(strcmp("exit", buffer) == 0){
+			if(job_running() > 0){
+				printf("[CLIENT]: waiting for %d download(s) to finish...\n", job_running());
+				job_wait(0);
+			}
 			printf("[CLIENT]: exiting...\n");
 			exit(EXIT_SUCCESS);
 		}
 		// recieve response
-		memset(buffer, 0, BUFFER_SIZE);
-		io_count = recv(FD_socket, buffer, BUFFER_SIZE - 1, 0); // read response from server
-		if(io_count < 0){
-			fprintf(stderr, "ERROR: reading socket (%s)\n", strerror(errno));
-			exit(EXIT_FAILURE);
-		}else if(io_count == 0){
-			fprintf(stderr, "ERROR: [SERVER_MAIN] is offline\n");
-			exit(EXIT_FAILURE);
+		char* reply = buffer;
+		if(FRAMED){ // the whole reply, whatever its size
+			long reply_seq;
+			int status;
+			if((reply = recv_reply(&reply_seq, &status)) == NULL){
+				fprintf(stderr, "ERROR: [SERVER_MAIN] is offline\n");
+				exit(EXIT_FAILURE);
+			}
+			seq++;
+		}else{ // text protocol: one recv() is one reply
+			memset(buffer, 0, BUFFER_SIZE);
+			ssize_t io_count = recv(FD_socket, buffer, BUFFER_SIZE - 1, 0); // read response from server
+			if(io_count < 0){
+				fprintf(stderr, "ERROR: reading socket (%s)\n", strerror(errno));
+				exit(EXIT_FAILURE);
+			}else if(io_count == 0){
+				fprintf(stderr, "ERROR: [SERVER_MAIN] is offline\n");
+				exit(EXIT_FAILURE);
+			}
 		}
-		if(strcmp(START_FILE_TRANSFER_MSG, buffer) == 0){
-			setup_file_download();
+		if(strncmp(START_FILE_TRANSFER_MSG, reply, strlen(START_FILE_TRANSFER_MSG)) == 0){
+			int id = start_download(reply, command);
+			if(id > 0) printf("[CLIENT]: download started as job [%d], use 'jobs' to see its progress\n", id);
 			continue;
 		}
-		printf("%s", buffer); // printf server response to client
+		printf("%s", reply); // printf server response to client
+		save_token(reply);
 	}
 	return (EXIT_SUCCESS);
 }
@@ -111,8 +172,8 @@ void setup_server_connection(int argc, char* argv[]){
 #ifdef debug
 	strcpy(input, "127.0.0.1");
 #else
-	if(argc != 2){
-		fprintf(stderr, "ERROR: incorrect syntax, use %s <IP:port>\n", argv[0]);
+	if(argc < 2){
+		fprintf(stderr, "ERROR: incorrect syntax, use %s <IP:port> [-f <script> | <command>...]\n", argv[0]);
 		exit(EXIT_FAILURE);
 	}
 	strncpy(input, argv[1], sizeof(input));
@@ -138,6 +199,7 @@ void setup_server_connection(int argc, char* argv[]){
 		}
 	}
 	// port is valid (or relaced)
+	server_port = port;
 #ifdef verbose
 	printf("\n> verbose defined:\n");
 	printf("    IP:   %s -> valid: %d\n", server_IP, validate_ip(server_IP));
@@ -194,160 +256,535 @@ void close_FDs(){
 	}
 }
 
-/// prepares the client for file transfer
+/// reads a batch script, one command per line
 ///
-/// handles the connection between the client and the file server, also writes the file to the selected device
-void setup_file_download(){
-#ifdef FORK_MODE
-	// fork
-	pid_t pid;
-	pid = fork();
-	if(pid < 0){
-		fprintf(stderr, "ERROR: forking process (%s)\n", strerror(errno));
+/// empty lines, lines starting with BATCH_TAG (comments) and 'exit' are skipped
+/// @param script the script filename, "-" for stdin
+/// @param count where the amount of commands read is stored
+/// @returns an array of *count* commands
+char** load_script(const char* script, int* count){
+	FILE* file_ptr = stdin;
+	if(strcmp(script, "-") != 0 && (file_ptr = fopen(script, "r")) == NULL){
+		fprintf(stderr, "ERROR: opening script %s (%s)\n", script, strerror(errno));
 		exit(EXIT_FAILURE);
 	}
-	if(pid > 0){ // parent process returns
-		sleep(5);
-		return;
+	char** commands = NULL;
+	int size = 0;
+	char line[BUFFER_SIZE];
+	*count = 0;
+	while(fgets(line, sizeof(line), file_ptr) != NULL){
+		line[strcspn(line, "\r\n")] = '\0';
+		if(strcmp(line, "") == 0 || line[0] == BATCH_TAG[0] || strcmp(line, "exit") == 0) continue;
+		if(*count == size){
+			size = size == 0 ? 32 : size * 2;
+			if((commands = realloc(commands, (size_t) size * sizeof(char*))) == NULL){
+				fprintf(stderr, "ERROR: loading script (%s)\n", strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+		}
+		commands[(*count)++] = strdup(line);
 	}
-	// child process -> create socket for connection:
-	if(close(FD_socket) < 0){ // close SERVER_MAIN socket
-		fprintf(stderr, "ERROR: closing socket for file transfer (%s)\n", strerror(errno));
+	if(file_ptr != stdin) fclose(file_ptr);
+	return commands;
+}
+
+/// agrees on a protocol version with SERVER_MAIN (see frame.h)
+///
+/// servers that do not know the framed protocol answer the hello as a text command, in which case
+/// the text protocol is used
+void negotiate_protocol(){
+	char hello[FRAME_HEADER_SIZE + 2];
+	uint16_t version = htons(FRAME_VERSION);
+	frame_encode(hello, FRAME_HELLO, 0, 0, 2);
+	memcpy(hello + FRAME_HEADER_SIZE, &version, 2);
+	if(send(FD_socket, hello, sizeof(hello), 0) < 0){
+		fprintf(stderr, "ERROR: writing socket (%s)\n", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
+	struct frame_header header;
+	int decoded;
+	while((decoded = frame_decode(pending, pending_length, &header)) == FALSE){
+		if(recv_more() <= 0){
+			fprintf(stderr, "ERROR: [SERVER_MAIN] is offline\n");
+			exit(EXIT_FAILURE);
+		}
+	}
+	if(decoded == INEX || header.type != FRAME_HELLO || header.length != 2){ // old server, drop its answer
+		pending_length = 0;
+		FRAMED = 0;
+		return;
+	}
+	memcpy(&version, pending + FRAME_HEADER_SIZE, 2);
+	FRAMED = ntohs(version);
+	pending_length -= FRAME_HEADER_SIZE + header.length;
+	memmove(pending, pending + FRAME_HEADER_SIZE + header.length, pending_length);
+#ifdef verbose
+	printf("[CLIENT]: using protocol version %d\n", FRAMED);
 #endif
+}
+
+/// sends a command to SERVER_MAIN
+/// @param seq sequence number of the command, INEX for an untagged interactive command (text protocol only)
+/// @param command the command
+void send_command(long seq, const char* command){
+	char line[FRAME_HEADER_SIZE + BUFFER_SIZE + 32];
+	size_t length = strlen(command);
+	if(length > BUFFER_SIZE - 1) length = BUFFER_SIZE - 1; // SERVER_MAIN would drop it anyway
+	if(FRAMED){
+		frame_encode(line, FRAME_COMMAND, 0, (uint32_t) seq, (uint32_t) length);
+		memcpy(line + FRAME_HEADER_SIZE, command, length);
+		length += FRAME_HEADER_SIZE;
+	}else if(seq != INEX){ // pipelined
+		length = (size_t) snprintf(line, sizeof(line), BATCH_TAG "%ld %.*s\n", seq, (int) length, command);
+	}else{
+		memcpy(line, command, length);
+	}
+	if(send(FD_socket, line, length, 0) < 0){
+		fprintf(stderr, "ERROR: writing socket (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/// receives more bytes from SERVER_MAIN into *pending*, growing it if needed
+/// @returns the amount of bytes received, 0 if the server closed the connection
+ssize_t recv_more(){
+	if(pending_length == pending_size){
+		pending_size = pending_size == 0 ? BUFFER_SIZE * 8 : pending_size * 2;
+		if((pending = realloc(pending, pending_size)) == NULL){
+			fprintf(stderr, "ERROR: allocating receive buffer (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+	ssize_t io_count = recv(FD_socket, pending + pending_length, pending_size - pending_length, 0);
+	if(io_count < 0){
+		fprintf(stderr, "ERROR: reading socket (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	pending_length += (size_t) io_count;
+	return io_count;
+}
+
+/// receives the next reply to a tagged command from SERVER_MAIN
+///
+/// replies may arrive split across several recv() or several in a single one, so whatever is
+/// received after the current reply is kept for the next call. Replies are either frames, or
+/// "#<seq> <status> <length>\n<reply>" with the text protocol
+/// @param seq where the sequence number of the reply is stored
+/// @param status where the status of the reply (REPLY_OK or REPLY_FAILED) is stored
+/// @returns a pointer to the reply, valid until the next call, NULL if the server closed the connection
+char* recv_reply(long* seq, int* status){
+	static char* reply = NULL;
+	static size_t reply_size = 0;
+	size_t header_length = 0;
+	unsigned long length = 0;
+	while(TRUE){
+		if(FRAMED){
+			struct frame_header header;
+			int decoded = frame_decode(pending, pending_length, &header);
+			if(decoded == INEX || (decoded == TRUE && header.type != FRAME_REPLY)){
+				fprintf(stderr, "ERROR: malformed frame from [SERVER_MAIN]\n");
+				exit(EXIT_FAILURE);
+			}
+			if(decoded == TRUE){
+				*seq = header.seq;
+				*status = header.status;
+				header_length = FRAME_HEADER_SIZE;
+				length = header.length;
+			}
+		}else{
+			char* newline = memchr(pending, '\n', pending_length);
+			if(header_length == 0 && newline != NULL){
+				*newline = '\0';
+				if(pending[0] != BATCH_TAG[0] || sscanf(pending + 1, "%ld %d %lu", seq, status, &length) != 3 || length > FRAME_MAX_PAYLOAD){
+					fprintf(stderr, "ERROR: malformed reply from [SERVER_MAIN] [%s]\n", pending);
+					exit(EXIT_FAILURE);
+				}
+				header_length = (size_t) (newline - pending) + 1;
+			}
+		}
+		if(header_length > 0 && pending_length >= header_length + length){ // complete reply
+			if(reply_size < length + 1){
+				reply_size = length + 1;
+				if((reply = realloc(reply, reply_size)) == NULL){
+					fprintf(stderr, "ERROR: allocating reply buffer (%s)\n", strerror(errno));
+					exit(EXIT_FAILURE);
+				}
+			}
+			memcpy(reply, pending + header_length, length);
+			reply[length] = '\0';
+			pending_length -= header_length + length;
+			memmove(pending, pending + header_length + length, pending_length);
+			return reply;
+		}
+		if(recv_more() == 0) return NULL;
+	}
+}
+
+/// runs a list of commands without user interaction
+///
+/// commands are pipelined to SERVER_MAIN (as frames, or "#<seq> <command>\n" with the text protocol), keeping
+/// up to BATCH_WINDOW of them in flight, and every reply is matched to its command by sequence number
+/// @param commands the commands to run
+/// @param count amount of commands
+/// @returns EXIT_SUCCESS if every command succeeded, BATCH_FAILED if any failed, EXIT_FAILURE on connection errors
+int run_batch(char* commands[], int count){
+	int sent = 0;
+	int answered = 0;
+	int failed = 0;
+	while(answered < count){
+		while(sent < count && sent - answered < BATCH_WINDOW){ // fill the window
+			if(strcmp(commands[sent], "jobs") == 0 || strncmp(commands[sent], "wait", 4) == 0 || strncmp(commands[sent], "cancel", 6) == 0){
+				if(answered < sent) break; // client-side commands wait for every reply before them
+				printf("> %s\n", commands[sent]);
+				if(local_command(commands[sent]) != 0){
+					fprintf(stderr, "[CLIENT]: command #%d '%s' failed\n", sent, commands[sent]);
+					failed++;
+				}
+				sent++;
+				answered++;
+				continue;
+			}
+			if(strncmp(commands[sent], "login ", 6) == 0){
+				if(answered < sent) break; // the token is tried on its own, before the login is sent
+				if(resume_session(sent, commands[sent], TRUE)){
+					sent++;
+					answered++;
+					continue;
+				}
+			}
+			send_command(sent, commands[sent]);
+			sent++;
+		}
+		if(answered == sent) continue; // only client-side commands so far
+		long seq;
+		int status;
+		char* reply;
+		if((reply = recv_reply(&seq, &status)) == NULL){
+			fprintf(stderr, "ERROR: [SERVER_MAIN] closed the connection after %d of %d commands\n", answered, count);
+			return EXIT_FAILURE;
+		}
+		if(seq != answered){
+			fprintf(stderr, "ERROR: expected reply #%d, got #%ld\n", answered, seq);
+			return EXIT_FAILURE;
+		}
+		printf("> %s\n", commands[seq]);
+		if(strncmp(START_FILE_TRANSFER_MSG, reply, strlen(START_FILE_TRANSFER_MSG)) == 0){
+			int id = start_download(reply, commands[seq]);
+			if(id == 0) status = REPLY_FAILED;
+			else printf("[CLIENT]: download started as job [%d]\n", id);
+		}else{
+			printf("%s", reply);
+			save_token(reply);
+		}
+		if(status != REPLY_OK){
+			fprintf(stderr, "[CLIENT]: command #%ld '%s' failed\n", seq, commands[seq]);
+			failed++;
+		}
+		answered++;
+	}
+	send_command(count, "exit");
+	failed += job_wait(0); // downloads still running
+	printf("[CLIENT]: batch finished, %d of %d commands failed\n", failed, count);
+	return failed > 0 ? BATCH_FAILED : EXIT_SUCCESS;
+}
+
+/// runs a client-side command (jobs, wait, cancel), see jobs.h
+/// @param command the command typed by the user
+/// @returns INEX if the command is not a client-side command, 0 if it succeeded, 1 if it failed
+int local_command(const char* command){
+	char copy[BUFFER_SIZE];
+	strncpy(copy, command, BUFFER_SIZE - 1);
+	copy[BUFFER_SIZE - 1] = '\0';
+	char* arg = strtok(copy, " ");
+	if(arg == NULL) return INEX;
+	if(strcmp("jobs", arg) == 0){
+		job_list();
+		return 0;
+	}else if(strcmp("wait", arg) == 0){
+		arg = strtok(NULL, " ");
+		int id = arg == NULL ? 0 : (int) strtol(arg, NULL, 10);
+		int failed = job_wait(id);
+		if(failed == INEX){
+			printf("[CLIENT]: job [%d] does not exist, use 'jobs' to see every job\n", id);
+			return 1;
+		}
+		return failed > 0;
+	}else if(strcmp("cancel", arg) == 0){
+		arg = strtok(NULL, " ");
+		int id = arg == NULL ? 0 : (int) strtol(arg, NULL, 10);
+		if(job_cancel(id) == FALSE){
+			printf("[CLIENT]: job [%d] is not running, use 'jobs' to see every job\n", id);
+			return 1;
+		}
+		printf("[CLIENT]: cancelling job [%d]...\n", id);
+		return 0;
+	}
+	return INEX;
+}
+
+/// builds the path of the saved session token of a user on this server
+/// @param user the user
+/// @param path the buffer in which the path is stored, **must be at least PATH_MAX bytes long**
+/// @returns 1 on success, 0 if tokens can not be saved
+int token_path(const char* user, char* path){
+	char name[NAME_MAX + 1];
+	if(strchr(user, '/') != NULL) return FALSE;
+	snprintf(name, sizeof(name), TOKEN_FILE, server_IP, server_port, user);
+	return cache_file(name, path);
+}
+
+/// saves the session token sent along with a successful login, see token.h
+/// @param reply the reply of SERVER_MAIN
+void save_token(const char* reply){
+	char* line = strstr(reply, TOKEN_PREFIX);
+	if(line == NULL) return;
+	char token[TOKEN_SIZE];
+	snprintf(token, sizeof(token), "%s", line + strlen(TOKEN_PREFIX));
+	token[strcspn(token, "\n")] = '\0';
+	char user[TOKEN_SIZE]; // "<user>:<epoch>:<expiry>:<signature>"
+	strcpy(user, token);
+	for(int i = 0;i < TOKEN_FIELDS;i++){
+		char* colon = strrchr(user, ':');
+		if(colon == NULL) return;
+		*colon = '\0';
+	}
+	char path[PATH_MAX];
+	if(token_path(user, path) == FALSE) return;
+	int FD = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0600); // as good as the password, until it expires
+	if(FD < 0){
+		fprintf(stderr, "ERROR: saving session token (%s)\n", strerror(errno));
+		return;
+	}
+	if(write(FD, token, strlen(token)) < 0) fprintf(stderr, "ERROR: saving session token (%s)\n", strerror(errno));
+	close(FD);
+}
+
+/// logs in with the saved session token of the user, instead of sending the login to SERVER_AUTH
+///
+/// if the token is rejected (e.g. it expired, or SERVER_MAIN was restarted) it is removed, and the
+/// caller sends the login command as usual
+/// @param seq sequence number of the command (INEX for the text protocol, which does not support tokens)
+/// @param command a command typed by the user, only 'login <user> <pass>' is handled
+/// @param echo TRUE to print the command along with the reply (batch mode)
+/// @returns 1 if the session was resumed, 0 otherwise
+int resume_session(long seq, const char* command, int echo){
+	char copy[BUFFER_SIZE];
+	snprintf(copy, sizeof(copy), "%s", command);
+	char* arg = strtok(copy, " ");
+	char* user = strtok(NULL, " ");
+	if(seq == INEX || arg == NULL || strcmp(arg, "login") != 0 || user == NULL) return FALSE;
+	char path[PATH_MAX];
+	if(token_path(user, path) == FALSE) return FALSE;
+	char token[TOKEN_SIZE] = "";
+	int FD = open(path, O_RDONLY);
+	if(FD < 0) return FALSE;
+	ssize_t R = read(FD, token, sizeof(token) - 1);
+	close(FD);
+	if(R <= 0) return FALSE;
+	token[R] = '\0';
+	char resume[BUFFER_SIZE];
+	snprintf(resume, sizeof(resume), "token %s", token);
+	send_command(seq, resume);
+	long reply_seq;
+	int status;
+	char* reply = recv_reply(&reply_seq, &status);
+	if(reply == NULL){
+		fprintf(stderr, "ERROR: [SERVER_MAIN] is offline\n");
+		exit(EXIT_FAILURE);
+	}
+	if(status != REPLY_OK){
+		remove(path);
+		return FALSE;
+	}
+	if(echo) printf("> %s\n", command);
+	printf("%s", reply);
+	return TRUE;
+}
+
+/// starts the download announced by SERVER_FILE as a background job
+/// @param reply the announcement: START_FILE_TRANSFER_MSG " <ticket> [port]"
+/// @param command the command that requested the download
+/// @returns the job ID, 0 on failure
+int start_download(const char* reply, const char* command){
+	char* end;
+	long ticket = strtol(reply + strlen(START_FILE_TRANSFER_MSG), &end, 10);
+	int port = (int) strtol(end, NULL, 10); // missing from servers with a single SERVER_FILE
+	return job_start(ticket, port > 0 ? port : SERVER_FILE_PORT, command, download_file);
+}
+
+/// downloads a file from SERVER_FILE, runs as a background job (see jobs.h)
+///
+/// handles the connection between the client and the file server, also writes the file to the selected device(s)
+/// @param job the job running the download, its ticket tells SERVER_FILE which transfer this is
+/// @returns the amount of targets that could not be written, 0 on success
+int download_file(struct job* job){
 	int FD_SERVER_FILE = socket(AF_INET, SOCK_STREAM, 0);
 	if(FD_SERVER_FILE == INEX){
 		fprintf(stderr, "ERROR: creating transfer socket (%s)\n", strerror(errno));
-		exit(EXIT_FAILURE);
+		return 1;
 	}
+	// server_address setup (server_IP was validated on startup):
 	struct sockaddr_in server_address;
-	if(validate_ip(server_IP) == FALSE){
-		fprintf(stderr, "ERROR: invalid SERVER_FILE IP (%s)", server_IP);
-		exit(EXIT_FAILURE);
-	}
-	struct hostent* server = gethostbyname(server_IP); // server already exists
-	// server_address setup:
-	memset((char*) &server_address, '0', sizeof(server_address));
+	memset((char*) &server_address, 0, sizeof(server_address));
 	server_address.sin_family = AF_INET;
-	server_address.sin_port = htons(SERVER_FILE_PORT); // SERVER_FILE_PORT = 37778
-	bcopy((char*) server->h_addr, (char *) &server_address.sin_addr.s_addr, (size_t) server->h_length);
+	server_address.sin_port = htons((uint16_t) job->port); // the worker that gave the ticket
+	inet_pton(AF_INET, server_IP, &server_address.sin_addr); // gethostbyname() is not thread safe
 	// connect:
-	printf("[CLIENT]: connecting to SERVER_FILE...");
-	fflush(stdout);
 	int attempts = 0;
-	do{
-		if(connect(FD_SERVER_FILE, (struct sockaddr*) &server_address, sizeof(server_address)) < 0){
-			if(++attempts > MAX_CONNECTION_ATTEMPTS){
-				fprintf(stderr, "[CLIENT]: SERVER_FILE is not responding, exiting...\n");
-				exit(EXIT_FAILURE);
-			}
-			printf("[CLIENT]: failed to connect to SERVER_FILE, retrying in 3...");
-			fflush(stdout);
-			sleep(1);
-			printf("2...");
-			fflush(stdout);
-			sleep(1);
-			printf("1...");
-			fflush(stdout);
-			sleep(1);
-			printf("\n");
-			continue;
+	while(connect(FD_SERVER_FILE, (struct sockaddr*) &server_address, sizeof(server_address)) < 0){
+		if(++attempts > MAX_CONNECTION_ATTEMPTS || job_cancelled(job)){
+			fprintf(stderr, "[CLIENT]: SERVER_FILE is not responding, job [%d] failed\n", job->id);
+			close(FD_SERVER_FILE);
+			return 1;
 		}
-		break; // connected
-	}while(TRUE);
-	// connected
-	printf("done\n");
-/*
-	// get filename
-	char filename[MAX_FILENAME_SIZE];
-	memset(filename, '\0', MAX_FILENAME_SIZE);
-#ifdef verbose
-	printf("[CLIENT]: receiving filename\n");
-#endif
-	if(recv(FD_SERVER_FILE, filename, MAX_FILENAME_SIZE, 0) < 0){
-		fprintf(stderr, "ERROR: getting file transfer filename (%s)\n", strerror(errno));
-		exit(EXIT_FAILURE);
+		sleep(3);
 	}
-#ifdef verbose
-	printf("[CLIENT]: filename is: [%s]\n", filename);
-#endif
-*/
-#ifdef verbose
-	printf("[CLIENT]: receiving target\n");
-#endif
-	// get device
-	char target[MAX_FILENAME_SIZE];
-	memset(target, '\0', MAX_FILENAME_SIZE);
-	if(recv(FD_SERVER_FILE, target, sizeof(target), 0) < 0){
-		fprintf(stderr, "ERROR: getting file transfer target (%s)\n", strerror(errno));
-		//exit(EXIT_FAILURE);
-		return;
+	job_set_socket(job, FD_SERVER_FILE);
+	// tell SERVER_FILE which transfer this connection is for
+	char ticket[32];
+	sprintf(ticket, "%ld", job->ticket);
+	if(send(FD_SERVER_FILE, ticket, strlen(ticket), 0) < 0){
+		fprintf(stderr, "ERROR: sending ticket to [SERVER_FILE] (%s)\n", strerror(errno));
+		job_set_socket(job, INEX);
+		close(FD_SERVER_FILE);
+		return 1;
 	}
 #ifdef verbose
-	printf("[CLIENT]: target is: [%s]\n", target);
+	printf("[CLIENT]: receiving targets\n");
 #endif
-	// test if client has write permissions
+	// get "<size> <MD5> <partition> <target> [target...]"
+	char header[BUFFER_SIZE];
+	memset(header, '\0', BUFFER_SIZE);
+	if(recv(FD_SERVER_FILE, header, BUFFER_SIZE - 1, 0) <= 0){
+		fprintf(stderr, "ERROR: getting file transfer targets (%s)\n", strerror(errno));
+		job_set_socket(job, INEX);
+		close(FD_SERVER_FILE);
+		return 1;
+	}
+	char* size = strtok(header, " ");
+	char* digest = strtok(NULL, " ");
+	char* partition = strtok(NULL, " "); // 0 for the whole image
+	char* targets[TEE_MAX_TARGETS + 1];
+	int count = 0;
+	char* target;
+	while((target = strtok(NULL, " ")) != NULL && count <= TEE_MAX_TARGETS){
+		targets[count++] = target;
+	}
+	if(size == NULL || digest == NULL || partition == NULL || count == 0){
+		fprintf(stderr, "ERROR: no target specified, use: file down <image_ID>[:<partition>] <target> [target...]\n");
+		send(FD_SERVER_FILE, NO, strlen(NO), 0);
+		job_set_socket(job, INEX);
+		close(FD_SERVER_FILE);
+		return 1;
+	}
+	if(!cache_key_valid(digest)){ // it names files of the cache, e.g. "../x" must never get there
+		fprintf(stderr, "ERROR: invalid MD5 from [SERVER_FILE] [%.40s], cancelling transfer\n", digest);
+		send(FD_SERVER_FILE, NO, strlen(NO), 0);
+		job_set_socket(job, INEX);
+		close(FD_SERVER_FILE);
+		return 1;
+	}
+	unsigned long expected = strtoul(size, NULL, 10);
 #ifdef verbose
-	printf("[CLIENT]: opening target [%s]\n", target);
+	printf("[CLIENT]: opening %d target(s) for %lu bytes\n", count, expected);
 #endif
-	FILE* file_output;
-	if((file_output = fopen(target, "wb")) == NULL){
+	// test if client has write permissions (on at least one of the targets)
+	struct tee tee;
+	int opened = tee_open(&tee, targets, count, expected, TRUE); // quiet, runs in the background (see 'jobs' for progress)
+	if(opened == 0){
 		// let SERVER_FILE know the transfer is cancelled
-		if(send(FD_SERVER_FILE, NO, strlen(NO), 0) < 0){ // SEND device
+		if(send(FD_SERVER_FILE, NO, strlen(NO), 0) < 0){ // SEND cancellation
 			fprintf(stderr, "ERROR: sending cancellation to [SERVER_FILE] (%s)\n", strerror(errno));
-			return;
-		}
-		switch(errno){
-			case EACCES: {/* Permission denied */
-				fprintf(stderr, "ERROR: no permission on client to write on %s, restart with sudo\n", target);
-				break;
-			}
-			case EISDIR: {/* Is a directory */
-				fprintf(stderr, "ERROR: no filename specified\n");
-				fprintf(stderr, TAB TAB "example: file down 3 /home/user/Desktop/test_file");
-				fprintf(stderr, TAB TAB "example: file down 1 /dev/sdc");
-				break;
-			}
-			case ENOENT: {/* No such file or directory */
-				fprintf(stderr, "ERROR: invalid file ID, use 'file ls' to get a list of files and their IDs\n");
-				break;
-			}
-			default: {
-				fprintf(stderr, "ERROR: unable to open %s (%s)\n", target, strerror(errno));
-				break;
-			}
 		}
-		return;
+		job_set_socket(job, INEX);
+		close(FD_SERVER_FILE);
+		return 1;
+	}
+	// look for the image in the cache, a partial image is resumed from where it was left
+	char cache_path[PATH_MAX];
+	unsigned long cached;
+	int cache = cache_lookup(digest, expected, cache_path, &cached);
+	char answer[32];
+	if(cache == CACHE_HIT){
+		printf("[CLIENT]: job [%d]: image [%s] is cached, writing local copy\n", job->id, digest);
+		strcpy(answer, CACHED);
+	}else{
+		if(cache == CACHE_PARTIAL) printf("[CLIENT]: job [%d]: resuming image [%s] from byte %lu\n", job->id, digest, cached);
+		sprintf(answer, OK " %lu", cached); // SERVER_FILE skips what is already cached
 	}
-	// send OK to start transfer
-	if(send(FD_SERVER_FILE, OK, strlen(OK), 0) < 0){ // SEND OK
+	if(send(FD_SERVER_FILE, answer, strlen(answer), 0) < 0){ // SEND OK
 		fprintf(stderr, "ERROR: sending OK to [SERVER_FILE] (%s)\n", strerror(errno));
-		fclose(file_output);
-		return;
+		tee_close(&tee);
+		job_set_socket(job, INEX);
+		close(FD_SERVER_FILE);
+		return 1;
 	}
 #ifdef verbose
 	printf("[CLIENT]: starting transfer...\n");
 #endif
 	long read;
-	unsigned long total = 0;
-	char buffer[BUFFER_SIZE];
-	while((read = recv(FD_SERVER_FILE, buffer, sizeof(buffer), 0)) > 0){
-		if(read < 0){
+	char buffer[TEE_CHUNK_SIZE];
+	FILE* cache_file;
+	if(cached > 0){ // cached bytes first
+		if((cache_file = fopen(cache_path, "rb")) == NULL){
+			fprintf(stderr, "ERROR: opening cached image %s (%s)\n", cache_path, strerror(errno));
+			tee_close(&tee);
+			job_set_socket(job, INEX);
+			close(FD_SERVER_FILE);
+			return 1;
+		}
+		unsigned long left = cached;
+		while(left > 0 && !job_cancelled(job) && (read = (long) fread(buffer, 1, left < sizeof(buffer) ? left : sizeof(buffer), cache_file)) > 0){
+			if(tee_write(&tee, buffer, (size_t) read) == FALSE) break;
+			left -= (unsigned long) read;
+			job_progress(job, tee.total, expected);
+		}
+		fclose(cache_file);
+	}
+	cache_file = NULL;
+	if(cache != CACHE_HIT){ // then the network, filling the cache on the way
+		cache_file = cache_open_part(cache_path);
+		while((read = recv(FD_SERVER_FILE, buffer, sizeof(buffer), 0)) > 0){
+			if(cache_file != NULL && fwrite(buffer, 1, (size_t) read, cache_file) != (size_t) read){
+				fprintf(stderr, "ERROR: writing %s, image will not be cached (%s)\n", cache_path, strerror(errno));
+				fclose(cache_file);
+				cache_file = NULL;
+				cache_discard(digest);
+			}
+			if(tee_write(&tee, buffer, (size_t) read) == FALSE){
+				fprintf(stderr, "ERROR: every target failed, cancelling transfer\n");
+				break;
+			}
+			job_progress(job, tee.total, expected);
+		}
+		if(read < 0 && !job_cancelled(job)){
 			fprintf(stderr, "ERROR: transfering (%s)\n", strerror(errno));
-			exit(EXIT_FAILURE);
 		}
-		fwrite(buffer, 1, (unsigned long) read, file_output);
-		//printf("[CLIENT] read %ld bytes\n", read);
-		total += (unsigned) read;
-		memset(buffer, '0', sizeof(buffer));
-	}
-	printf("[CLIENT]: transfer complete, total: [%ld] bytes\n", total);
-	fclose(file_output);
-	// get MD5
-	printf("[CLIENT]: MD5 is [%s]\n", get_MD5(target));
-	// print partitions
-	print_partition(target);
+	}
+	job_set_socket(job, INEX);
+	close(FD_SERVER_FILE);
+	int failed = tee_close(&tee);
+	if(tee.total < expected) failed = count; // cancelled or interrupted
+	char received[2 * MD5_DIGEST_LENGTH + 1];
+	for(int i = 0;i < MD5_DIGEST_LENGTH;i++){
+		sprintf(received + 2 * i, "%02x", tee.digest[i]);
+	}
+	if(tee.total == expected && strcmp(received, digest) != 0){
+		fprintf(stderr, "ERROR: MD5 mismatch, expected [%s]\n", digest);
+		failed = count;
+	}
+	if(cache_file != NULL){ // a short transfer stays as a partial image, to be resumed later
+		fclose(cache_file);
+		if(tee.total == expected){
+			if(strcmp(received, digest) == 0) cache_commit(digest);
+			else cache_discard(digest);
+		}
+	}
+	// print partitions (a single partition has no partition table of its own)
+	for(int i = 0;i < tee.count && failed == 0 && strcmp(partition, "0") == 0;i++){
+		if(tee.targets[i].verified) print_partition(tee.targets[i].path);
+	}
+	return failed;
 }
 
 /// calculates MD5 hash for *target* file
@@ -0,0 +1,50 @@
+/*
+ * frame.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#include <string.h>
+#include <arpa/inet.h>
+#include <global.h>
+#include <frame.h>
+
+/// writes a frame header
+/// @param buffer the buffer in which to store the header, **must be at least FRAME_HEADER_SIZE bytes long**
+/// @param type FRAME_HELLO, FRAME_COMMAND or FRAME_REPLY
+/// @param status status of the reply (0 for other frames)
+/// @param seq sequence number
+/// @param length payload length
+void frame_encode(char* buffer, uint8_t type, uint16_t status, uint32_t seq, uint32_t length){
+	uint16_t status_n = htons(status);
+	uint32_t seq_n = htonl(seq);
+	uint32_t length_n = htonl(length);
+	buffer[0] = (char) FRAME_MAGIC;
+	buffer[1] = (char) type;
+	memcpy(buffer + 2, &status_n, 2);
+	memcpy(buffer + 4, &seq_n, 4);
+	memcpy(buffer + 8, &length_n, 4);
+}
+
+/// reads a frame header
+/// @param buffer the received bytes
+/// @param available amount of received bytes
+/// @param header where the header is stored
+/// @returns TRUE if a whole frame (header and payload) is available, FALSE if more bytes are needed, INEX if the frame is malformed
+int frame_decode(const char* buffer, size_t available, struct frame_header* header){
+	if(available > 0 && (unsigned char) buffer[0] != FRAME_MAGIC) return INEX;
+	if(available < FRAME_HEADER_SIZE) return FALSE;
+	uint16_t status_n;
+	uint32_t seq_n;
+	uint32_t length_n;
+	memcpy(&status_n, buffer + 2, 2);
+	memcpy(&seq_n, buffer + 4, 4);
+	memcpy(&length_n, buffer + 8, 4);
+	header->type = (uint8_t) buffer[1];
+	header->status = ntohs(status_n);
+	header->seq = ntohl(seq_n);
+	header->length = ntohl(length_n);
+	if(header->length > FRAME_MAX_PAYLOAD) return INEX;
+	return available >= FRAME_HEADER_SIZE + header->length ? TRUE : FALSE;
+}
@@ -0,0 +1,45 @@
+/*
+ * frame.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#ifndef FRAME_H_
+#define FRAME_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+/*
+ * framed protocol between the client and SERVER_MAIN, every message is
+ *
+ *   [magic:1][type:1][status:2][seq:4][length:4][payload:length]   (network byte order)
+ *
+ * so commands and replies can be split or coalesced by TCP, and replies can be of any size.
+ * after the "OK" greeting the client sends a FRAME_HELLO with the highest version it speaks,
+ * SERVER_MAIN answers with the version both will use. Text commands never start with
+ * FRAME_MAGIC, so old clients keep using the text protocol, and old servers answer the
+ * hello with plain text, which tells new clients to fall back to it
+ */
+
+#define FRAME_MAGIC 0xA5 ///< first byte of every frame
+#define FRAME_VERSION 1 ///< highest protocol version spoken
+#define FRAME_HEADER_SIZE 12 ///< size of the frame header (bytes)
+#define FRAME_MAX_PAYLOAD (1024 * 1024) ///< maximum size of a payload (bytes)
+
+#define FRAME_HELLO 1 ///< version negotiation, payload: version (2 bytes)
+#define FRAME_COMMAND 2 ///< client command, payload: the command
+#define FRAME_REPLY 3 ///< reply to the command with the same seq, payload: the reply
+
+struct frame_header{
+	uint8_t type;
+	uint16_t status; ///< REPLY_OK or REPLY_FAILED on replies
+	uint32_t seq;
+	uint32_t length; ///< payload length
+};
+
+void frame_encode(char* buffer, uint8_t type, uint16_t status, uint32_t seq, uint32_t length);
+int frame_decode(const char* buffer, size_t available, struct frame_header* header);
+
+#endif /* FRAME_H_ */
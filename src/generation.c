@@ -0,0 +1,157 @@
+/*
+ * generation.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/mman.h>
+#include <global.h>
+#include <generation.h>
+
+/// a directory watched by generation_watch()
+struct generation_watcher{
+	struct generations* generations;
+	int which;
+	int FD; ///< inotify instance
+	char filename[NAME_MAX + 1]; ///< file within the directory, empty for every file
+};
+
+/// maps the generation region
+/// @param flags flags for shm_open()
+/// @returns the region, NULL on failure
+static struct generations* generation_map(int flags){
+	int FD = shm_open(GENERATION_NAME, flags, 0666);
+	if(FD < 0){
+		fprintf(stderr, "ERROR: opening shared memory %s (%s)\n", GENERATION_NAME, strerror(errno));
+		return NULL;
+	}
+	if((flags & O_CREAT) && ftruncate(FD, sizeof(struct generations)) < 0){
+		fprintf(stderr, "ERROR: sizing shared memory %s (%s)\n", GENERATION_NAME, strerror(errno));
+		close(FD);
+		return NULL;
+	}
+	void* region = mmap(NULL, sizeof(struct generations), PROT_READ | PROT_WRITE, MAP_SHARED, FD, 0);
+	close(FD);
+	if(region == MAP_FAILED){
+		fprintf(stderr, "ERROR: mapping shared memory %s (%s)\n", GENERATION_NAME, strerror(errno));
+		return NULL;
+	}
+	return region;
+}
+
+/// creates the generation region (SERVER_MAIN), every generation starts at 1
+/// @returns the region, NULL on failure
+struct generations* generation_create(){
+	shm_unlink(GENERATION_NAME);
+	struct generations* generations = generation_map(O_RDWR | O_CREAT | O_EXCL);
+	if(generations == NULL) return NULL;
+	for(int i = 0;i < GENERATION_COUNT;i++){
+		atomic_store(&generations->values[i], 1);
+	}
+	return generations;
+}
+
+/// attaches to the generation region created by SERVER_MAIN
+/// @returns the region, NULL on failure
+struct generations* generation_attach(){
+	return generation_map(O_RDWR);
+}
+
+/// removes the generation region
+/// @param generations the region
+void generation_destroy(struct generations* generations){
+	if(generations == NULL) return;
+	munmap(generations, sizeof(struct generations));
+	shm_unlink(GENERATION_NAME);
+}
+
+/// reads a generation
+/// @param generations the region (NULL if unavailable)
+/// @param which GENERATION_FILE or GENERATION_AUTH
+/// @returns the current generation, 0 if unknown
+unsigned long generation_get(struct generations* generations, int which){
+	if(generations == NULL) return 0;
+	return atomic_load(&generations->values[which]);
+}
+
+/// marks the data behind a generation as changed
+/// @param generations the region (NULL if unavailable)
+/// @param which GENERATION_FILE or GENERATION_AUTH
+void generation_bump(struct generations* generations, int which){
+	if(generations == NULL) return;
+	atomic_fetch_add(&generations->values[which], 1);
+}
+
+/// watcher thread: bumps a generation whenever a file of the watched directory changes
+/// @param arg the generation_watcher
+static void* generation_watcher(void* arg){
+	struct generation_watcher* watcher = (struct generation_watcher*) arg;
+	char buffer[GENERATION_EVENTS] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while(TRUE){
+		ssize_t R = read(watcher->FD, buffer, sizeof(buffer));
+		if(R <= 0){
+			if(R < 0 && errno == EINTR) continue;
+			fprintf(stderr, "ERROR: watching for changes (%s)\n", R < 0 ? strerror(errno) : "closed");
+			break;
+		}
+		int changed = FALSE;
+		for(char* ptr = buffer;ptr < buffer + R;ptr += sizeof(struct inotify_event) + ((struct inotify_event*) ptr)->len){
+			struct inotify_event* event = (struct inotify_event*) ptr;
+			if(event->mask & IN_Q_OVERFLOW) changed = TRUE; // events were lost, assume the worst
+			else if(strcmp(watcher->filename, "") == 0 || (event->len > 0 && strcmp(event->name, watcher->filename) == 0)) changed = TRUE;
+		}
+		if(changed) generation_bump(watcher->generations, watcher->which);
+	}
+	close(watcher->FD);
+	free(watcher);
+	return NULL;
+}
+
+/// starts a thread that bumps a generation whenever a directory (or a file within it) changes
+///
+/// files replaced with rename() are caught too, since the directory is watched rather than the file
+/// @param generations the region
+/// @param which GENERATION_FILE or GENERATION_AUTH
+/// @param directory the directory to watch
+/// @param filename the file within the directory, NULL for every file
+/// @returns 1 on success, 0 on failure
+int generation_watch(struct generations* generations, int which, const char* directory, const char* filename){
+	struct generation_watcher* watcher = malloc(sizeof(struct generation_watcher));
+	if(watcher == NULL){
+		fprintf(stderr, "ERROR: allocating watcher (%s)\n", strerror(errno));
+		return FALSE;
+	}
+	watcher->generations = generations;
+	watcher->which = which;
+	snprintf(watcher->filename, sizeof(watcher->filename), "%s", filename == NULL ? "" : filename);
+	if((watcher->FD = inotify_init()) < 0){
+		fprintf(stderr, "ERROR: creating inotify instance (%s)\n", strerror(errno));
+		free(watcher);
+		return FALSE;
+	}
+	uint32_t mask = IN_CREATE | IN_DELETE | IN_MODIFY | IN_ATTRIB | IN_MOVED_FROM | IN_MOVED_TO;
+	if(inotify_add_watch(watcher->FD, directory, mask) < 0){
+		fprintf(stderr, "ERROR: watching %s (%s)\n", directory, strerror(errno));
+		close(watcher->FD);
+		free(watcher);
+		return FALSE;
+	}
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, generation_watcher, watcher) != 0){
+		fprintf(stderr, "ERROR: creating watcher thread (%s)\n", strerror(errno));
+		close(watcher->FD);
+		free(watcher);
+		return FALSE;
+	}
+	pthread_detach(thread);
+	return TRUE;
+}
@@ -0,0 +1,44 @@
+/*
+ * generation.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#ifndef GENERATION_H_
+#define GENERATION_H_
+
+#include <stdatomic.h>
+#include <limits.h>
+
+/*
+ * generation numbers of the data behind the backend listings, in shared memory:
+ *
+ *   SERVER_FILE  generation_bump(GENERATION_FILE) whenever the images folder changes
+ *   SERVER_AUTH  generation_bump(GENERATION_AUTH) whenever the user database changes
+ *   SERVER_MAIN  caches listings along with the generation they were built from, and serves them
+ *                from memory while the generation stays the same
+ *
+ * backends bump their generation when they start (their data may have changed while they were
+ * down), when they change the data themselves, and from a watcher thread (generation_watch())
+ * when the data is changed by someone else, e.g. an image copied into the images folder
+ */
+
+#define GENERATION_NAME "/os_image_tool_generation" ///< name of the shared memory region
+#define GENERATION_FILE 0 ///< images served by SERVER_FILE
+#define GENERATION_AUTH 1 ///< users known by SERVER_AUTH
+#define GENERATION_COUNT 2
+#define GENERATION_EVENTS 4096 ///< size of the inotify buffer of generation_watch() (bytes)
+
+struct generations{
+	_Atomic unsigned long values[GENERATION_COUNT]; ///< 0 means unknown, never cached
+};
+
+struct generations* generation_create();
+struct generations* generation_attach();
+void generation_destroy(struct generations* generations);
+unsigned long generation_get(struct generations* generations, int which);
+void generation_bump(struct generations* generations, int which);
+int generation_watch(struct generations* generations, int which, const char* directory, const char* filename);
+
+#endif /* GENERATION_H_ */
@@ -16,10 +16,17 @@
 #define BUFFER_SIZE 1024 ///< default buffer size for socket communications
 #define OK "OK" ///< 'OK' message
 #define NO "NO" ///< 'NO' message
+#define CACHED "CACHED" ///< 'CACHED' message, the client already has the image and needs no transfer
+#define BATCH_TAG "#" ///< prefix of pipelined commands and replies: "#<seq> <command>\n" / "#<seq> <status> <length>\n<reply>"
+#define REPLY_OK 0 ///< status of a pipelined reply whose command succeeded
+#define REPLY_FAILED 1 ///< status of a pipelined reply whose command failed
 
 // SERVER_MAIN
 #define SERVER_MAIN_PORT 37777 ///< default port for communication with client
 
+// SERVER_AUTH
+#define MAX_USERNAME_SIZE 30 ///< maximum username length
+
 // SERVER_FILE
 #define MAX_FILENAME_SIZE 256 ///< maximum filename size
 #define START_FILE_TRANSFER_MSG "SETUP_FILETRANSFER" ///< 'signal' used to informe client to start preparations for file transfer
@@ -0,0 +1,552 @@
+/*
+ ============================================================================
+ Name        : ipc_bench.c
+ Author      : Seba Murillo
+ Version     : 1.0
+ Copyright   : GPL
+ Description : round-trip latency and throughput of the transports between SERVER_MAIN and its backends
+ ============================================================================
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <mqueue.h>
+#include <poll.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <global.h>
+#include <message.h>
+
+#define BENCH_RING_NAME "/os_image_tool_bench" ///< shared memory region used by the benchmark, so running servers are not disturbed
+#define BENCH_MQ_NAME "/os_image_tool_bench_%d" ///< POSIX queues used by the benchmark, -1 for the requests
+#define BENCH_ITERATIONS 10000 ///< default amount of round trips per test, split among the requesters
+#define BENCH_MAX_REQUESTERS 8 ///< maximum amount of concurrent requesters (each one reads its own message type)
+#define BENCH_REQUEST_TYPE SERVER_AUTH_MSG_TYPE ///< message type read by the echo backend
+#define BENCH_REPLY_TYPE 8 ///< message type read by the first requester, the rest follow (lower than RING_COUNT)
+#define BENCH_MQ_MAXMSG 10 ///< messages of each POSIX queue (the default limit of fs.mqueue.msg_max)
+#define BENCH_MQ_MSGSIZE 8192 ///< size of each POSIX message (the default limit of fs.mqueue.msgsize_max)
+#define BENCH_MAX_SIZE (64 * 1024) ///< largest payload tested
+
+/*
+ * every test runs an echo backend (like SERVER_AUTH) and 1 to N requesters (like the clients of
+ * SERVER_MAIN) as separate processes, each requester with one request in flight at a time:
+ *
+ *   requester i -> request (BENCH_REQUEST_TYPE) -> echo backend -> response (BENCH_REPLY_TYPE + i) -> requester i
+ *
+ * transports:
+ *   sysv  the systemV queue through message.h, as the servers use it (send_large() above MESSAGE_SIZE)
+ *   shm   the shared memory rings through message.h (OS_IMAGE_IPC=shm)
+ *   mq    POSIX message queues, one for the requests and one per requester
+ *   unix  UNIX domain stream sockets, one per requester, length-prefixed
+ *
+ * the results are printed one test per line, in columns separated by spaces, so they can be
+ * compared between runs (or machines) with the usual text tools. Tests that can not run print
+ * "-" in every result column, and the reason on stderr
+ */
+
+/// a chunk of a POSIX message queue message, see mq_request()
+struct mq_chunk{
+	long request; ///< request ID, 0 stops the echo backend
+	int requester; ///< requester whose queue the response goes to
+	uint32_t flags; ///< MESSAGE_MORE
+	uint32_t length; ///< bytes of data
+	char data[];
+};
+
+/// a transport under test
+struct transport{
+	const char* name;
+	int (*setup)(int requesters, size_t size); ///< prepares the transport before forking, returns 0 to skip the test
+	void (*echo)(int requesters); ///< echo backend, never returns
+	void (*request)(int requester, long id, char* data, size_t length); ///< one round trip, the response is stored in *data*
+	void (*stop)(int requesters); ///< tells the echo backend to exit
+	void (*release)(int requesters); ///< releases the transport, once the echo backend exited
+};
+
+mqd_t MQ_requests = (mqd_t) -1; ///< requests of the mq transport
+mqd_t MQ_responses[BENCH_MAX_REQUESTERS]; ///< responses of the mq transport, one queue per requester
+int FD_echo[BENCH_MAX_REQUESTERS]; ///< echo backend ends of the unix transport
+int FD_requester[BENCH_MAX_REQUESTERS]; ///< requester ends of the unix transport
+
+int message_setup(int requesters, size_t size);
+int ring_setup(int requesters, size_t size);
+void message_echo(int requesters);
+void message_request(int requester, long id, char* data, size_t length);
+void message_stop(int requesters);
+void message_release(int requesters);
+mqd_t mq_create(int index);
+void mq_send_chunks(mqd_t queue, long request, int requester, const char* data, size_t length);
+int mq_setup(int requesters, size_t size);
+void mq_echo(int requesters);
+void mq_request(int requester, long id, char* data, size_t length);
+void mq_stop(int requesters);
+void mq_release(int requesters);
+int unix_setup(int requesters, size_t size);
+void unix_echo(int requesters);
+void unix_request(int requester, long id, char* data, size_t length);
+void unix_stop(int requesters);
+void unix_release(int requesters);
+int read_full(int FD, void* buffer, size_t length);
+int write_full(int FD, const void* buffer, size_t length);
+void run_test(const struct transport* transport, size_t size, int requesters, int iterations);
+int compare_times(const void* a, const void* b);
+
+const struct transport TRANSPORTS[] = {
+	{"sysv", message_setup, message_echo, message_request, message_stop, message_release},
+	{"shm", ring_setup, message_echo, message_request, message_stop, message_release},
+	{"mq", mq_setup, mq_echo, mq_request, mq_stop, mq_release},
+	{"unix", unix_setup, unix_echo, unix_request, unix_stop, unix_release},
+};
+const size_t SIZES[] = {16, 256, 1024, 4096, 16384, BENCH_MAX_SIZE}; ///< payload sizes tested (bytes)
+
+/// benchmark program entrypoint
+///
+/// use: ipc_bench [iterations] [requesters], every transport is tested with every payload size and 1, 2, 4... up
+/// to *requesters* concurrent requesters
+/// @returns 1 on error, 0 on success
+int main(int argc, char* argv[]){
+	int iterations = argc > 1 ? (int) strtol(argv[1], NULL, 10) : BENCH_ITERATIONS;
+	int requesters = argc > 2 ? (int) strtol(argv[2], NULL, 10) : 4;
+	if(iterations <= 0 || requesters <= 0 || requesters > BENCH_MAX_REQUESTERS){
+		fprintf(stderr, "> use: %s [iterations] [requesters (max: %d)]\n", argv[0], BENCH_MAX_REQUESTERS);
+		exit(EXIT_FAILURE);
+	}
+	printf("# round trip latency (us) and requests answered per second, %d round trips per test\n", iterations);
+	printf("%-10s %-8s %-11s %-11s %-10s %-10s %-10s %-10s %-10s %-12s\n", "transport", "bytes", "requesters", "round_trips",
+			"avg_us", "p50_us", "p99_us", "p999_us", "max_us", "requests_s");
+	for(size_t t = 0;t < sizeof(TRANSPORTS) / sizeof(TRANSPORTS[0]);t++){
+		for(size_t s = 0;s < sizeof(SIZES) / sizeof(SIZES[0]);s++){
+			for(int r = 1;r <= requesters;r *= 2){
+				run_test(&TRANSPORTS[t], SIZES[s], r, iterations);
+			}
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+/// runs *iterations* round trips of *size* bytes, split among *requesters* concurrent requesters, and prints the results
+/// @param transport the transport
+/// @param size size of each request and response (bytes)
+/// @param requesters amount of concurrent requesters
+/// @param iterations total amount of round trips
+void run_test(const struct transport* transport, size_t size, int requesters, int iterations){
+	int per_requester = iterations / requesters;
+	int count = per_requester * requesters;
+	fflush(stdout); // the children must not inherit pending output
+	if(count == 0 || transport->setup(requesters, size) == FALSE){
+		printf("%-10s %-8zu %-11d %-11d %-10s %-10s %-10s %-10s %-10s %-12s\n", transport->name, size, requesters, 0, "-", "-", "-", "-", "-", "-");
+		return;
+	}
+	double* times = mmap(NULL, (size_t) count * sizeof(double), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	int start[2];
+	if(times == MAP_FAILED || pipe(start) < 0){
+		fprintf(stderr, "ERROR: preparing test (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	pid_t echo = fork();
+	if(echo < 0){
+		fprintf(stderr, "ERROR: forking echo backend (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if(echo == 0){
+		close(start[0]);
+		close(start[1]);
+		transport->echo(requesters);
+	}
+	pid_t pids[BENCH_MAX_REQUESTERS];
+	for(int r = 0;r < requesters;r++){
+		if((pids[r] = fork()) < 0){
+			fprintf(stderr, "ERROR: forking requester (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		if(pids[r] > 0) continue;
+		close(start[1]);
+		char go;
+		if(read(start[0], &go, 1) < 0) exit(EXIT_FAILURE); // every requester starts at once, when the pipe is closed
+		char* data = malloc(size);
+		for(int i = 0;i < per_requester;i++){
+			struct timespec before, after;
+			memset(data, 'a' + (i + r) % 26, size);
+			clock_gettime(CLOCK_MONOTONIC, &before);
+			transport->request(r, (long) (r + 1) * 1000000000L + i + 1, data, size);
+			clock_gettime(CLOCK_MONOTONIC, &after);
+			if(data[0] != 'a' + (i + r) % 26 || data[size - 1] != 'a' + (i + r) % 26){
+				fprintf(stderr, "ERROR: %s returned a wrong response\n", transport->name);
+				exit(EXIT_FAILURE);
+			}
+			times[r * per_requester + i] = (double) (after.tv_sec - before.tv_sec) * 1e6 + (double) (after.tv_nsec - before.tv_nsec) / 1e3;
+		}
+		exit(EXIT_SUCCESS);
+	}
+	struct timespec begin, end;
+	close(start[0]);
+	clock_gettime(CLOCK_MONOTONIC, &begin);
+	close(start[1]);
+	int failed = FALSE;
+	for(int r = 0;r < requesters;r++){
+		int status;
+		waitpid(pids[r], &status, 0);
+		if(!WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS) failed = TRUE;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	transport->stop(requesters);
+	waitpid(echo, NULL, 0);
+	transport->release(requesters);
+	if(failed){
+		fprintf(stderr, "ERROR: %s test failed\n", transport->name);
+		exit(EXIT_FAILURE);
+	}
+	double total = 0;
+	for(int i = 0;i < count;i++){
+		total += times[i];
+	}
+	qsort(times, (size_t) count, sizeof(double), compare_times);
+	double elapsed = (double) (end.tv_sec - begin.tv_sec) + (double) (end.tv_nsec - begin.tv_nsec) / 1e9;
+	printf("%-10s %-8zu %-11d %-11d %-10.2f %-10.2f %-10.2f %-10.2f %-10.2f %-12.0f\n", transport->name, size, requesters, count,
+			total / count, times[count / 2], times[(long) count * 99 / 100], times[(long) count * 999 / 1000], times[count - 1],
+			count / elapsed);
+	munmap(times, (size_t) count * sizeof(double));
+}
+
+/// prepares the systemV queue, large enough for a request and a response of every requester
+/// @param requesters amount of concurrent requesters
+/// @param size size of each request and response (bytes)
+/// @returns 1 on success, 0 if the queue can not hold them (the echo backend and the requesters would block each other)
+int message_setup(int requesters, size_t size){
+	if((Q_ID = msgget(IPC_PRIVATE, 0600 | IPC_CREAT)) < 0){
+		fprintf(stderr, "ERROR: creating systemV queue (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	size_t messages = (size + MESSAGE_SIZE - 1) / MESSAGE_SIZE;
+	msglen_t needed = (msglen_t) (2 * (size_t) requesters * (size + messages * MESSAGE_HEADER));
+	struct msqid_ds queue;
+	msgctl(Q_ID, IPC_STAT, &queue);
+	if(queue.msg_qbytes < needed){
+		queue.msg_qbytes = needed;
+		msgctl(Q_ID, IPC_SET, &queue);
+		msgctl(Q_ID, IPC_STAT, &queue);
+	}
+	if(queue.msg_qbytes < needed){
+		fprintf(stderr, "> sysv: skipping %zu bytes with %d requester(s), the queue can not be grown to %lu bytes\n", size, requesters, (unsigned long) needed);
+		msgctl(Q_ID, IPC_RMID, NULL);
+		Q_ID = -1;
+		return FALSE;
+	}
+	return TRUE;
+}
+
+/// prepares the shared memory rings
+/// @param requesters unused
+/// @param size unused
+/// @returns 1 on success
+int ring_setup(int requesters, size_t size){
+	(void) requesters;
+	(void) size;
+	if((RINGS = ring_create(BENCH_RING_NAME)) == NULL) exit(EXIT_FAILURE);
+	return TRUE;
+}
+
+/// echoes every request back to its reply address through message.h, like SERVER_AUTH would answer it
+/// @param requesters unused
+void message_echo(int requesters){
+	(void) requesters;
+	while(TRUE){
+		long request;
+		long reply;
+		size_t length;
+		char* data = receive_large(BENCH_REQUEST_TYPE, &request, &reply, &length);
+		if(data == NULL || request == 0) exit(EXIT_SUCCESS);
+		send_large(reply, request, 0, data, length);
+		free(data);
+	}
+}
+
+/// one round trip through message.h
+/// @param requester the requester
+/// @param id the request ID
+/// @param data the request, replaced by the response
+/// @param length size of the request
+void message_request(int requester, long id, char* data, size_t length){
+	long response;
+	size_t response_length;
+	send_large(BENCH_REQUEST_TYPE, id, BENCH_REPLY_TYPE + requester, data, length);
+	char* received = receive_large(BENCH_REPLY_TYPE + requester, &response, NULL, &response_length);
+	if(received == NULL || response != id || response_length != length){
+		fprintf(stderr, "ERROR: response to request %ld, expected %ld\n", response, id);
+		exit(EXIT_FAILURE);
+	}
+	memcpy(data, received, length);
+	free(received);
+}
+
+/// tells the echo backend to exit (request 0)
+/// @param requesters unused
+void message_stop(int requesters){
+	(void) requesters;
+	send_large(BENCH_REQUEST_TYPE, 0, 0, "", 0);
+}
+
+/// removes the systemV queue or the rings
+/// @param requesters unused
+void message_release(int requesters){
+	(void) requesters;
+	if(RINGS != NULL){
+		ring_destroy(RINGS, BENCH_RING_NAME);
+		RINGS = NULL;
+	}else{
+		msgctl(Q_ID, IPC_RMID, NULL);
+		Q_ID = -1;
+	}
+}
+
+/// opens a POSIX message queue of the benchmark
+/// @param index the requester, -1 for the requests
+/// @returns the queue, (mqd_t) -1 on failure
+mqd_t mq_create(int index){
+	char name[64];
+	sprintf(name, BENCH_MQ_NAME, index);
+	mq_unlink(name); // leftover of an interrupted run
+	struct mq_attr attributes = {.mq_maxmsg = BENCH_MQ_MAXMSG, .mq_msgsize = BENCH_MQ_MSGSIZE};
+	mqd_t queue = mq_open(name, O_RDWR | O_CREAT | O_EXCL, 0600, &attributes);
+	mq_unlink(name); // removed once every process closes it
+	return queue;
+}
+
+/// prepares the POSIX message queues
+/// @param requesters amount of concurrent requesters
+/// @param size unused
+/// @returns 1 on success, 0 if POSIX message queues are not available
+int mq_setup(int requesters, size_t size){
+	(void) size;
+	if((MQ_requests = mq_create(-1)) == (mqd_t) -1){
+		fprintf(stderr, "> mq: skipping, unable to open a POSIX message queue (%s)\n", strerror(errno));
+		return FALSE;
+	}
+	for(int r = 0;r < requesters;r++){
+		if((MQ_responses[r] = mq_create(r)) == (mqd_t) -1){
+			fprintf(stderr, "> mq: skipping, unable to open a POSIX message queue (%s)\n", strerror(errno));
+			for(int i = 0;i < r;i++) mq_close(MQ_responses[i]);
+			mq_close(MQ_requests);
+			return FALSE;
+		}
+	}
+	return TRUE;
+}
+
+/// sends data of any length through a POSIX message queue, as chunks of BENCH_MQ_MSGSIZE bytes
+/// @param queue the queue
+/// @param request request ID
+/// @param requester the requester the data comes from or goes to
+/// @param data the bytes to be sent
+/// @param length amount of bytes
+void mq_send_chunks(mqd_t queue, long request, int requester, const char* data, size_t length){
+	char buffer[BENCH_MQ_MSGSIZE];
+	struct mq_chunk* chunk = (struct mq_chunk*) buffer;
+	size_t room = BENCH_MQ_MSGSIZE - sizeof(struct mq_chunk);
+	size_t offset = 0;
+	do{
+		size_t part = length - offset < room ? length - offset : room;
+		chunk->request = request;
+		chunk->requester = requester;
+		chunk->length = (uint32_t) part;
+		chunk->flags = offset + part < length ? MESSAGE_MORE : 0;
+		memcpy(chunk->data, data + offset, part);
+		if(mq_send(queue, buffer, sizeof(struct mq_chunk) + part, 0) < 0){
+			fprintf(stderr, "ERROR: sending POSIX message (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		offset += part;
+	}while(offset < length);
+}
+
+/// echoes every request back to the queue of its requester, chunks of concurrent requests are put together apart
+/// @param requesters amount of concurrent requesters
+void mq_echo(int requesters){
+	char buffer[BENCH_MQ_MSGSIZE];
+	char* data[BENCH_MAX_REQUESTERS];
+	size_t lengths[BENCH_MAX_REQUESTERS] = {0};
+	for(int r = 0;r < requesters;r++){
+		data[r] = malloc(BENCH_MAX_SIZE);
+	}
+	while(TRUE){
+		if(mq_receive(MQ_requests, buffer, BENCH_MQ_MSGSIZE, NULL) < 0){
+			fprintf(stderr, "ERROR: receiving POSIX message (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		struct mq_chunk* chunk = (struct mq_chunk*) buffer;
+		if(chunk->request == 0) exit(EXIT_SUCCESS);
+		int r = chunk->requester;
+		memcpy(data[r] + lengths[r], chunk->data, chunk->length);
+		lengths[r] += chunk->length;
+		if(chunk->flags & MESSAGE_MORE) continue;
+		mq_send_chunks(MQ_responses[r], chunk->request, r, data[r], lengths[r]);
+		lengths[r] = 0;
+	}
+}
+
+/// one round trip through POSIX message queues
+/// @param requester the requester
+/// @param id the request ID
+/// @param data the request, replaced by the response
+/// @param length size of the request
+void mq_request(int requester, long id, char* data, size_t length){
+	char buffer[BENCH_MQ_MSGSIZE];
+	mq_send_chunks(MQ_requests, id, requester, data, length);
+	size_t received = 0;
+	struct mq_chunk* chunk = (struct mq_chunk*) buffer;
+	do{
+		if(mq_receive(MQ_responses[requester], buffer, BENCH_MQ_MSGSIZE, NULL) < 0 || chunk->request != id
+				|| received + chunk->length > length){
+			fprintf(stderr, "ERROR: receiving POSIX message (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		memcpy(data + received, chunk->data, chunk->length);
+		received += chunk->length;
+	}while(chunk->flags & MESSAGE_MORE);
+}
+
+/// tells the echo backend to exit (request 0)
+/// @param requesters unused
+void mq_stop(int requesters){
+	(void) requesters;
+	mq_send_chunks(MQ_requests, 0, 0, "", 0);
+}
+
+/// closes the POSIX message queues (already unlinked, see mq_create())
+/// @param requesters amount of concurrent requesters
+void mq_release(int requesters){
+	mq_close(MQ_requests);
+	for(int r = 0;r < requesters;r++){
+		mq_close(MQ_responses[r]);
+	}
+}
+
+/// prepares a pair of connected UNIX sockets for every requester
+/// @param requesters amount of concurrent requesters
+/// @param size unused
+/// @returns 1 on success
+int unix_setup(int requesters, size_t size){
+	(void) size;
+	for(int r = 0;r < requesters;r++){
+		int pair[2];
+		if(socketpair(AF_UNIX, SOCK_STREAM, 0, pair) < 0){
+			fprintf(stderr, "ERROR: creating UNIX sockets (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		FD_echo[r] = pair[0];
+		FD_requester[r] = pair[1];
+	}
+	return TRUE;
+}
+
+/// echoes every request back through the socket it came from, until every requester is gone
+/// @param requesters amount of concurrent requesters
+void unix_echo(int requesters){
+	struct pollfd FDs[BENCH_MAX_REQUESTERS];
+	char* data = malloc(BENCH_MAX_SIZE);
+	for(int r = 0;r < requesters;r++){
+		close(FD_requester[r]); // so the requesters leaving is noticed
+		FDs[r].fd = FD_echo[r];
+		FDs[r].events = POLLIN;
+	}
+	int open = requesters;
+	while(open > 0){
+		if(poll(FDs, (nfds_t) requesters, -1) < 0){
+			if(errno == EINTR) continue;
+			fprintf(stderr, "ERROR: polling UNIX sockets (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		for(int r = 0;r < requesters;r++){
+			if(FDs[r].fd < 0 || FDs[r].revents == 0) continue;
+			uint32_t length;
+			if(read_full(FDs[r].fd, &length, sizeof(length)) == FALSE || length > BENCH_MAX_SIZE || read_full(FDs[r].fd, data, length) == FALSE){
+				close(FDs[r].fd);
+				FDs[r].fd = -1; // ignored by poll()
+				open--;
+				continue;
+			}
+			if(write_full(FDs[r].fd, &length, sizeof(length)) == FALSE || write_full(FDs[r].fd, data, length) == FALSE){
+				fprintf(stderr, "ERROR: writing to UNIX socket (%s)\n", strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+		}
+	}
+	exit(EXIT_SUCCESS);
+}
+
+/// one round trip through a UNIX socket
+/// @param requester the requester
+/// @param id unused, the socket belongs to the requester
+/// @param data the request, replaced by the response
+/// @param length size of the request
+void unix_request(int requester, long id, char* data, size_t length){
+	(void) id;
+	uint32_t header = (uint32_t) length;
+	if(write_full(FD_requester[requester], &header, sizeof(header)) == FALSE || write_full(FD_requester[requester], data, length) == FALSE
+			|| read_full(FD_requester[requester], &header, sizeof(header)) == FALSE || header != length
+			|| read_full(FD_requester[requester], data, length) == FALSE){
+		fprintf(stderr, "ERROR: round trip through UNIX socket (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/// closes the requester ends of the UNIX sockets, the echo backend exits once it reads the end of all of them
+/// @param requesters amount of concurrent requesters
+void unix_stop(int requesters){
+	for(int r = 0;r < requesters;r++){
+		close(FD_requester[r]);
+	}
+}
+
+/// closes the echo backend ends of the UNIX sockets
+/// @param requesters amount of concurrent requesters
+void unix_release(int requesters){
+	for(int r = 0;r < requesters;r++){
+		close(FD_echo[r]);
+	}
+}
+
+/// reads exactly *length* bytes
+/// @param FD the socket
+/// @param buffer where the bytes are stored
+/// @param length amount of bytes
+/// @returns 1 on success, 0 on failure or end of file
+int read_full(int FD, void* buffer, size_t length){
+	size_t done = 0;
+	while(done < length){
+		ssize_t R = read(FD, (char*) buffer + done, length - done);
+		if(R < 0 && errno == EINTR) continue;
+		if(R <= 0) return FALSE;
+		done += (size_t) R;
+	}
+	return TRUE;
+}
+
+/// writes exactly *length* bytes
+/// @param FD the socket
+/// @param buffer the bytes
+/// @param length amount of bytes
+/// @returns 1 on success, 0 on failure
+int write_full(int FD, const void* buffer, size_t length){
+	size_t done = 0;
+	while(done < length){
+		ssize_t W = write(FD, (const char*) buffer + done, length - done);
+		if(W < 0 && errno == EINTR) continue;
+		if(W <= 0) return FALSE;
+		done += (size_t) W;
+	}
+	return TRUE;
+}
+
+/// qsort() comparison for doubles
+int compare_times(const void* a, const void* b){
+	double x = *(const double*) a;
+	double y = *(const double*) b;
+	return (x > y) - (x < y);
+}
@@ -0,0 +1,179 @@
+/*
+ * jobs.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/socket.h>
+#include <jobs.h>
+
+static struct job jobs[MAX_JOBS]; ///< job table, shared by every thread
+static int next_job_id = 1;
+static pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t jobs_finished = PTHREAD_COND_INITIALIZER;
+
+static const char* job_states[] = {"free", "running", "done", "FAILED", "cancelled"};
+
+/// job thread: runs the job function and stores its result
+/// @param arg the job to run
+static void* job_thread(void* arg){
+	struct job* job = (struct job*) arg;
+	int result = job->function(job);
+	pthread_mutex_lock(&jobs_lock);
+	job->result = result;
+	if(job->cancel) job->state = JOB_CANCELLED;
+	else job->state = result == 0 ? JOB_DONE : JOB_FAILED;
+	job->FD = INEX;
+	printf("[CLIENT]: job [%d] %s\n", job->id, job_states[job->state]);
+	fflush(stdout);
+	pthread_cond_broadcast(&jobs_finished);
+	pthread_mutex_unlock(&jobs_lock);
+	return NULL;
+}
+
+/// starts a job on its own thread
+///
+/// finished jobs stay in the table until waited for, if the table is full the oldest finished job is dropped
+/// @param ticket the transfer ticket given by SERVER_FILE
+/// @param port the port of the SERVER_FILE worker that gave the ticket
+/// @param command the command that started the job
+/// @param function the function run by the job, must return 0 on success
+/// @returns the job ID, 0 if the table is full of running jobs
+int job_start(long ticket, int port, const char* command, int (*function)(struct job* job)){
+	pthread_mutex_lock(&jobs_lock);
+	struct job* job = NULL;
+	for(int i = 0;i < MAX_JOBS;i++){
+		if(jobs[i].state == JOB_FREE){
+			job = &jobs[i];
+			break;
+		}
+		if(jobs[i].state != JOB_RUNNING && (job == NULL || jobs[i].id < job->id)){
+			job = &jobs[i];
+		}
+	}
+	if(job == NULL){
+		pthread_mutex_unlock(&jobs_lock);
+		fprintf(stderr, "ERROR: too many jobs running (max: %d)\n", MAX_JOBS);
+		return 0;
+	}
+	memset(job, 0, sizeof(struct job));
+	job->id = next_job_id++;
+	job->state = JOB_RUNNING;
+	job->ticket = ticket;
+	job->port = port;
+	job->FD = INEX;
+	job->function = function;
+	strncpy(job->command, command, MAX_COMMAND_SIZE - 1);
+	if(pthread_create(&job->thread, NULL, job_thread, job) != 0){
+		fprintf(stderr, "ERROR: creating job thread (%s)\n", strerror(errno));
+		job->state = JOB_FREE;
+		pthread_mutex_unlock(&jobs_lock);
+		return 0;
+	}
+	pthread_detach(job->thread);
+	int id = job->id;
+	pthread_mutex_unlock(&jobs_lock);
+	return id;
+}
+
+/// registers the socket used by a job, so job_cancel() can interrupt it
+/// @param job the job
+/// @param FD the transfer socket (INEX once closed)
+void job_set_socket(struct job* job, int FD){
+	pthread_mutex_lock(&jobs_lock);
+	job->FD = FD;
+	if(job->cancel && FD != INEX) shutdown(FD, SHUT_RDWR); // cancelled before connecting
+	pthread_mutex_unlock(&jobs_lock);
+}
+
+/// updates the progress of a job
+/// @param job the job
+/// @param received bytes received so far
+/// @param expected bytes expected (0 if unknown)
+void job_progress(struct job* job, unsigned long received, unsigned long expected){
+	pthread_mutex_lock(&jobs_lock);
+	job->received = received;
+	job->expected = expected;
+	pthread_mutex_unlock(&jobs_lock);
+}
+
+/// checks if a job was cancelled
+/// @param job the job
+/// @returns 1 if the job must stop, 0 otherwise
+int job_cancelled(struct job* job){
+	pthread_mutex_lock(&jobs_lock);
+	int cancel = job->cancel;
+	pthread_mutex_unlock(&jobs_lock);
+	return cancel;
+}
+
+/// cancels a running job
+/// @param id the job ID
+/// @returns 1 on success, 0 if the job does not exist or is not running
+int job_cancel(int id){
+	int result = FALSE;
+	pthread_mutex_lock(&jobs_lock);
+	for(int i = 0;i < MAX_JOBS;i++){
+		if(jobs[i].id != id || jobs[i].state != JOB_RUNNING) continue;
+		jobs[i].cancel = TRUE;
+		if(jobs[i].FD != INEX) shutdown(jobs[i].FD, SHUT_RDWR); // wake up recv()
+		result = TRUE;
+	}
+	pthread_mutex_unlock(&jobs_lock);
+	return result;
+}
+
+/// waits for a job (or every job) to finish and removes it from the table
+/// @param id the job ID, 0 for every job
+/// @returns the amount of waited jobs that did not finish successfully, INEX if the job does not exist
+int job_wait(int id){
+	int failed = 0;
+	int found = FALSE;
+	pthread_mutex_lock(&jobs_lock);
+	for(int i = 0;i < MAX_JOBS;i++){
+		if(jobs[i].state == JOB_FREE) continue;
+		if(id != 0 && jobs[i].id != id) continue;
+		found = TRUE;
+		while(jobs[i].state == JOB_RUNNING){
+			pthread_cond_wait(&jobs_finished, &jobs_lock);
+		}
+		if(jobs[i].state != JOB_DONE) failed++;
+		jobs[i].state = JOB_FREE;
+	}
+	pthread_mutex_unlock(&jobs_lock);
+	if(id != 0 && !found) return INEX;
+	return failed;
+}
+
+/// counts the running jobs
+/// @returns the amount of running jobs
+int job_running(){
+	int running = 0;
+	pthread_mutex_lock(&jobs_lock);
+	for(int i = 0;i < MAX_JOBS;i++){
+		if(jobs[i].state == JOB_RUNNING) running++;
+	}
+	pthread_mutex_unlock(&jobs_lock);
+	return running;
+}
+
+/// prints every job in the table and its progress
+void job_list(){
+	printf("> job list:\n");
+	printf(TAB "%-5s %-10s %-25s %s\n", "ID", "state", "progress (B)", "command");
+	pthread_mutex_lock(&jobs_lock);
+	for(int i = 0;i < MAX_JOBS;i++){
+		if(jobs[i].state == JOB_FREE) continue;
+		char progress[32];
+		if(jobs[i].expected > 0) sprintf(progress, "%lu/%lu", jobs[i].received, jobs[i].expected);
+		else sprintf(progress, "%lu", jobs[i].received);
+		printf(TAB "%-5d %-10s %-25s %s\n", jobs[i].id, job_states[jobs[i].state], progress, jobs[i].command);
+	}
+	pthread_mutex_unlock(&jobs_lock);
+	printf("\n");
+}
@@ -0,0 +1,57 @@
+/*
+ * jobs.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#ifndef JOBS_H_
+#define JOBS_H_
+
+#include <pthread.h>
+#include <global.h>
+
+/*
+ * background transfer manager: every 'file down' runs as a job on its own thread, so the prompt
+ * is available right away. job state and progress live in a single table shared by every thread
+ * (protected by one mutex), and are shown/handled with the client-side commands:
+ *
+ *   jobs            lists every job and its progress
+ *   wait [job_ID]   waits for a job (or every job) to finish
+ *   cancel <job_ID> cancels a running job
+ */
+
+#define MAX_JOBS 32 ///< maximum amount of jobs kept in the table
+#define MAX_COMMAND_SIZE 128 ///< maximum length of the command shown for a job
+
+#define JOB_FREE 0 ///< table slot is free
+#define JOB_RUNNING 1
+#define JOB_DONE 2
+#define JOB_FAILED 3
+#define JOB_CANCELLED 4
+
+struct job{
+	int id;
+	int state;
+	long ticket; ///< transfer ticket given by SERVER_FILE
+	int port; ///< port of the SERVER_FILE worker that gave the ticket
+	char command[MAX_COMMAND_SIZE];
+	pthread_t thread;
+	int cancel; ///< set by job_cancel(), checked by the job itself
+	int FD; ///< transfer socket, shut down by job_cancel() to wake the job up (INEX if none)
+	unsigned long received;
+	unsigned long expected;
+	int result; ///< return value of the job function
+	int (*function)(struct job* job);
+};
+
+int job_start(long ticket, int port, const char* command, int (*function)(struct job* job));
+void job_set_socket(struct job* job, int FD);
+void job_progress(struct job* job, unsigned long received, unsigned long expected);
+int job_cancelled(struct job* job);
+int job_cancel(int id);
+int job_wait(int id);
+int job_running();
+void job_list();
+
+#endif /* JOBS_H_ */
@@ -0,0 +1,219 @@
+/*
+ * kdf.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/rand.h>
+#include <kdf.h>
+
+/// a hash waiting for a KDF worker, owned by the thread that asked for it
+struct kdf_job{
+	const char* password;
+	const unsigned char* salt;
+	int iterations;
+	unsigned char hash[KDF_HASH_SIZE];
+	int done;
+	int result;
+	pthread_cond_t finished;
+};
+
+/// settings, see kdf_start()
+static struct{
+	int iterations;
+	int workers;
+	int queue;
+} KDF = {KDF_ITERATIONS, 0, KDF_QUEUE};
+
+static struct kdf_job* queue[KDF_MAX_QUEUE]; ///< jobs waiting for a worker
+static unsigned long queue_head = 0; ///< next job to be added
+static unsigned long queue_tail = 0; ///< next job to be hashed
+static unsigned long queue_peak = 0; ///< longest the queue has been
+static unsigned long hashed = 0; ///< jobs done so far
+static unsigned long rejected = 0; ///< jobs turned down because the queue was full
+static pthread_mutex_t queue_lock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t queue_not_empty = PTHREAD_COND_INITIALIZER;
+
+/// KDF worker thread: hashes the jobs in the queue
+/// @param arg unused
+static void* kdf_worker(void* arg){
+	(void) arg;
+	while(TRUE){
+		pthread_mutex_lock(&queue_lock);
+		while(queue_tail == queue_head){
+			pthread_cond_wait(&queue_not_empty, &queue_lock);
+		}
+		struct kdf_job* job = queue[queue_tail++ % KDF_MAX_QUEUE];
+		pthread_mutex_unlock(&queue_lock);
+		int result = PKCS5_PBKDF2_HMAC(job->password, (int) strlen(job->password), job->salt, KDF_SALT_SIZE, job->iterations,
+				EVP_sha256(), KDF_HASH_SIZE, job->hash) == 1;
+		pthread_mutex_lock(&queue_lock);
+		hashed++;
+		job->result = result;
+		job->done = TRUE;
+		pthread_cond_signal(&job->finished);
+		pthread_mutex_unlock(&queue_lock);
+	}
+	return NULL;
+}
+
+/// hashes a password on the KDF workers, waiting for the result
+/// @param password the password
+/// @param salt the salt, **must be KDF_SALT_SIZE bytes long**
+/// @param iterations the cost
+/// @param hash where the hash is stored, **must be KDF_HASH_SIZE bytes long**
+/// @returns 1 on success, 0 on failure, INEX if the queue is full
+static int kdf_compute(const char* password, const unsigned char* salt, int iterations, unsigned char* hash){
+	struct kdf_job job;
+	memset(&job, 0, sizeof(struct kdf_job));
+	job.password = password;
+	job.salt = salt;
+	job.iterations = iterations;
+	pthread_cond_init(&job.finished, NULL);
+	pthread_mutex_lock(&queue_lock);
+	if(queue_head - queue_tail >= (unsigned long) KDF.queue){ // waiting would only make every login slower
+		rejected++;
+		pthread_mutex_unlock(&queue_lock);
+		pthread_cond_destroy(&job.finished);
+		return INEX;
+	}
+	queue[queue_head++ % KDF_MAX_QUEUE] = &job;
+	if(queue_head - queue_tail > queue_peak) queue_peak = queue_head - queue_tail;
+	pthread_cond_signal(&queue_not_empty);
+	while(!job.done){
+		pthread_cond_wait(&job.finished, &queue_lock);
+	}
+	pthread_mutex_unlock(&queue_lock);
+	pthread_cond_destroy(&job.finished);
+	if(job.result == FALSE){
+		fprintf(stderr, "ERROR: hashing password\n");
+		return FALSE;
+	}
+	memcpy(hash, job.hash, KDF_HASH_SIZE);
+	return TRUE;
+}
+
+/// reads the settings from KDF_ENV ("<name>=<value>,...") and starts the KDF workers
+///
+/// names: iterations, workers, queue
+void kdf_start(){
+	KDF.workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	char* env = getenv(KDF_ENV);
+	if(env != NULL){
+		char settings[BUFFER_SIZE];
+		strncpy(settings, env, BUFFER_SIZE - 1);
+		settings[BUFFER_SIZE - 1] = '\0';
+		char* save;
+		for(char* setting = strtok_r(settings, ",", &save);setting != NULL;setting = strtok_r(NULL, ",", &save)){
+			char* value = strchr(setting, '=');
+			int number = value == NULL ? INEX : (int) strtol(value + 1, NULL, 10);
+			if(value != NULL) *value = '\0';
+			if(number < 1) fprintf(stderr, "ERROR: invalid KDF setting [%s], ignoring\n", setting);
+			else if(strcmp(setting, "iterations") == 0) KDF.iterations = number;
+			else if(strcmp(setting, "workers") == 0) KDF.workers = number;
+			else if(strcmp(setting, "queue") == 0) KDF.queue = number;
+			else fprintf(stderr, "ERROR: unknown KDF setting [%s], ignoring\n", setting);
+		}
+	}
+	if(KDF.iterations < KDF_MIN_ITERATIONS) KDF.iterations = KDF_MIN_ITERATIONS;
+	if(KDF.workers < 1) KDF.workers = 1;
+	if(KDF.workers > KDF_MAX_WORKERS) KDF.workers = KDF_MAX_WORKERS;
+	if(KDF.queue > KDF_MAX_QUEUE) KDF.queue = KDF_MAX_QUEUE;
+	for(int i = 0;i < KDF.workers;i++){
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, kdf_worker, NULL) != 0){
+			fprintf(stderr, "ERROR: creating KDF worker %d (%s)\n", i, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		pthread_detach(thread);
+	}
+	printf("[SERVER_AUTH]: hashing passwords with %d worker(s), iterations: %d, queue: %d\n", KDF.workers, KDF.iterations, KDF.queue);
+}
+
+/// hashes a password with a new salt and the current cost
+/// @param password the password
+/// @param credential where the credential is stored, **must be KDF_CREDENTIAL_SIZE bytes long**
+/// @returns 1 on success, 0 on failure, INEX if the queue is full
+int kdf_hash(const char* password, char* credential){
+	unsigned char salt[KDF_SALT_SIZE];
+	unsigned char hash[KDF_HASH_SIZE];
+	if(RAND_bytes(salt, KDF_SALT_SIZE) != 1){
+		fprintf(stderr, "ERROR: generating salt\n");
+		return FALSE;
+	}
+	int result = kdf_compute(password, salt, KDF.iterations, hash);
+	if(result != TRUE) return result;
+	int length = sprintf(credential, KDF_PREFIX "%d$", KDF.iterations);
+	for(int i = 0;i < KDF_SALT_SIZE;i++){
+		length += sprintf(credential + length, "%02x", salt[i]);
+	}
+	credential[length++] = '$';
+	for(int i = 0;i < KDF_HASH_SIZE;i++){
+		length += sprintf(credential + length, "%02x", hash[i]);
+	}
+	return TRUE;
+}
+
+/// decodes *size* hex encoded bytes
+/// @param hex the hex string
+/// @param bytes where the bytes are stored
+/// @param size amount of bytes expected
+/// @returns 1 on success, 0 if *hex* is not *size* hex encoded bytes
+static int kdf_decode(const char* hex, unsigned char* bytes, int size){
+	for(int i = 0;i < size;i++){
+		unsigned int byte;
+		if(sscanf(hex + 2 * i, "%2x", &byte) != 1) return FALSE;
+		bytes[i] = (unsigned char) byte;
+	}
+	return TRUE;
+}
+
+/// checks a password against a stored credential
+/// @param password the password
+/// @param credential the stored credential, or a plaintext password
+/// @param upgrade where to store if the credential should be hashed again with kdf_hash() (it is plaintext, or of
+/// another cost), only meaningful when the password matches
+/// @returns 1 if the password matches, 0 if it does not, INEX if the queue is full
+int kdf_verify(const char* password, const char* credential, int* upgrade){
+	*upgrade = TRUE;
+	if(strncmp(credential, KDF_PREFIX, strlen(KDF_PREFIX)) != 0){ // plaintext, from before passwords were hashed
+		return strcmp(password, credential) == 0;
+	}
+	int iterations;
+	char salt_hex[2 * KDF_SALT_SIZE + 1];
+	char hash_hex[2 * KDF_HASH_SIZE + 1];
+	unsigned char salt[KDF_SALT_SIZE];
+	unsigned char stored[KDF_HASH_SIZE];
+	unsigned char hash[KDF_HASH_SIZE];
+	if(sscanf(credential + strlen(KDF_PREFIX), "%d$%32[0-9a-f]$%64[0-9a-f]", &iterations, salt_hex, hash_hex) != 3
+			|| iterations < 1 || kdf_decode(salt_hex, salt, KDF_SALT_SIZE) == FALSE || kdf_decode(hash_hex, stored, KDF_HASH_SIZE) == FALSE){
+		fprintf(stderr, "ERROR: stored credential out of format\n");
+		return FALSE;
+	}
+	int result = kdf_compute(password, salt, iterations, hash);
+	if(result != TRUE) return result;
+	*upgrade = iterations != KDF.iterations;
+	return CRYPTO_memcmp(hash, stored, KDF_HASH_SIZE) == 0;
+}
+
+/// stores the state of the KDF workers in *buffer*
+/// @param buffer the buffer
+/// @param size size of the buffer
+/// @returns a pointer to the provided buffer
+char* kdf_stats(char* buffer, size_t size){
+	pthread_mutex_lock(&queue_lock);
+	snprintf(buffer, size, TAB "%-20s %d\n" TAB "%-20s %d\n" TAB "%-20s %lu/%d (peak: %lu)\n" TAB "%-20s %lu\n" TAB "%-20s %lu\n",
+			"KDF workers", KDF.workers, "KDF iterations", KDF.iterations, "KDF queue", queue_head - queue_tail, KDF.queue,
+			queue_peak, "hashed", hashed, "rejected (busy)", rejected);
+	pthread_mutex_unlock(&queue_lock);
+	return buffer;
+}
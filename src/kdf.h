@@ -0,0 +1,45 @@
+/*
+ * kdf.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#ifndef KDF_H_
+#define KDF_H_
+
+#include <stddef.h>
+#include <global.h>
+
+/*
+ * password hashing for SERVER_AUTH (PBKDF2-HMAC-SHA256), on its own pool of workers:
+ *
+ *   auth worker -> kdf_verify() / kdf_hash() -> queue[queue] -> KDF worker 1 -> PKCS5_PBKDF2_HMAC()
+ *                      (waits for the result)                -> KDF worker 2 -> ...
+ *
+ * passwords are stored as KDF_PREFIX "<iterations>$<salt>$<hash>" (hex), so the cost can be raised
+ * without invalidating what is stored. The queue is bounded: a request that finds it full is turned
+ * down right away (INEX) instead of waiting, which bounds the latency of a login to the queue
+ * length times the cost of a hash. Anything that is not a credential is a plaintext password left
+ * from before, and is reported as needing an upgrade, as are credentials of another cost
+ *
+ * the cost, workers and queue length are set with KDF_ENV, e.g. "iterations=200000,workers=2,queue=16"
+ */
+
+#define KDF_ENV "OS_IMAGE_KDF" ///< environment variable that overrides the defaults, see kdf_start()
+#define KDF_PREFIX "$pbkdf2-sha256$" ///< first characters of a stored credential
+#define KDF_ITERATIONS 100000 ///< default cost
+#define KDF_MIN_ITERATIONS 1000 ///< lowest cost accepted
+#define KDF_QUEUE 32 ///< default length of the queue
+#define KDF_MAX_QUEUE 256 ///< maximum length of the queue
+#define KDF_MAX_WORKERS 16 ///< maximum amount of workers, one per core by default
+#define KDF_SALT_SIZE 16 ///< salt size (bytes)
+#define KDF_HASH_SIZE 32 ///< hash size (bytes)
+#define KDF_CREDENTIAL_SIZE 128 ///< maximum size of a stored credential, including the terminating null byte
+
+void kdf_start();
+int kdf_hash(const char* password, char* credential);
+int kdf_verify(const char* password, const char* credential, int* upgrade);
+char* kdf_stats(char* buffer, size_t size);
+
+#endif /* KDF_H_ */
@@ -8,38 +8,145 @@
 #ifndef MESSAGE_H_
 #define MESSAGE_H_
 
+#include <stdio.h>
 #include <stdlib.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <errno.h>
 #include <string.h>
 #include <sys/msg.h>
+#include <ring.h>
 
 #define MESSAGE_QUEUE_KEY "/bin/ls" ///< file used for message queue key generation with ftok()
 #define SERVER_MAIN_MSG_TYPE 1 ///< message type of messages read by SERVER_MAIN
+#define SERVER_MAIN_RELOAD_MSG_TYPE 2 ///< message type read instead by a SERVER_MAIN that took over from another (server_main --reload), they alternate
 #define SERVER_AUTH_MSG_TYPE 5 ///< message type of messages read by SERVER_AUTH
 #define SERVER_FILE_MSG_TYPE 7 ///< message type of messages read by SERVER_FILE
-#define MESSAGE_SIZE 1024 ///< maximum size of message
+#define MESSAGE_SIZE 1024 ///< maximum size of the data of a message, see send_large() for longer ones
+#define MESSAGE_MORE 1 ///< message flag: the data goes on in the next message of the same request (see send_large())
+#define MESSAGE_ASSEMBLIES 16 ///< large messages being received at once, see receive_large()
+#define MESSAGE_LARGE_MAX (16 * 1024 * 1024) ///< maximum size of a large message
+#define LISTING_SIZE (MESSAGE_SIZE * 16) ///< maximum size of a listing ("FILE LS", "AUTH LS"), answered with send_large()
+#define IPC_ENV "OS_IMAGE_IPC" ///< environment variable that selects the transport: "sysv" (default) or "shm", see ring.h
 
 int Q_ID = -1;
+long REQUEST_ID = 0; ///< ID of the last request read with get_msg(), answered by send_response()
+long REPLY_TYPE = SERVER_MAIN_MSG_TYPE; ///< message type the response to the last request read with get_msg() goes to
+struct ring_region* RINGS = NULL; ///< shared memory transport, NULL while using the systemV queue
 
-struct message_struct{
-	long type;
-	char string[MESSAGE_SIZE];
+/*
+ * every message carries a request ID and a reply address (the message type its response goes to):
+ *
+ *   SERVER_MAIN  send_request(SERVER_AUTH_MSG_TYPE, 42, SERVER_MAIN_MSG_TYPE, "AUTH LS")
+ *   SERVER_AUTH  get_msg(SERVER_AUTH_MSG_TYPE, ...) -> send_response("> user list: ...")
+ *   SERVER_MAIN  get_request(SERVER_MAIN_MSG_TYPE, &request, NULL, ...) -> request = 42
+ *
+ * so any amount of requests can be in flight and every response is routed to its request.
+ * request ID 0 means no response is expected
+ *
+ * messages carry their length, only the header and the bytes in use go through the transport, and
+ * the data may be binary. They can be built where they are sent from, and answered in place:
+ *
+ *   struct message msg;
+ *   message_start(&msg, SERVER_AUTH_MSG_TYPE, 42, SERVER_MAIN_MSG_TYPE);
+ *   message_printf(&msg, "AUTH LOG %ld %s", ...);
+ *   message_send(&msg);                  SERVER_AUTH  message_receive(SERVER_AUTH_MSG_TYPE, &msg);
+ *                                                     sprintf(msg.data, "..."); message_answer(&msg);
+ *
+ * the string functions (send_request(), get_request(), ...) are kept on top of them. Data longer
+ * than MESSAGE_SIZE is sent with send_large() as several messages of the same request, and put
+ * back together by receive_large()
+ */
+
+/// a message: a header and *length* bytes of data, nothing past them is sent
+struct message{
+	long type; ///< message type ID
+	long request; ///< request ID, echoed in the response
+	long reply; ///< message type the response must be sent to
+	uint32_t flags; ///< MESSAGE_MORE
+	uint32_t length; ///< bytes of data in use
+	char data[MESSAGE_SIZE + 1]; ///< always NUL terminated after *length*, so text can be used as a string
 };
 
-/// sends message of type *type* containing *message*
+#define MESSAGE_HEADER (offsetof(struct message, data) - sizeof(long)) ///< bytes sent along with the data (systemV does not count the type)
+
+/// a large message being received, see receive_large()
+struct message_assembly{
+	int used;
+	long request;
+	long reply;
+	char* data;
+	size_t length;
+};
+
+/// selects the transport set in IPC_ENV, every process must use the same one
+/// @param create TRUE for SERVER_MAIN, which creates the shared memory region, FALSE for the backends
+/// @returns TRUE if the shared memory transport is in use, FALSE for the systemV queue
+int setup_transport(const int create){
+	char* transport = getenv(IPC_ENV);
+	if(transport == NULL || strcmp(transport, "shm") != 0) return FALSE;
+	if((RINGS = create ? ring_create(RING_NAME) : ring_attach(RING_NAME)) == NULL){
+		fprintf(stderr, "ERROR: shared memory transport unavailable%s\n", create ? "" : ", is [SERVER_MAIN] using it?");
+		exit(EXIT_FAILURE);
+	}
+	return TRUE;
+}
+
+/// starts an empty message, to be filled with message_printf() or message_append()
+/// @param msg the message
 /// @param type message type ID
-/// @param message message to be sent
-/// @returns the length of the message sent
-int send_msg(const int type, const char* message){
+/// @param request request ID (0 if no response is expected)
+/// @param reply message type the response must be sent to
+/// @returns a pointer to the message
+struct message* message_start(struct message* msg, const long type, const long request, const long reply){
+	msg->type = type;
+	msg->request = request;
+	msg->reply = reply;
+	msg->flags = 0;
+	msg->length = 0;
+	msg->data[0] = '\0';
+	return msg;
+}
+
+/// appends *length* bytes to the data of a message
+/// @param msg the message
+/// @param data the bytes
+/// @param length amount of bytes
+/// @returns 1 on success, 0 if they do not fit (nothing is appended)
+int message_append(struct message* msg, const void* data, const size_t length){
+	if(msg->length + length > MESSAGE_SIZE) return FALSE;
+	memcpy(msg->data + msg->length, data, length);
+	msg->length += (uint32_t) length;
+	msg->data[msg->length] = '\0';
+	return TRUE;
+}
+
+/// appends formatted text to the data of a message, in place
+/// @param msg the message
+/// @param format the format, as for printf()
+/// @returns 1 on success, 0 if the text was cut to fit
+__attribute__((format(printf, 2, 3))) int message_printf(struct message* msg, const char* format, ...){
+	va_list args;
+	va_start(args, format);
+	int written = vsnprintf(msg->data + msg->length, MESSAGE_SIZE + 1 - msg->length, format, args);
+	va_end(args);
+	if(written < 0) return FALSE;
+	int fits = msg->length + (uint32_t) written <= MESSAGE_SIZE;
+	msg->length = fits ? msg->length + (uint32_t) written : MESSAGE_SIZE;
+	return fits;
+}
+
+/// sends a message, only its header and the data in use
+/// @param msg the message
+/// @returns the amount of bytes sent
+int message_send(const struct message* msg){
+	if(RINGS != NULL) return ring_send(RINGS, msg->type, msg->request, msg->reply, msg->flags, msg->data, msg->length);
 	if(Q_ID < 0){
 		fprintf(stderr, "ERROR: systemV queue not initiated\n");
 		return 0;
 	}
-	struct message_struct msg;
-	msg.type = type;
-	strcpy(msg.string, message);
-	int sent = 0;
-	if((sent = msgsnd(Q_ID, &msg, MESSAGE_SIZE, 0)) < 0){
+	if(msgsnd(Q_ID, msg, MESSAGE_HEADER + msg->length, 0) < 0){
 		if(errno == EIDRM){
 			fprintf(stderr, "ERROR: [SERVER_MAIN] is offline\n");
 			exit(EXIT_FAILURE);
@@ -47,29 +154,198 @@ int send_msg(const int type, const char* message){
 		fprintf(stderr, "ERROR: sending systemV message (%s)\n", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
-	return sent;
+	return (int) (MESSAGE_HEADER + msg->length);
 }
 
-/// get the first message of type *type* on the message queue and stores it in *message*
+/// gets the first message of type *type*, straight into *msg*
 /// @param type message type ID
-/// @param message buffer to store the message in (**must be MESSAGE_SIZE bytes long**)
-/// @returns a pointer to the buffer *message*
-char* get_msg(const int type, char* message){
+/// @param msg where the message is stored
+/// @returns a pointer to the message, NULL on failure
+struct message* message_receive(const long type, struct message* msg){
+	if(RINGS != NULL){
+		if(ring_receive(RINGS, type, &msg->request, &msg->reply, &msg->flags, msg->data, &msg->length, MESSAGE_SIZE) == FALSE){
+			fprintf(stderr, "ERROR: [SERVER_MAIN] is offline\n");
+			exit(EXIT_FAILURE);
+		}
+		msg->type = type;
+		msg->data[msg->length] = '\0';
+		return msg;
+	}
 	if(Q_ID < 0){
 		fprintf(stderr, "ERROR: systemV queue not initiated\n");
 		return NULL;
 	}
-	struct message_struct msg;
-	memset(message, '\0', MESSAGE_SIZE);
-	if(msgrcv(Q_ID, &msg, MESSAGE_SIZE, type, 0) < 0){
+	ssize_t R;
+	if((R = msgrcv(Q_ID, msg, MESSAGE_HEADER + MESSAGE_SIZE, type, 0)) < 0){
 		if(errno == EIDRM){
 			fprintf(stderr, "ERROR: [SERVER_MAN] is offline\n");
 			exit(EXIT_FAILURE);
 		}
-		fprintf(stderr, "ERROR: sending systemV message (%s)\n", strerror(errno));
+		fprintf(stderr, "ERROR: receiving systemV message (%s)\n", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
-	strcpy(message, msg.string);
+	if((size_t) R < MESSAGE_HEADER + msg->length) msg->length = (size_t) R < MESSAGE_HEADER ? 0 : (uint32_t) ((size_t) R - MESSAGE_HEADER); // should NEVER happen
+	msg->data[msg->length] = '\0';
+	return msg;
+}
+
+/// answers the request held in *msg* with the text now in its data (usually written over the request), unless it
+/// expects no response
+/// @param msg the request read with message_receive(), its data holds the response
+/// @returns the amount of bytes sent
+int message_answer(struct message* msg){
+	if(msg->request == 0) return 0;
+	msg->type = msg->reply;
+	msg->reply = 0;
+	msg->flags = 0;
+	msg->data[MESSAGE_SIZE] = '\0';
+	msg->length = (uint32_t) strlen(msg->data);
+	return message_send(msg);
+}
+
+/// sends data of any length (up to MESSAGE_LARGE_MAX) as messages of the same request, every one but the last flagged
+/// MESSAGE_MORE, see receive_large()
+/// @param type message type ID
+/// @param request request ID, the messages of different large messages sent at once to the same type must not share it
+/// @param reply message type the response must be sent to
+/// @param data the bytes to be sent
+/// @param length amount of bytes
+/// @returns the amount of messages sent, 0 on failure
+int send_large(const long type, const long request, const long reply, const void* data, const size_t length){
+	if(length > MESSAGE_LARGE_MAX){
+		fprintf(stderr, "ERROR: message too large (%zu bytes, max: %d)\n", length, MESSAGE_LARGE_MAX);
+		return 0;
+	}
+	struct message msg;
+	int sent = 0;
+	size_t offset = 0;
+	do{
+		size_t chunk = length - offset < MESSAGE_SIZE ? length - offset : MESSAGE_SIZE;
+		message_start(&msg, type, request, reply);
+		message_append(&msg, (const char*) data + offset, chunk);
+		offset += chunk;
+		if(offset < length) msg.flags = MESSAGE_MORE;
+		if(message_send(&msg) == 0) return 0;
+		sent++;
+	}while(offset < length);
+	return sent;
+}
+
+/// gets the first complete message of type *type*, put back together if it was sent with send_large()
+///
+/// the messages of a large message arrive in order, but other senders may send to the same type meanwhile, so
+/// every request is put together on its own. **Only one thread of a process may use it**
+/// @param type message type ID
+/// @param request where the request ID is stored (may be NULL)
+/// @param reply where the reply address is stored (may be NULL)
+/// @param length where the amount of bytes is stored
+/// @returns the data (NUL terminated, to be freed by the caller), NULL on failure
+char* receive_large(const long type, long* request, long* reply, size_t* length){
+	static struct message_assembly assemblies[MESSAGE_ASSEMBLIES];
+	struct message msg;
+	while(message_receive(type, &msg) != NULL){
+		struct message_assembly* assembly = NULL;
+		struct message_assembly* free_assembly = NULL;
+		for(int i = 0;i < MESSAGE_ASSEMBLIES;i++){
+			if(assemblies[i].used && assemblies[i].request == msg.request) assembly = &assemblies[i];
+			else if(!assemblies[i].used && free_assembly == NULL) free_assembly = &assemblies[i];
+		}
+		if(assembly == NULL){
+			if(free_assembly == NULL){
+				fprintf(stderr, "ERROR: too many large messages at once (max: %d), discarding request %ld\n", MESSAGE_ASSEMBLIES, msg.request);
+				continue;
+			}
+			assembly = free_assembly;
+			memset(assembly, 0, sizeof(struct message_assembly));
+			assembly->used = TRUE;
+			assembly->request = msg.request;
+			assembly->reply = msg.reply;
+		}
+		char* data = assembly->length + msg.length <= MESSAGE_LARGE_MAX ? realloc(assembly->data, assembly->length + msg.length + 1) : NULL;
+		if(data == NULL){
+			fprintf(stderr, "ERROR: putting together request %ld (%s)\n", msg.request, assembly->length + msg.length > MESSAGE_LARGE_MAX ? "too large" : strerror(errno));
+			free(assembly->data);
+			assembly->used = FALSE;
+			continue;
+		}
+		memcpy(data + assembly->length, msg.data, msg.length);
+		assembly->data = data;
+		assembly->length += msg.length;
+		assembly->data[assembly->length] = '\0';
+		if(msg.flags & MESSAGE_MORE) continue;
+		assembly->used = FALSE;
+		if(request != NULL) *request = assembly->request;
+		if(reply != NULL) *reply = assembly->reply;
+		*length = assembly->length;
+		return assembly->data;
+	}
+	return NULL;
+}
+
+/// sends message of type *type* containing *message*, tagged with a request ID and a reply address
+/// @param type message type ID
+/// @param request request ID (0 if no response is expected)
+/// @param reply message type the response must be sent to
+/// @param message message to be sent
+/// @returns the length of the message sent
+int send_request(const long type, const long request, const long reply, const char* message){
+	struct message msg;
+	message_start(&msg, type, request, reply);
+	message_printf(&msg, "%s", message);
+	return message_send(&msg);
+}
+
+/// get the first message of type *type* on the message queue and stores it in *message*, along with its request ID and reply address
+/// @param type message type ID
+/// @param request where the request ID is stored (may be NULL)
+/// @param reply where the reply address is stored (may be NULL)
+/// @param message buffer to store the message in (**must be MESSAGE_SIZE bytes long**)
+/// @returns a pointer to the buffer *message*
+char* get_request(const long type, long* request, long* reply, char* message){
+	struct message msg;
+	if(message_receive(type, &msg) == NULL) return NULL;
+	if(request != NULL) *request = msg.request;
+	if(reply != NULL) *reply = msg.reply;
+	size_t length = msg.length < MESSAGE_SIZE ? msg.length : MESSAGE_SIZE - 1;
+	memcpy(message, msg.data, length);
+	message[length] = '\0';
 	return message;
 }
+
+/// sends message of type *type* containing *message*
+/// @param type message type ID
+/// @param message message to be sent
+/// @returns the length of the message sent
+int send_msg(const int type, const char* message){
+	return send_request(type, 0, SERVER_MAIN_MSG_TYPE, message);
+}
+
+/// get the first message of type *type* on the message queue and stores it in *message*
+///
+/// its request ID and reply address are kept for send_response()
+/// @param type message type ID
+/// @param message buffer to store the message in (**must be MESSAGE_SIZE bytes long**)
+/// @returns a pointer to the buffer *message*
+char* get_msg(const int type, char* message){
+	return get_request(type, &REQUEST_ID, &REPLY_TYPE, message);
+}
+
+/// answers a request read with get_request(), unless it expects no response
+///
+/// unlike send_response() it does not rely on the last request read, so it may be used by any thread
+/// @param reply the reply address of the request
+/// @param request the request ID
+/// @param message the response
+/// @returns the length of the message sent
+int answer_request(const long reply, const long request, const char* message){
+	if(request == 0) return 0;
+	return send_request(reply, request, 0, message);
+}
+
+/// answers the last request read with get_msg(), unless it expects no response
+/// @param message the response
+/// @returns the length of the message sent
+int send_response(const char* message){
+	return answer_request(REPLY_TYPE, REQUEST_ID, message);
+}
 #endif /* MESSAGE_H_ */
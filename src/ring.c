@@ -0,0 +1,179 @@
+/*
+ * ring.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <global.h>
+#include <ring.h>
+
+/// sleeps while *address* holds *value* (shared between processes, so no FUTEX_PRIVATE_FLAG)
+static void futex_wait(_Atomic uint32_t* address, uint32_t value){
+	syscall(SYS_futex, address, FUTEX_WAIT, value, NULL, NULL, 0);
+}
+
+/// wakes up every process sleeping on *address*
+static void futex_wake(_Atomic uint32_t* address){
+	syscall(SYS_futex, address, FUTEX_WAKE, INT_MAX, NULL, NULL, 0);
+}
+
+/// maps the shared memory region
+/// @param name name of the region
+/// @param flags flags for shm_open()
+/// @returns the region, NULL on failure
+static struct ring_region* ring_map(const char* name, int flags){
+	int FD = shm_open(name, flags, 0666);
+	if(FD < 0){
+		fprintf(stderr, "ERROR: opening shared memory %s (%s)\n", name, strerror(errno));
+		return NULL;
+	}
+	if((flags & O_CREAT) && ftruncate(FD, sizeof(struct ring_region)) < 0){
+		fprintf(stderr, "ERROR: sizing shared memory %s (%s)\n", name, strerror(errno));
+		close(FD);
+		return NULL;
+	}
+	void* region = mmap(NULL, sizeof(struct ring_region), PROT_READ | PROT_WRITE, MAP_SHARED, FD, 0);
+	close(FD);
+	if(region == MAP_FAILED){
+		fprintf(stderr, "ERROR: mapping shared memory %s (%s)\n", name, strerror(errno));
+		return NULL;
+	}
+	return region;
+}
+
+/// creates a shared memory region (SERVER_MAIN), replacing any leftover of a previous run
+/// @param name name of the region (RING_NAME for the servers)
+/// @returns the region, NULL on failure
+struct ring_region* ring_create(const char* name){
+	shm_unlink(name);
+	return ring_map(name, O_RDWR | O_CREAT | O_EXCL); // a new region is zero-filled, every ring starts empty
+}
+
+/// attaches to a shared memory region created by ring_create()
+/// @param name name of the region
+/// @returns the region, NULL on failure
+struct ring_region* ring_attach(const char* name){
+	return ring_map(name, O_RDWR);
+}
+
+/// marks the region as closed, waking up every consumer, and removes it
+/// @param region the region
+/// @param name name of the region
+void ring_destroy(struct ring_region* region, const char* name){
+	if(region == NULL) return;
+	shm_unlink(name); // before waking anyone up, woken processes may exit right away
+	atomic_store(&region->closed, TRUE);
+	for(int i = 0;i < RING_COUNT;i++){
+		atomic_fetch_add(&region->rings[i].produced, 1);
+		futex_wake(&region->rings[i].produced);
+	}
+}
+
+/// writes a message into the ring of its message type, waiting for room if the ring is full
+/// @param region the region
+/// @param type message type ID (lower than RING_COUNT)
+/// @param request request ID
+/// @param reply message type the response must be sent to
+/// @param flags flags of the message
+/// @param data the bytes to be sent
+/// @param length amount of bytes
+/// @returns the size of the record, 0 on failure
+int ring_send(struct ring_region* region, long type, long request, long reply, uint32_t flags, const char* data, uint32_t length){
+	if(type <= 0 || type >= RING_COUNT){
+		fprintf(stderr, "ERROR: message type %ld has no ring\n", type);
+		return 0;
+	}
+	struct ring* ring = &region->rings[type];
+	uint32_t size = (uint32_t) ((sizeof(struct ring_record) + length + 7) & ~7UL);
+	unsigned long reserve;
+	unsigned long pad;
+	while(TRUE){ // reserve pad (if the record does not fit before the end of the ring) + record
+		reserve = atomic_load(&ring->reserve);
+		unsigned long offset = reserve % RING_SIZE;
+		pad = RING_SIZE - offset < size ? RING_SIZE - offset : 0;
+		if(reserve + pad + size - atomic_load(&ring->tail) > RING_SIZE){ // full, wait for the consumer
+			uint32_t consumed = atomic_load(&ring->consumed);
+			atomic_fetch_add(&ring->producers_waiting, 1);
+			if(reserve + pad + size - atomic_load(&ring->tail) > RING_SIZE) futex_wait(&ring->consumed, consumed);
+			atomic_fetch_sub(&ring->producers_waiting, 1);
+			continue;
+		}
+		if(atomic_compare_exchange_weak(&ring->reserve, &reserve, reserve + pad + size)) break;
+	}
+	if(pad > 0){
+		struct ring_record* record = (struct ring_record*) (ring->data + reserve % RING_SIZE);
+		record->size = (uint32_t) pad;
+		atomic_store_explicit(&record->kind, RING_PAD, memory_order_release);
+	}
+	struct ring_record* record = (struct ring_record*) (ring->data + (reserve + pad) % RING_SIZE);
+	record->size = size;
+	record->request = request;
+	record->reply = reply;
+	record->flags = flags;
+	record->length = length;
+	memcpy(record->data, data, length);
+	atomic_store_explicit(&record->kind, RING_MESSAGE, memory_order_release); // commit
+	atomic_fetch_add(&ring->produced, 1);
+	if(atomic_load(&ring->consumer_idle)) futex_wake(&ring->produced);
+	return (int) size;
+}
+
+/// reads the next message of a message type, sleeping while its ring is empty
+/// @param region the region
+/// @param type message type ID (lower than RING_COUNT), **only one process may read each type**
+/// @param request where the request ID is stored (may be NULL)
+/// @param reply where the reply address is stored (may be NULL)
+/// @param flags where the flags are stored
+/// @param data the buffer in which to store the bytes of the message
+/// @param length where the amount of bytes is stored
+/// @param size size of *data*, longer messages are cut
+/// @returns 1 on success, 0 if the region was closed
+int ring_receive(struct ring_region* region, long type, long* request, long* reply, uint32_t* flags, char* data, uint32_t* length, uint32_t size){
+	if(type <= 0 || type >= RING_COUNT){
+		fprintf(stderr, "ERROR: message type %ld has no ring\n", type);
+		return FALSE;
+	}
+	struct ring* ring = &region->rings[type];
+	int spins = 0;
+	while(TRUE){
+		if(atomic_load(&region->closed)) return FALSE;
+		unsigned long tail = atomic_load(&ring->tail);
+		struct ring_record* record = (struct ring_record*) (ring->data + tail % RING_SIZE);
+		uint32_t kind = atomic_load_explicit(&record->kind, memory_order_acquire);
+		if(kind == RING_FREE){ // empty
+			if(++spins < RING_SPINS) continue;
+			uint32_t produced = atomic_load(&ring->produced);
+			atomic_store(&ring->consumer_idle, TRUE);
+			if(atomic_load_explicit(&record->kind, memory_order_acquire) == RING_FREE && !atomic_load(&region->closed)){
+				futex_wait(&ring->produced, produced);
+			}
+			atomic_store(&ring->consumer_idle, FALSE);
+			spins = 0;
+			continue;
+		}
+		uint32_t record_size = record->size;
+		if(kind == RING_MESSAGE){
+			if(request != NULL) *request = record->request;
+			if(reply != NULL) *reply = record->reply;
+			*flags = record->flags;
+			*length = record->length < size ? record->length : size;
+			memcpy(data, record->data, *length);
+		}
+		memset(record, 0, record_size); // stale bytes must never look like a committed record
+		atomic_store(&ring->tail, tail + record_size);
+		atomic_fetch_add(&ring->consumed, 1);
+		if(atomic_load(&ring->producers_waiting)) futex_wake(&ring->consumed);
+		if(kind == RING_MESSAGE) return TRUE;
+	}
+}
@@ -0,0 +1,70 @@
+/*
+ * ring.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#ifndef RING_H_
+#define RING_H_
+
+#include <stdint.h>
+#include <stdatomic.h>
+
+/*
+ * shared memory transport, an alternative to the systemV queue (see message.h):
+ *
+ *   /os_image_tool_ipc:  [ring 0][ring 1]...[ring RING_COUNT-1]
+ *                                  ^ one per message type, read only by the process that owns that type
+ *
+ *   ring:  ...[record][record][pad][record]...
+ *             ^ tail                         ^ reserve
+ *
+ * producers reserve space with a CAS on *reserve*, copy their record and then commit it by setting its
+ * kind; the single consumer reads committed records in order and zeroes them before moving *tail*.
+ * records are variable-length, so a 10 byte message costs 48 bytes instead of a full MESSAGE_SIZE.
+ * nobody sleeps while there is work: a futex is only waited on (and woken) once a consumer finds its
+ * ring empty, or a producer finds it full
+ */
+
+#define RING_NAME "/os_image_tool_ipc" ///< name of the shared memory region
+#define RING_SIZE (256 * 1024) ///< bytes of each ring
+#define RING_COUNT 16 ///< amount of rings, message types must be lower than this
+#define RING_SPINS 200 ///< times an empty ring is checked before sleeping
+
+#define RING_FREE 0 ///< record is being written (or the space is free)
+#define RING_MESSAGE 1 ///< record holds a message
+#define RING_PAD 2 ///< record fills the end of the ring, skip it
+
+struct ring_record{
+	_Atomic uint32_t kind; ///< RING_FREE until committed
+	uint32_t size; ///< size of the whole record, multiple of 8
+	long request;
+	long reply;
+	uint32_t flags; ///< see struct message
+	uint32_t length; ///< bytes of data
+	char data[];
+};
+
+struct ring{
+	_Atomic unsigned long reserve; ///< next byte to be reserved by a producer
+	_Atomic unsigned long tail; ///< next byte to be read by the consumer
+	_Atomic uint32_t produced; ///< futex, increased on every commit
+	_Atomic uint32_t consumed; ///< futex, increased on every read
+	_Atomic uint32_t consumer_idle; ///< the consumer is (about to be) sleeping on *produced*
+	_Atomic uint32_t producers_waiting; ///< producers sleeping on *consumed*
+	char data[RING_SIZE];
+};
+
+struct ring_region{
+	_Atomic uint32_t closed; ///< set once SERVER_MAIN exits, wakes up and ends every consumer
+	struct ring rings[RING_COUNT];
+};
+
+struct ring_region* ring_create(const char* name);
+struct ring_region* ring_attach(const char* name);
+void ring_destroy(struct ring_region* region, const char* name);
+int ring_send(struct ring_region* region, long type, long request, long reply, uint32_t flags, const char* data, uint32_t length);
+int ring_receive(struct ring_region* region, long type, long* request, long* reply, uint32_t* flags, char* data, uint32_t* length, uint32_t size);
+
+#endif /* RING_H_ */
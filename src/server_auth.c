@@ -12,60 +12,112 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
 #include <global.h>
 #include <message.h>
-
-// SERVER_AUTH
-#define MAX_USERNAME_SIZE 30 ///< maximum username length
-#define MAX_PASSWORD_SIZE 15 ///< maximum user password length
-#define USER_DDBB_FILE "USER_DDBB" ///< user database filename
-#define USER_DDBB_TMP ".tmp" ///< temporary filename used int update_current_user()
+#include <session.h>
+#include <generation.h>
+#include <users.h>
+#include <token.h>
+#include <kdf.h>
+#include <throttle.h>
 
 #define verbose ///< verbose mode
+#define WORKERS_ENV "OS_IMAGE_AUTH_WORKERS" ///< environment variable that overrides the amount of workers, one per core by default
+#define MAX_AUTH_WORKERS 64 ///< maximum amount of workers
+#define AUTH_QUEUE_SIZE 256 ///< requests read from the queue and waiting for a worker
+#define SESSION_LOCKS 256 ///< session locks, a session is handled by one worker at a time
+#define LATENCY_SAMPLES 1024 ///< latest logins whose latency is kept, see get_auth_stats()
+#define LOGIN_THROTTLED 2 ///< user_auth() result: too many failed logins of the user or from the address, see throttle.h
+
+/*
+ * requests are read by the main thread and handled by a pool of workers:
+ *
+ *   message_receive() -> jobs[AUTH_QUEUE_SIZE] -> worker 1 -> message_answer(&job->msg)
+ *                                          -> worker 2 -> ...
+ *
+ * requests are read straight into the queue, and answered in place over them. Every job keeps
+ * the request ID and reply address it was read with, so responses may be sent in any order.
+ * SERVER_MAIN sends one request per session at a time, but a slot of the session table may be
+ * reused by a new session while the old one is being closed, so workers lock the slot of the
+ * session they handle (striped over SESSION_LOCKS locks)
+ *
+ * passwords are checked by the KDF workers (see kdf.h), so a worker waits for the hash of a login
+ * instead of computing it, and the amount of hashes running at once does not grow with the workers
+ */
+
+/// a request waiting for a worker
+struct auth_job{
+	struct timespec received; ///< when it was read from the queue, see record_login_latency()
+	struct message msg; ///< the request, and then its response
+};
 
-int user_auth(const char* user, const char* password);
-int user_change_password(const char* new_password);
-int update_current_user();
+struct generations* GENERATIONS = NULL; ///< generation numbers shared with SERVER_MAIN
+struct token_key* TOKENS = NULL; ///< key of the session tokens, shared with SERVER_MAIN
+struct auth_job jobs[AUTH_QUEUE_SIZE]; ///< requests waiting for a worker
+unsigned long jobs_head = 0; ///< next job to be added
+unsigned long jobs_tail = 0; ///< next job to be handled
+pthread_mutex_t jobs_lock = PTHREAD_MUTEX_INITIALIZER;
+pthread_cond_t jobs_not_empty = PTHREAD_COND_INITIALIZER;
+pthread_cond_t jobs_not_full = PTHREAD_COND_INITIALIZER;
+pthread_mutex_t session_locks[SESSION_LOCKS]; ///< see get_session_lock()
+double login_latencies[LATENCY_SAMPLES]; ///< latency of the latest logins (ms), from being read until answered
+unsigned long logins = 0; ///< logins answered so far
+pthread_mutex_t latency_lock = PTHREAD_MUTEX_INITIALIZER;
+
+int user_auth(struct session* session, const char* name, const char* password, const char* address);
+int user_change_password(struct session* session, const char* new_password);
+int find_user(const char* name, user* record);
+int update_user(const user* record);
+long get_session_id(char** save);
+pthread_mutex_t* get_session_lock(long id);
 int get_message_queue();
+void setup_generation();
 char* get_user_list(char* user_list);
+void record_login_latency(const struct timespec* received);
+char* get_auth_stats(char* buffer);
 void create_user_database();
 void list_users();
+void setup_workers();
+void* auth_worker(void* arg);
+void handle_message(struct auth_job* job);
 void await_message();
 
-typedef struct current_user{
-	char name[MAX_USERNAME_SIZE];
-	char pass[MAX_PASSWORD_SIZE];
-	int strikes;
-	int ban;
-} user;
-
-user current_user;
-
 /// auth server program entrypoint
 /// @returns 1 on error, 0 on success
 int main(void){
 	printf("> Launching [SERVER_AUTH]\n\n");
 	// get message queue
-	if(get_message_queue() < 1){
+	if(get_message_queue() < 0){
 		fprintf(stderr, "ERROR: systemV queue not initiated\n"
 				"> launch [SERVER_MAIN] first\n");
 		exit(EXIT_FAILURE);
 	}
-	memset(current_user.name, '\0', MAX_USERNAME_SIZE);
+	setup_generation();
+	if((TOKENS = token_attach()) == NULL){ // clients log in every time without it
+		printf("[SERVER_AUTH]: WARNING -> session tokens will not be issued\n");
+	}
+	users_load(); // lookups are served from memory from now on
+	kdf_start();
+	throttle_start();
 #if debug > 0
+	struct session* session = session_attach(1);
 	create_user_database();
 	list_users();
-	user_auth("FAKE_USER", "123");
-	user_auth("usuario", "fake_pass");
-	user_auth("usuario", "fake_pass");
-	user_auth("usuario", "fake_pass");
-	user_auth("usuario", "1234");
-	user_auth("admin", "1234");
-	user_auth("admin", "admin");
-	user_change_password("hey_there");
+	user_auth(session, "FAKE_USER", "123", NULL);
+	user_auth(session, "usuario", "fake_pass", NULL);
+	user_auth(session, "usuario", "fake_pass", NULL);
+	user_auth(session, "usuario", "fake_pass", NULL);
+	user_auth(session, "usuario", "1234", NULL);
+	user_auth(session, "admin", "1234", NULL);
+	user_auth(session, "admin", "admin", NULL);
+	user_change_password(session, "hey_there");
 	list_users();
 #endif
 	list_users();
+	setup_workers();
 	await_message();
 	printf("> Closing [SERVER_AUTH]\n");
 	return EXIT_SUCCESS;
@@ -86,153 +138,163 @@ void create_user_database(){
 	fclose(file_ptr);
 }
 
-/// auth server program entrypoint
-int user_auth(const char* user, const char* password){
-	if(user == NULL || password == NULL) return FALSE;
-	FILE* file_ptr;
-	if((file_ptr = fopen(USER_DDBB_FILE, "r")) == NULL){ // file does not exist
-		fprintf(stderr, "ERROR: opening user database (%s)\n", strerror(errno));
+/// authenticates a user, logging the session in on success
+///
+/// plaintext passwords (and credentials of another cost) are hashed again on a successful login. Failures are
+/// counted in memory, per user and per address, and logins are turned down before checking the password once
+/// there are too many of them (see throttle.h)
+/// @param session the session of the client
+/// @param name the user name
+/// @param password the user password
+/// @param address the address of the client (NULL if unknown)
+/// @returns 1 on success, 0 on failure, INEX if the password could not be checked (too many logins at once),
+/// LOGIN_THROTTLED if the user or the address failed too many times
+int user_auth(struct session* session, const char* name, const char* password, const char* address){
+	if(name == NULL || password == NULL) return FALSE;
+	if(throttle_blocked(THROTTLE_ADDRESS, address) || throttle_blocked(THROTTLE_USER, name)){
+		printf("[SERVER_AUTH]: '%s' tried to login from %s, but failed too many times\n", name, address == NULL ? "?" : address);
+		return LOGIN_THROTTLED;
+	}
+	user record;
+	if(find_user(name, &record) == FALSE){
+		// user does not exist
+		printf("[SERVER_AUTH] '%s' is not part of the user database\n", name);
+		throttle_fail(THROTTLE_ADDRESS, address); // unknown names are not kept, anyone could fill the table with them
 		return FALSE;
 	}
-	char read_user[MAX_USERNAME_SIZE];
-	char read_pass[MAX_PASSWORD_SIZE];
-	int read_strikes;
-	int read_ban;
-	int io_chars;
-	while((io_chars = fscanf(file_ptr, "%s %s %d %d", read_user, read_pass, &read_strikes, &read_ban)) != EOF){
-		if(io_chars < 0){
-			fprintf(stderr, "ERROR: reading user database [out of format] (%s)\n", strerror(errno));
-			fclose(file_ptr);
-			return FALSE;
+	if(record.ban == TRUE){
+		printf("[SERVER_AUTH]: '%s' tried to login, but is banned\n", name);
+		return FALSE; // user is banned
+	}
+	int upgrade;
+	int result = kdf_verify(password, record.pass, &upgrade);
+	if(result == INEX){
+		printf("[SERVER_AUTH]: '%s' tried to login, but every KDF worker is busy\n", name);
+		return INEX;
+	}
+	if(result == TRUE){ // login OK
+		printf("[SERVER_AUTH]: '%s' just logged in (session %ld)\n", record.name, session->id);
+		session_login(session, record.name);
+		throttle_clear(THROTTLE_USER, record.name); // not the address, it may be trying every user
+		int changed = FALSE;
+		if(upgrade && kdf_hash(password, record.pass) == TRUE){ // otherwise tried again on the next login
+			printf("[SERVER_AUTH]: upgrading the password of '%s'\n", record.name);
+			changed = TRUE;
 		}
-		if(strcmp(user, read_user) == 0){ // line is user
-			strcpy(current_user.name, read_user);
-			strcpy(current_user.pass, read_pass);
-			current_user.strikes = read_strikes;
-			current_user.ban = read_ban;
-			if(read_ban == TRUE){
-				printf("[SERVER_AUTH]: '%s' tried to login, but is banned\n", user);
-				fclose(file_ptr);
-				return FALSE; // user is banned
-			}
-			if(strcmp(password, current_user.pass) == 0){ // login OK
-				current_user.strikes = 0;
-				printf("[SERVER_AUTH]: '%s' just logged in\n", current_user.name);
-				fclose(file_ptr);
-				update_current_user();
-				return TRUE;
-			}
-			// wrong password...
-			printf("[SERVER_AUTH]: '%s' entered a wrong password\n", current_user.name);
-			/*
-			 current_user.strikes++;
-			 printf("[SERVER_AUTH] '%s': wrong password\n", current_user.name, current_user.strikes);
-			 if(current_user.strikes > 2){
-			 current_user.ban = TRUE;
-			 printf("[SERVER_AUTH] '%s' is now BANNED\n", current_user.name);
-			 }
-			 fclose(file_ptr);
-			 update_current_user(); // register new strikes and/or bans
-			 */
-			fclose(file_ptr);
-			return FALSE; // wrong password
+		if(record.strikes != 0){
+			record.strikes = 0;
+			changed = TRUE;
 		}
+		if(changed) update_user(&record); // rewriting an unchanged database would invalidate the cached 'user ls' for nothing
+		return TRUE;
 	}
-	// user does not exist
-	printf("[SERVER_AUTH] '%s' is not part of the user database\n", user);
-	fclose(file_ptr);
-	return FALSE;
+	// wrong password...
+	printf("[SERVER_AUTH]: '%s' entered a wrong password\n", record.name);
+	throttle_fail(THROTTLE_USER, record.name); // in memory, nothing is written to the user database
+	throttle_fail(THROTTLE_ADDRESS, address);
+	session->strikes++;
+	return FALSE; // wrong password
 }
 
-/// changes the current user's password to new_password
+/// looks for a user in the database
+/// @param name the user name
+/// @param record where the user information is stored
+/// @returns 1 if the user exists, 0 otherwise
+int find_user(const char* name, user* record){
+	return users_find(name, record);
+}
+
+/// changes the password of the session's user to new_password
 ///
-/// changes the current user's password to new_password, which must be MAX_PASSWORD_SIZE characters long
-/// at most, also updates the user database after the change
-/// @returns the result of the update_current_user(), after changing the password
-int user_change_password(const char* new_password){
-	if(new_password == NULL) return FALSE;
+/// new_password must be MAX_PASSWORD_SIZE characters long at most, the user database is updated after the change
+/// (only its hash is stored)
+/// @param session the session of the client, must be logged in
+/// @param new_password the new password
+/// @returns the result of the update_user(), after changing the password
+int user_change_password(struct session* session, const char* new_password){
+	if(new_password == NULL || !session->logged_in) return FALSE;
 	if(strlen(new_password) > MAX_PASSWORD_SIZE){
 		perror("ERROR: new password is too long");
 		fprintf(stderr, "ERROR: new password is too long (max: %d chars)\n", MAX_PASSWORD_SIZE);
 		return FALSE;
 	}
-	printf("[SERVER_AUTH] %s just changed his password from [%s] to [%s]\n", current_user.name, current_user.pass, new_password);
-	strcpy(current_user.pass, new_password);
-	return update_current_user();
+	user record;
+	if(find_user(session->user, &record) == FALSE) return FALSE;
+	if(kdf_hash(new_password, record.pass) != TRUE) return FALSE;
+	printf("[SERVER_AUTH] %s just changed their password\n", record.name);
+	return update_user(&record);
 }
 
-/// updates the current user, saving it's information into the database
-int update_current_user(){
-	printf("[SERVER_AUTH]: updating user '%s'...", current_user.name);
-	FILE* file_read;
-	FILE* file_write;
-	if((file_read = fopen(USER_DDBB_FILE, "r")) == NULL){ // file does not exist
-		fprintf(stderr, "ERROR: opening user database (%s)\n", strerror(errno));
-		return FALSE;
-	}
-	if((file_write = fopen(USER_DDBB_TMP, "w")) == NULL){ // file does not exist
-		fprintf(stderr, "ERROR: writing user database (%s)\n", strerror(errno));
-		fclose(file_read);
-		return FALSE;
-	}
-	char read_user[MAX_USERNAME_SIZE], read_pas[MAX_PASSWORD_SIZE];
-	int read_strikes, read_ban, io_chars;
-	int result = FALSE;
-	while((io_chars = fscanf(file_read, "%s %s %d %d\n", read_user, read_pas, &read_strikes, &read_ban)) != EOF){
-		if(io_chars < 0){
-			fprintf(stderr, "ERROR: reading user database [out of format] (%s)\n", strerror(errno));
-			fclose(file_read);
-			fclose(file_write);
-			return FALSE;
-		}
-		if(strcmp(current_user.name, read_user) == 0){ // line is current userprintf(" ((%s %s %d %d)) ", current_user.name, current_user.pass, current_user.strikes, current_user.ban);
-			// replace line
-			fprintf(file_write, "%s %s %d %d\n", current_user.name, current_user.pass, current_user.strikes, current_user.ban);
-			result = TRUE; // user existed (it always should)
-		}else{
-			fprintf(file_write, "%s %s %d %d\n", read_user, read_pas, read_strikes, read_ban); // copy old line
-		}
-	}
-	fclose(file_read);
-	fclose(file_write);
-	remove(USER_DDBB_FILE);
-	rename(USER_DDBB_TMP, USER_DDBB_FILE);
+/// updates a user, saving it's information into the database
+///
+/// the change is visible right away, the database file is written in the background (see users.h)
+/// @param record the user information
+int update_user(const user* record){
+	printf("[SERVER_AUTH]: updating user '%s'...", record->name);
+	int changed;
+	int result = users_update(record, &changed);
+	if(changed) generation_bump(GENERATIONS, GENERATION_AUTH); // before responding, so the next 'user ls' is not served stale
 	printf("done\n");
 	return result; // if(OK == FALSE) user does not exist
 }
 
 /// prints the list of all users in the database
 void list_users(){
-	char string[MESSAGE_SIZE];
+	char string[LISTING_SIZE];
 	get_user_list(string);
 	printf("%s", string);
 }
 
 /// reads the user database and stores it's information into 'user_list'
-/// @param user_list the buffer in which to store the user list, **must be at least 1024 bytes long**
+/// @param user_list the buffer in which to store the user list, **must be at least LISTING_SIZE bytes long**
 /// @returns a pointer to the provided buffer
 char* get_user_list(char* user_list){
 	printf("[SERVER_AUTH]: getting user list...\n");
-	FILE* file_ptr;
-	if((file_ptr = fopen(USER_DDBB_FILE, "r")) == NULL){ // file does not exist
-		fprintf(stderr, "ERROR: opening user database (%s)\n", strerror(errno));
-		return NULL;
-	}
-	char read_user[MAX_USERNAME_SIZE];
-	char read_pass[MAX_PASSWORD_SIZE];
-	int read_strikes;
-	int read_ban;
-	char tmp[MESSAGE_SIZE];
-	strcpy(user_list, "> user list:\n");
-	sprintf(tmp, "%s%-30s %-10s %-10s\n", TAB, "name", "strikes", "banned");
-	strcat(user_list, tmp);
-	while(fscanf(file_ptr, "%s %s %d %d", read_user, read_pass, &read_strikes, &read_ban) != EOF){
-		sprintf(tmp, "%s%-30s %-10d %-10d\n", TAB, read_user, read_strikes, read_ban);
-		strcat(user_list, tmp);
+	return users_list(user_list, LISTING_SIZE);
+}
+
+/// records the latency of a login
+/// @param received when the login request was read from the queue
+void record_login_latency(const struct timespec* received){
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	double latency = (double) (now.tv_sec - received->tv_sec) * 1000 + (double) (now.tv_nsec - received->tv_nsec) / 1000000;
+	pthread_mutex_lock(&latency_lock);
+	login_latencies[logins++ % LATENCY_SAMPLES] = latency;
+	pthread_mutex_unlock(&latency_lock);
+}
+
+/// compares two latencies, for qsort()
+/// @param a the first latency
+/// @param b the second latency
+/// @returns -1, 0 or 1 as a is lower, equal or greater than b
+int compare_latencies(const void* a, const void* b){
+	double A = *(const double*) a;
+	double B = *(const double*) b;
+	return (A > B) - (A < B);
+}
+
+/// stores the state of the KDF workers, the throttled logins and the latency of the latest logins in *buffer*
+/// @param buffer the buffer, **must be at least MESSAGE_SIZE bytes long**
+/// @returns a pointer to the provided buffer
+char* get_auth_stats(char* buffer){
+	double latencies[LATENCY_SAMPLES];
+	pthread_mutex_lock(&latency_lock);
+	int count = logins < LATENCY_SAMPLES ? (int) logins : LATENCY_SAMPLES;
+	memcpy(latencies, login_latencies, (size_t) count * sizeof(double));
+	unsigned long total = logins;
+	pthread_mutex_unlock(&latency_lock);
+	qsort(latencies, (size_t) count, sizeof(double), compare_latencies);
+	sprintf(buffer, "> auth stats:\n");
+	kdf_stats(buffer + strlen(buffer), MESSAGE_SIZE - strlen(buffer));
+	throttle_stats(buffer + strlen(buffer), MESSAGE_SIZE - strlen(buffer));
+	if(count == 0){
+		sprintf(buffer + strlen(buffer), TAB "%-20s %lu\n\n", "logins", total);
+	}else{
+		sprintf(buffer + strlen(buffer), TAB "%-20s %lu (latest %d: p50 %.1f ms, p99 %.1f ms, max %.1f ms)\n\n", "logins", total, count,
+				latencies[count / 2], latencies[count * 99 / 100], latencies[count - 1]);
 	}
-	strcat(user_list, "\n");
-	fclose(file_ptr);
-	return user_list;
+	return buffer;
 }
 
 /// obtains the systemV message queue ID for communication with SERVER_MAIN
@@ -244,56 +306,185 @@ int get_message_queue(){
 		return FALSE;
 	}
 	Q_ID = msgget(key, 0666); // ASK: flags necessary?
+	if(Q_ID >= 0) setup_transport(FALSE);
 	return Q_ID;
 }
 
+/// publishes changes of the user database, so SERVER_MAIN knows when its cached listings are stale
+void setup_generation(){
+	if((GENERATIONS = generation_attach()) == NULL){
+		fprintf(stderr, "ERROR: generation numbers not initiated\n"
+				"> launch [SERVER_MAIN] first\n");
+		exit(EXIT_FAILURE);
+	}
+	generation_bump(GENERATIONS, GENERATION_AUTH); // users may have changed while SERVER_AUTH was down
+	if(generation_watch(GENERATIONS, GENERATION_AUTH, ".", USER_DDBB_DB) == FALSE) exit(EXIT_FAILURE); // imported with user_db
+}
+
+/// reads the session ID of the request being parsed with strtok_r()
+/// @param save the strtok_r() state of the request
+/// @returns the session ID, 0 if missing
+long get_session_id(char** save){
+	char* id = strtok_r(NULL, " ", save);
+	return id == NULL ? 0 : strtol(id, NULL, 10);
+}
+
+/// gets the lock of a session slot
+/// @param id the session ID
+/// @returns the lock, NULL if the ID is not valid
+pthread_mutex_t* get_session_lock(long id){
+	if(id <= 0) return NULL;
+	return &session_locks[(id % SESSION_SLOTS) % SESSION_LOCKS];
+}
+
+/// starts the worker pool, one worker per core (or as set in WORKERS_ENV)
+void setup_workers(){
+	int workers = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	char* env = getenv(WORKERS_ENV);
+	if(env != NULL) workers = (int) strtol(env, NULL, 10);
+	if(workers < 1) workers = 1;
+	if(workers > MAX_AUTH_WORKERS) workers = MAX_AUTH_WORKERS;
+	for(int i = 0;i < SESSION_LOCKS;i++){
+		pthread_mutex_init(&session_locks[i], NULL);
+	}
+	for(int i = 0;i < workers;i++){
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, auth_worker, NULL) != 0){
+			fprintf(stderr, "ERROR: creating worker %d (%s)\n", i, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		pthread_detach(thread);
+	}
+	printf("[SERVER_AUTH]: handling requests with %d worker(s)\n", workers);
+}
+
+/// worker thread: handles the requests read by await_message()
+/// @param arg unused
+void* auth_worker(void* arg){
+	(void) arg;
+	struct auth_job job;
+	while(TRUE){
+		pthread_mutex_lock(&jobs_lock);
+		while(jobs_tail == jobs_head){
+			pthread_cond_wait(&jobs_not_empty, &jobs_lock);
+		}
+		struct auth_job* next = &jobs[jobs_tail++ % AUTH_QUEUE_SIZE];
+		memcpy(&job, next, offsetof(struct auth_job, msg.data) + next->msg.length + 1); // only the bytes in use
+		pthread_cond_signal(&jobs_not_full);
+		pthread_mutex_unlock(&jobs_lock);
+		handle_message(&job);
+	}
+	return NULL;
+}
+
 /*
- "AUTH LOG %s %s"
+ "AUTH LOG <session> %s %s <address>"
  "AUTH LS"
- "AUTH PASS %s"
+ "AUTH PASS <session> %s <token>"
+ "AUTH END <session>"
+ "AUTH STATS"
  "AUTH KILL"
  */
 
-/// enters the program into a loop where it processes incoming messages
+/// processes a request and responds to SERVER_MAIN
+/// @param job the request, its message is used as the response buffer
+void handle_message(struct auth_job* job){
+	char* message = job->msg.data;
+	printf("[SERVER_AUTH]: processing message: [%s]\n", message);
+	char* save;
+	char* arg = strtok_r(message, " ", &save);
+	if(arg == NULL || strcmp("AUTH", arg) != 0 || (arg = strtok_r(NULL, " ", &save)) == NULL){ // should NEVER happen
+		fprintf(stderr, "ERROR: something went wrong with SERVER_AUTH message queue\n");
+		sprintf(message, "[SERVER_AUTH] who was THAT for???");
+		message_answer(&job->msg); // send response to MAIN
+		return;
+	}
+	if(strcmp("LS", arg) == 0){
+		char listing[LISTING_SIZE]; // longer than a message, put back together by SERVER_MAIN
+		get_user_list(listing);
+		printf("[SERVER_AUTH]: sending user list to [SERVER_MAIN]\n");
+		if(job->msg.request != 0) send_large(job->msg.reply, job->msg.request, 0, listing, strlen(listing)); // send response to MAIN
+		return;
+	}
+	if(strcmp("STATS", arg) == 0){
+		get_auth_stats(message);
+		message_answer(&job->msg); // send response to MAIN
+		return;
+	}
+	long id = get_session_id(&save);
+	pthread_mutex_t* lock = get_session_lock(id);
+	if(lock == NULL){
+		sprintf(message, "[SERVER_AUTH]: ERROR invalid session\n");
+		message_answer(&job->msg); // send response to MAIN
+		return;
+	}
+	pthread_mutex_lock(lock);
+	if(strcmp("LOG", arg) == 0){
+		struct session* session = session_attach(id);
+		char* user = strtok_r(NULL, " ", &save);
+		char* pass = strtok_r(NULL, " ", &save);
+		char* address = strtok_r(NULL, " ", &save);
+		int result = session == NULL ? FALSE : user_auth(session, user, pass, address);
+		if(result == TRUE){
+			sprintf(message, "[SERVER_AUTH]: welcome back %s!\n", session->user);
+			char token[TOKEN_SIZE];
+			if(token_issue(TOKENS, session->user, token) == TRUE){ // the client reconnects with it, see token.h
+				sprintf(message + strlen(message), TOKEN_PREFIX "%s\n", token);
+			}
+		}else if(result == INEX){ // not a strike, see backend_reply() in SERVER_MAIN
+			sprintf(message, "[SERVER_AUTH]: ERROR too many logins at once, try again later\n");
+		}else if(result == LOGIN_THROTTLED){
+			sprintf(message, "[SERVER_AUTH]: ERROR too many failed logins, try again later\n");
+		}else{
+			sprintf(message, "[SERVER_AUTH]: incorrect user and/or password, try again\n");
+		}
+		record_login_latency(&job->received);
+	}else if(strcmp("PASS", arg) == 0){
+		struct session* session = session_find(id);
+		char* new_pass = strtok_r(NULL, " ", &save);
+		char* token = strtok_r(NULL, " ", &save); // sessions resumed with a token never logged in here
+		char user[MAX_USERNAME_SIZE];
+		if((session == NULL || !session->logged_in) && token_verify(TOKENS, token, user) == TRUE){
+			session = session_attach(id);
+			session_login(session, user);
+		}
+		if(session == NULL || user_change_password(session, new_pass) != TRUE){
+			sprintf(message, "[SERVER_AUTH]: ERROR changing password (maybe too long)\n");
+		}else{
+			token_revoke(TOKENS, session->user); // tokens issued with the old password, see token.h
+			sprintf(message, "[SERVER_AUTH]: password successfully changed\n");
+		}
+	}else if(strcmp("END", arg) == 0){ // connection closed
+		session_close(session_find(id));
+		sprintf(message, "[SERVER_AUTH]: session closed\n");
+	}else{
+		sprintf(message, "[SERVER_AUTH] who was THAT for???");
+	}
+	pthread_mutex_unlock(lock);
+	message_answer(&job->msg); // send response to MAIN
+}
+
+/// enters the program into a loop where it reads incoming messages and hands them to the workers
 ///
-/// the program reads the messages destined to it, process them, and responds to SERVER_MAIN in the same queue
+/// the program reads the messages destined to it, the workers process them, and respond to SERVER_MAIN in the same queue
 void await_message(){
 	printf("[SERVER_AUTH]: awating messages...\n");
-	char message[MESSAGE_SIZE];
 	while(TRUE){
-		get_msg(SERVER_AUTH_MSG_TYPE, message); // get MAIN request
-		printf("[SERVER_AUTH]: processing message: [%s]\n", message);
-		char* arg = strtok(message, " ");
-		if(strcmp("AUTH", message) != 0){ // should NEVER happen
-			fprintf(stderr, "ERROR: something went wrong with SERVER_AUTH message queue\n");
-			send_msg(SERVER_MAIN_MSG_TYPE, "[SERVER_AUTH] who was THAT for???"); // send response to MAIN
-			return;
+		pthread_mutex_lock(&jobs_lock);
+		while(jobs_head - jobs_tail == AUTH_QUEUE_SIZE){ // every worker is busy, stop reading
+			pthread_cond_wait(&jobs_not_full, &jobs_lock);
 		}
-		arg = strtok(NULL, " ");
-		if(strcmp("LOG", arg) == 0){
-			char* user = strtok(NULL, " ");
-			char* pass = strtok(NULL, " ");
-			if(user_auth(user, pass) == TRUE){
-				sprintf(message, "[SERVER_AUTH]: welcome back %s!\n", current_user.name);
-			}else{
-				sprintf(message, "[SERVER_AUTH]: incorrect user and/or password, try again\n");
-			}
-			send_msg(SERVER_MAIN_MSG_TYPE, message); // send response to MAIN
-		}else if(strcmp("LS", arg) == 0){
-			get_user_list(message);
-			printf("[SERVER_AUTH]: sending user list to [SERVER_MAIN]\n");
-			send_msg(SERVER_MAIN_MSG_TYPE, message); // send response to MAIN
-		}else if(strcmp("PASS", arg) == 0){
-			char* new_pass = strtok(NULL, " ");
-			if(user_change_password(new_pass) != TRUE){
-				send_msg(SERVER_MAIN_MSG_TYPE, "[SERVER_AUTH]: ERROR changing password (maybe too long)\n"); // send response to MAIN
-				continue;
-			}
-			send_msg(SERVER_MAIN_MSG_TYPE, "[SERVER_AUTH]: password successfully changed\n"); // send response to MAIN
-		}else if(strcmp("KILL", message) == 0){
+		struct auth_job* job = &jobs[jobs_head % AUTH_QUEUE_SIZE]; // not seen by the workers until jobs_head moves
+		pthread_mutex_unlock(&jobs_lock);
+		message_receive(SERVER_AUTH_MSG_TYPE, &job->msg); // get MAIN request, straight into the queue
+		clock_gettime(CLOCK_MONOTONIC, &job->received);
+		if(strcmp("AUTH KILL", job->msg.data) == 0){
 			printf("[SERVER_AUTH] exiting...\n");
 			exit(EXIT_SUCCESS);
 		}
+		pthread_mutex_lock(&jobs_lock);
+		jobs_head++;
+		pthread_cond_signal(&jobs_not_empty);
+		pthread_mutex_unlock(&jobs_lock);
 	}
 }
-
@@ -12,6 +12,7 @@
 #include <stdlib.h>
 #include <dirent.h>
 #include <errno.h>
+#include <limits.h>
 #include <global.h>
 #include <message.h>
 #include <sys/types.h>
@@ -23,30 +24,101 @@
 #include <string.h>
 #include <unistd.h>
 #include <sys/socket.h>
+#include <sys/time.h>
 #include <netinet/in.h>
+#include <openssl/crypto.h>
 #include <openssl/md5.h>
+#include <openssl/rand.h>
 #include <stdint.h>
+#include <time.h>
+#include <pthread.h>
+#include <MBR.h>
+#include <generation.h>
+#include <workers.h>
+#include <signal.h>
 
 #define FILES_FOLDER "images" ///< directory in which .iso images are stored
+#define MAX_TRANSFERS 64 ///< maximum amount of transfers waiting for their client
+#define TRANSFER_TIMEOUT 60 ///< seconds a transfer waits for its client before being dropped
+#define MAX_LAYOUTS 32 ///< maximum amount of image partition tables kept in memory
+#define MAX_DIGESTS 64 ///< maximum amount of image (or partition) MD5s kept in memory
+#define MAX_DEVICES_SIZE (BUFFER_SIZE - 128) ///< maximum size of the targets of a transfer, so they fit in its header (see transfer_file())
 
 #define verbose ///< verbose mode
 
-int FD_client;
-int FD_transfer;
+int FD_client; ///< listening socket for file transfers
+
+/// a transfer requested through SERVER_MAIN, waiting for the client to connect with its ticket
+struct transfer{
+	long ticket; ///< random, so it can not be guessed by whoever connects to the transfer port, 0 if the slot is free
+	char filename[MAX_FILENAME_SIZE];
+	char device[MAX_DEVICES_SIZE];
+	int partition; ///< partition number, 0 for the whole image
+	unsigned long start; ///< first byte to transfer
+	unsigned long length; ///< amount of bytes to transfer
+	time_t created;
+};
+
+/// partition table of an image, parsed once and kept until the image changes
+struct image_layout{
+	char filename[MAX_FILENAME_SIZE]; ///< empty if the slot is free
+	time_t mtime;
+	unsigned long size;
+	int count;
+	struct partition_info partitions[MAX_PARTITIONS];
+};
+
+/// MD5 of a byte range of an image, hashed once and kept until the image changes
+struct image_digest{
+	char filename[MAX_FILENAME_SIZE]; ///< empty if the slot is free
+	time_t mtime;
+	unsigned long size;
+	unsigned long start; ///< first byte hashed
+	unsigned long length; ///< amount of bytes hashed
+	char MD5[2 * MD5_DIGEST_LENGTH + 1];
+};
+
+struct transfer transfers[MAX_TRANSFERS];
+int serving = 0; ///< clients connected for a transfer, each on its own thread (at most MAX_TRANSFERS)
+pthread_mutex_t transfers_lock = PTHREAD_MUTEX_INITIALIZER;
+struct image_layout layouts[MAX_LAYOUTS];
+int next_layout = 0; ///< next slot replaced when every slot is in use
+pthread_mutex_t layouts_lock = PTHREAD_MUTEX_INITIALIZER;
+struct image_digest digests[MAX_DIGESTS];
+int next_digest = 0; ///< next slot replaced when every slot is in use
+pthread_mutex_t digests_lock = PTHREAD_MUTEX_INITIALIZER;
+struct generations* GENERATIONS = NULL; ///< generation numbers shared with SERVER_MAIN
+struct worker_table* WORKERS = NULL; ///< worker table shared with SERVER_MAIN
+int WORKER = 0; ///< index of this worker, see workers.h
 
 char* get_current_dir();
 char* get_MD5(const char* target);
+char* get_MD5_range(const char* target, unsigned long start, unsigned long length);
+int get_layout(const char* filename, struct image_layout* layout);
+int get_digest(const char* filename, const char* file_path, unsigned long start, unsigned long length, char* MD5);
+void get_partition_list(int file_id, char* partition_list);
 int get_message_queue();
+void setup_generation();
+void setup_worker(int argc, char* argv[]);
+void register_worker();
+void deregister_worker();
+void SIGKILL_handler();
 int get_filename(int file_id, char* filename);
-void transfer_file(int file_id, const char* device);
-void get_file_list(char* file_list);
+long add_transfer(const char* filename, int partition, unsigned long start, unsigned long length, const char* device);
+int take_transfer(long ticket, struct transfer* transfer);
+void setup_transfer_socket();
+void* accept_transfers(void* arg);
+void* serve_transfer(void* arg);
+void transfer_file(int FD_transfer, const struct transfer* transfer);
+void get_file_list(char* file_list, size_t size);
 void await_message();
 void list_files();
 
 /// file server program entrypoint
 /// @returns 1 on error, 0 on success
-int main(void){
-	printf("> Launching [SERVER_FILE]\n\n");
+int main(int argc, char* argv[]){
+	setup_worker(argc, argv);
+	printf("> Launching [SERVER_FILE] (worker %d)\n\n", WORKER);
 	get_current_dir();
 	// get message queue
 	if(get_message_queue() < 0){
@@ -54,7 +126,10 @@ int main(void){
 				"> launch [SERVER_MAIN] first\n");
 		exit(EXIT_FAILURE);
 	}
+	setup_generation();
 	list_files();
+	register_worker(); // requests wait in the queue until await_message()
+	setup_transfer_socket();
 	await_message();
 	printf("> Closing [SERVER_FILE]\n");
 	return EXIT_SUCCESS;
@@ -62,15 +137,15 @@ int main(void){
 
 /// prints the list of all files in the FILES_FOLDER directory
 void list_files(){
-	char string[PATH_MAX];
-	get_file_list(string);
+	char string[LISTING_SIZE];
+	get_file_list(string, sizeof(string));
 	printf("%s", string);
 }
 
-/// reads the FILES_FOLDER directory and stores it's information into 'file_list'
-/// @param file_list the buffer in which to store the file list, **must be at least 4096 bytes long**
-/// @returns a pointer to the provided buffer
-void get_file_list(char* file_list){
+/// reads the FILES_FOLDER directory and stores it's information into 'file_list' (as many images as fit)
+/// @param file_list the buffer in which to store the file list
+/// @param size size of the buffer, at least 256 bytes
+void get_file_list(char* file_list, size_t size){
 	printf("[SERVER_FILE]: getting file list...\n");
 	DIR* directory;
 	struct dirent* dir_entity;
@@ -104,10 +179,14 @@ void get_file_list(char* file_list){
 			fclose(file_ptr);
 			return;
 		}
+		fclose(file_ptr);
+		if(strlen(file_list) + strlen(TAB) + 2 * MD5_DIGEST_LENGTH + 256 + 32 > size){ // keep room for the note below
+			strcat(file_list, TAB "(more images not listed)\n");
+			break;
+		}
 		char* MD5 = get_MD5(file_path);
-		sprintf(tmp, TAB "%d)  %-35s%-15d%s\n", ID++, dir_entity->d_name, (unsigned int) stat_struct.st_size, MD5);
+		snprintf(tmp, sizeof(tmp), TAB "%d)  %-35s%-15d%s\n", ID++, dir_entity->d_name, (unsigned int) stat_struct.st_size, MD5);
 		strcat(file_list, tmp);
-		fclose(file_ptr);
 	}
 	strcat(file_list, "\n");
 	closedir(directory);
@@ -129,40 +208,42 @@ char* get_current_dir(){
 /// @param target the file or device to be hashed
 /// @returns a pointer to the MD5 hash
 char* get_MD5(const char* target){
-	int FD = open(target, O_RDONLY);
-	if(FD < 0){
-		fprintf(stderr, "ERROR: opening %s for MD5 hash (%s)\n", target, strerror(errno));
-		exit(EXIT_FAILURE);
-	}
 	// get size
 	struct stat stat_struct;
 	if(stat(target, &stat_struct) != 0){
 		fprintf(stderr, "ERROR: reading file size (%s)\n", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
+	return get_MD5_range(target, 0, (unsigned long) stat_struct.st_size);
+}
+
+/// calculates MD5 hash for *length* bytes of *target* file, starting at *start*
+/// @param target the file or device to be hashed
+/// @param start first byte to hash
+/// @param length amount of bytes to hash
+/// @returns a pointer to the MD5 hash
+char* get_MD5_range(const char* target, unsigned long start, unsigned long length){
+	int FD = open(target, O_RDONLY);
+	if(FD < 0){
+		fprintf(stderr, "ERROR: opening %s for MD5 hash (%s)\n", target, strerror(errno));
+		exit(EXIT_FAILURE);
+	}
 	// init MD5
 	unsigned char MD5[MD5_DIGEST_LENGTH];
-	char buffer[512];
+	char buffer[65536];
 	MD5_CTX CTX;
-	long int reads = stat_struct.st_size / 512;
-	long int R;
 	MD5_Init(&CTX);
 	// calculate MD5
-	for(int i = 0;i < reads;i++){
-		R = read(FD, buffer, sizeof(buffer));
-		if(R < 0){
-			fprintf(stderr, "ERROR: reading %s for MD5 hash (%s)\n", target, strerror(errno));
-			return NULL;
-		}
-		MD5_Update(&CTX, buffer, (unsigned long) R);
-	}
-	if(stat_struct.st_size % 512 != 0){
-		R = read(FD, buffer, (long unsigned) (stat_struct.st_size % 512));
-		if(R < 0){
-			fprintf(stderr, "ERROR: reading %s for MD5 hash (%s)\n", target, strerror(errno));
+	while(length > 0){
+		ssize_t R = pread(FD, buffer, length < sizeof(buffer) ? length : sizeof(buffer), (off_t) start);
+		if(R <= 0){
+			fprintf(stderr, "ERROR: reading %s for MD5 hash (%s)\n", target, R < 0 ? strerror(errno) : "unexpected end of file");
+			close(FD);
 			return NULL;
 		}
 		MD5_Update(&CTX, buffer, (unsigned long) R);
+		start += (unsigned long) R;
+		length -= (unsigned long) R;
 	}
 	MD5_Final(MD5, &CTX);
 	close(FD);
@@ -176,6 +257,136 @@ char* get_MD5(const char* target){
 	return result;
 }
 
+/// obtains the partition table of an image
+///
+/// the table is parsed once (MBR, and GPT if the MBR is protective) and kept in memory until the image changes
+/// @param filename the image
+/// @param layout where the partition table is copied
+/// @returns 1 on success, 0 on failure
+int get_layout(const char* filename, struct image_layout* layout){
+	char file_path[PATH_MAX];
+	snprintf(file_path, sizeof(file_path), "%s/%s", FILES_FOLDER, filename);
+	struct stat stat_struct;
+	if(stat(file_path, &stat_struct) != 0){
+		fprintf(stderr, "ERROR: reading file size (%s)\n", strerror(errno));
+		return FALSE;
+	}
+	pthread_mutex_lock(&layouts_lock);
+	for(int i = 0;i < MAX_LAYOUTS;i++){
+		if(strcmp(layouts[i].filename, filename) == 0 && layouts[i].mtime == stat_struct.st_mtime
+				&& layouts[i].size == (unsigned long) stat_struct.st_size){
+			*layout = layouts[i];
+			pthread_mutex_unlock(&layouts_lock);
+			return TRUE;
+		}
+	}
+	pthread_mutex_unlock(&layouts_lock);
+	// not parsed yet (or changed)
+	printf("[SERVER_FILE]: reading partition table of [%s]\n", filename);
+	memset(layout, 0, sizeof(struct image_layout));
+	strcpy(layout->filename, filename);
+	layout->mtime = stat_struct.st_mtime;
+	layout->size = (unsigned long) stat_struct.st_size;
+	if((layout->count = read_partition_table(file_path, layout->partitions, MAX_PARTITIONS)) == INEX){
+		return FALSE;
+	}
+	pthread_mutex_lock(&layouts_lock);
+	int slot = INEX;
+	for(int i = 0;i < MAX_LAYOUTS && slot == INEX;i++){
+		if(strcmp(layouts[i].filename, filename) == 0 || strcmp(layouts[i].filename, "") == 0) slot = i;
+	}
+	if(slot == INEX){
+		slot = next_layout;
+		next_layout = (next_layout + 1) % MAX_LAYOUTS;
+	}
+	layouts[slot] = *layout;
+	pthread_mutex_unlock(&layouts_lock);
+	return TRUE;
+}
+
+/// obtains the MD5 of a byte range of an image (the whole image or one of its partitions)
+///
+/// the range is hashed once and kept in memory until the image changes, so a client that has it cached does not
+/// cost a read of the whole range
+/// @param filename the image
+/// @param file_path the path of the image
+/// @param start first byte of the range
+/// @param length amount of bytes of the range
+/// @param MD5 where the MD5 is stored, **must be at least 2 * MD5_DIGEST_LENGTH + 1 bytes long**
+/// @returns 1 on success, 0 on failure
+int get_digest(const char* filename, const char* file_path, unsigned long start, unsigned long length, char* MD5){
+	struct stat stat_struct;
+	if(stat(file_path, &stat_struct) != 0){
+		fprintf(stderr, "ERROR: reading file size (%s)\n", strerror(errno));
+		return FALSE;
+	}
+	pthread_mutex_lock(&digests_lock);
+	for(int i = 0;i < MAX_DIGESTS;i++){
+		if(strcmp(digests[i].filename, filename) == 0 && digests[i].mtime == stat_struct.st_mtime
+				&& digests[i].size == (unsigned long) stat_struct.st_size && digests[i].start == start && digests[i].length == length){
+			strcpy(MD5, digests[i].MD5);
+			pthread_mutex_unlock(&digests_lock);
+			return TRUE;
+		}
+	}
+	pthread_mutex_unlock(&digests_lock);
+	// not hashed yet (or changed)
+	printf("[SERVER_FILE]: hashing [%s] (%lu bytes from byte %lu)\n", filename, length, start);
+	char* hash = get_MD5_range(file_path, start, length);
+	if(hash == NULL) return FALSE;
+	strcpy(MD5, hash);
+	free(hash);
+	pthread_mutex_lock(&digests_lock);
+	int slot = INEX;
+	for(int i = 0;i < MAX_DIGESTS && slot == INEX;i++){
+		if((strcmp(digests[i].filename, filename) == 0 && digests[i].start == start && digests[i].length == length)
+				|| strcmp(digests[i].filename, "") == 0) slot = i;
+	}
+	if(slot == INEX){
+		slot = next_digest;
+		next_digest = (next_digest + 1) % MAX_DIGESTS;
+	}
+	strcpy(digests[slot].filename, filename);
+	digests[slot].mtime = stat_struct.st_mtime;
+	digests[slot].size = (unsigned long) stat_struct.st_size;
+	digests[slot].start = start;
+	digests[slot].length = length;
+	strcpy(digests[slot].MD5, MD5);
+	pthread_mutex_unlock(&digests_lock);
+	return TRUE;
+}
+
+/// stores the partition table of an image into 'partition_list'
+/// @param file_id the ID of the file, see list_files()
+/// @param partition_list the buffer in which to store the partition list, **must be at least MESSAGE_SIZE bytes long**
+void get_partition_list(int file_id, char* partition_list){
+	char filename[MAX_FILENAME_SIZE];
+	struct image_layout layout;
+	if(get_filename(file_id, filename) == FALSE){
+		sprintf(partition_list, "[SERVER_FILE]: incorrect image ID, use 'file ls' to get a list of images and their IDs\n");
+		return;
+	}
+	if(get_layout(filename, &layout) == FALSE){
+		sprintf(partition_list, "[SERVER_FILE]: ERROR reading partition table of [%s]\n", filename);
+		return;
+	}
+	if(layout.count == 0){
+		sprintf(partition_list, "> [%s] has no partition table\n\n", filename);
+		return;
+	}
+	char tmp[MESSAGE_SIZE];
+	snprintf(partition_list, MESSAGE_SIZE, "> partition table for [%s]:\n" TAB "%-5s%-8s%-15s%-15s%-10s%s\n",
+			filename, "ID", "type", "start (B)", "size (B)", "bootable", "name");
+	for(int i = 0;i < layout.count;i++){
+		struct partition_info* partition = &layout.partitions[i];
+		snprintf(tmp, sizeof(tmp), TAB "%-5d%-8x%-15lu%-15lu%-10s%s\n", partition->number, partition->type,
+				partition->start, partition->size, partition->bootable ? "yes" : "no", partition->name);
+		if(strlen(partition_list) + strlen(tmp) + 2 >= MESSAGE_SIZE) break; // does not fit in a message
+		strcat(partition_list, tmp);
+	}
+	strcat(partition_list, "\n");
+}
+
 /// obtains the systemV message queue ID for communication with SERVER_MAIN
 /// @returns 0 on error, queue_id on success
 int get_message_queue(){
@@ -185,9 +396,62 @@ int get_message_queue(){
 		return FALSE;
 	}
 	Q_ID = msgget(key, 0666); // ASK: flags necessary?
+	if(Q_ID >= 0) setup_transport(FALSE);
 	return Q_ID;
 }
 
+/// publishes changes of the FILES_FOLDER directory, so SERVER_MAIN knows when its cached listings are stale
+void setup_generation(){
+	if((GENERATIONS = generation_attach()) == NULL){
+		fprintf(stderr, "ERROR: generation numbers not initiated\n"
+				"> launch [SERVER_MAIN] first\n");
+		exit(EXIT_FAILURE);
+	}
+	generation_bump(GENERATIONS, GENERATION_FILE); // images may have changed while SERVER_FILE was down
+	if(generation_watch(GENERATIONS, GENERATION_FILE, FILES_FOLDER, NULL) == FALSE) exit(EXIT_FAILURE);
+}
+
+/// reads the worker index from the command line
+void setup_worker(int argc, char* argv[]){
+	char* end = NULL;
+	if(argc == 2) WORKER = (int) strtol(argv[1], &end, 10);
+	if(argc > 2 || (end != NULL && (*end != '\0' || end == argv[1])) || WORKER < 0 || WORKER >= MAX_FILE_WORKERS){
+		fprintf(stderr, "> use: %s [worker] (0 to %d)\n", argv[0], MAX_FILE_WORKERS - 1);
+		exit(EXIT_FAILURE);
+	}
+}
+
+/// registers this worker in the table shared with SERVER_MAIN, which starts sending it requests
+void register_worker(){
+	if((WORKERS = workers_attach()) == NULL){
+		fprintf(stderr, "ERROR: worker table not initiated\n"
+				"> launch [SERVER_MAIN] first\n");
+		exit(EXIT_FAILURE);
+	}
+	if(worker_register(WORKERS, WORKER) == FALSE){
+		fprintf(stderr, "ERROR: worker %d is already running\n", WORKER);
+		exit(EXIT_FAILURE);
+	}
+	signal(SIGINT, SIGKILL_handler);
+	signal(SIGTERM, SIGKILL_handler);
+	if((atexit(deregister_worker)) != 0){
+		fprintf(stderr, "ERROR: registering exit handler (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	printf("[SERVER_FILE]: registered as worker %d (message type %d, port %d)\n", WORKER, SERVER_FILE_MSG_TYPE + WORKER, SERVER_FILE_PORT + WORKER);
+}
+
+/// deregisters this worker, so SERVER_MAIN stops sending it requests
+void deregister_worker(){
+	printf("[SERVER_FILE]: deregistering worker %d\n", WORKER);
+	worker_deregister(WORKERS, WORKER);
+}
+
+/// handles the ctrl+C signal, closing the program properly
+void SIGKILL_handler(){
+	exit(EXIT_SUCCESS);
+}
+
 /*
  "FILE LS"
  "FILE DOWN ????"
@@ -201,32 +465,89 @@ void await_message(){
 	printf("[SERVER_FILE]: awating messages...\n");
 	char message[MESSAGE_SIZE];
 	while(TRUE){
-		get_msg(SERVER_FILE_MSG_TYPE, message); // get MAIN request
+		get_msg(SERVER_FILE_MSG_TYPE + WORKER, message); // get MAIN request
 		printf("[SERVER_FILE]: processing message: [%s]\n", message);
 		char* arg = strtok(message, " ");
 		if(strcmp("FILE", arg) != 0){ // should NEVER happen
 			fprintf(stderr, "ERROR: something went wrong with SERVER_FILE message queue\n");
-			send_msg(SERVER_MAIN_MSG_TYPE, "[SERVER_AUTH] who was THAT for???"); // send response to MAIN
+			send_response("[SERVER_AUTH] who was THAT for???"); // send response to MAIN
 			return;
 		}
 		arg = strtok(NULL, " ");
 		if(strcmp("LS", arg) == 0){
-			get_file_list(message);
+			char listing[LISTING_SIZE]; // longer than a message, put back together by SERVER_MAIN
+			get_file_list(listing, sizeof(listing));
 			printf("[SERVER_FILE]: sending file list to [SERVER_MAIN]\n");
-			send_msg(SERVER_MAIN_MSG_TYPE, message); // send response to MAIN
+			if(REQUEST_ID != 0) send_large(REPLY_TYPE, REQUEST_ID, 0, listing, strlen(listing)); // send response to MAIN
+		}else if(strcmp("PARTS", arg) == 0){
+			char* id = strtok(NULL, " "); // file_id
+			int file_id;
+			if(id == NULL || (file_id = (int) strtol(id, NULL, 10)) == 0){
+				send_response("[SERVER_FILE]: incorrect syntax, use: file parts <file_id>\n"); // send response to MAIN
+				continue;
+			}
+			get_partition_list(file_id, message);
+			send_response(message); // send response to MAIN
 		}else if(strcmp("DOWN", arg) == 0){
 			int file_id;
 			char* id = strtok(NULL, " "); // file_id
-			char* dev = strtok(NULL, " "); // file_id
-			if(id == NULL || dev == NULL){
-				send_msg(SERVER_MAIN_MSG_TYPE, "[SERVER_FILE]: incorrect syntax, use: file down <file_id> <device>\n"); // send response to MAIN
+			char* devices = strtok(NULL, ""); // every remaining arg is a target
+			if(id == NULL || devices == NULL){
+				send_response("[SERVER_FILE]: incorrect syntax, use: file down <file_id>[:<partition>] <device> [device...]\n"); // send response to MAIN
+				continue;
+			}
+			if(strlen(devices) >= MAX_DEVICES_SIZE){ // the client reads the header in one BUFFER_SIZE recv()
+				send_response("[SERVER_FILE]: ERROR too many targets, or their names are too long\n"); // send response to MAIN
 				continue;
 			}
-			if((file_id = (int) strtol(id, NULL, 10)) == 0){
-				send_msg(SERVER_MAIN_MSG_TYPE, "[SERVER_FILE]: incorrect syntax, use: file down <file_id> <device>\n"); // send response to MAIN
+			char* partition_id;
+			if((file_id = (int) strtol(id, &partition_id, 10)) == 0 || (*partition_id != '\0' && *partition_id != ':')){
+				send_response("[SERVER_FILE]: incorrect syntax, use: file down <file_id>[:<partition>] <device> [device...]\n"); // send response to MAIN
 				continue;
 			}
-			transfer_file(file_id, dev);
+			char filename[MAX_FILENAME_SIZE];
+			if(get_filename(file_id, filename) == FALSE){
+				send_response("[SERVER_FILE]: incorrect image ID, use 'file ls' to get a list of images and their IDs\n"); // send response to MAIN
+				continue;
+			}
+			// whole image, or only the byte range of one of its partitions
+			struct image_layout layout;
+			int partition = 0;
+			if(*partition_id == ':'){
+				char* end;
+				long number = strtol(partition_id + 1, &end, 10);
+				if(end == partition_id + 1 || *end != '\0' || number < 1 || number > INT_MAX){ // e.g. "1:" or "1:abc" are not the whole image
+					send_response("[SERVER_FILE]: incorrect partition, use 'file parts <file_id>' to get a list of partitions\n"); // send response to MAIN
+					continue;
+				}
+				partition = (int) number;
+			}
+			if(get_layout(filename, &layout) == FALSE){
+				send_response("[SERVER_FILE]: ERROR reading image\n"); // send response to MAIN
+				continue;
+			}
+			unsigned long start = 0;
+			unsigned long length = layout.size;
+			if(partition != 0){
+				int found = FALSE;
+				for(int i = 0;i < layout.count;i++){
+					if(layout.partitions[i].number != partition) continue;
+					start = layout.partitions[i].start;
+					length = layout.partitions[i].size;
+					found = TRUE;
+				}
+				if(!found || start + length > layout.size){
+					send_response("[SERVER_FILE]: incorrect partition, use 'file parts <file_id>' to get a list of partitions\n"); // send response to MAIN
+					continue;
+				}
+			}
+			long ticket = add_transfer(filename, partition, start, length, devices);
+			if(ticket == 0){
+				send_response("[SERVER_FILE]: ERROR too many transfers waiting, try again later\n"); // send response to MAIN
+				continue;
+			}
+			sprintf(message, START_FILE_TRANSFER_MSG " %ld %d", ticket, SERVER_FILE_PORT + WORKER);
+			send_response(message); // CLIENT connects to this worker with this ticket
 		}else if(strcmp("KILL", message) == 0){
 			printf("[SERVER_FILE] exiting...\n");
 			exit(EXIT_SUCCESS);
@@ -255,6 +576,7 @@ int get_filename(int file_id, char* filename){
 		sprintf(file_path, "%s/%s", dir_path, dir_entity->d_name);
 		if(++ID == file_id){
 			strcpy(filename, dir_entity->d_name);
+			closedir(directory);
 			return TRUE;
 		}
 	}
@@ -264,11 +586,68 @@ int get_filename(int file_id, char* filename){
 	return FALSE;
 }
 
-/// transfer the file pointed by file_id to the client
-/// @param file_id the ID of the file, see list_files()
-/// @param device the target in which file will be saved on the client's side (done so for simplicity of comms)
-void transfer_file(int file_id, const char* device){
-	printf("[SERVER_FILE]: setting up transfer for file ID: %d\n", file_id);
+/// registers a transfer, which will start once the client connects with the returned ticket
+///
+/// transfers whose client did not show up in TRANSFER_TIMEOUT seconds are dropped
+/// @param filename the image to transfer
+/// @param partition the partition to transfer, 0 for the whole image
+/// @param start the first byte to transfer
+/// @param length the amount of bytes to transfer
+/// @param device the space-separated target(s) in which file will be saved on the client's side
+/// @returns the ticket of the transfer, 0 if there are already MAX_TRANSFERS waiting (or no ticket could be generated)
+long add_transfer(const char* filename, int partition, unsigned long start, unsigned long length, const char* device){
+	long ticket = 0;
+	unsigned long random = 0;
+	while(random == 0){ // the transfer port takes no login, the ticket is all that proves who asked for the transfer
+		if(RAND_bytes((unsigned char*) &random, sizeof(random)) != 1){
+			fprintf(stderr, "ERROR: generating transfer ticket\n");
+			return 0;
+		}
+		random &= LONG_MAX; // positive, as parsed by the client
+	}
+	time_t now = time(NULL);
+	pthread_mutex_lock(&transfers_lock);
+	for(int i = 0;i < MAX_TRANSFERS;i++){
+		if(transfers[i].ticket != 0 && now - transfers[i].created > TRANSFER_TIMEOUT){
+			printf("[SERVER_FILE]: transfer [%ld] expired, client never connected\n", transfers[i].ticket);
+			transfers[i].ticket = 0;
+			worker_load(WORKERS, WORKER, -1, -(long) transfers[i].length);
+		}
+		if(transfers[i].ticket == 0 && ticket == 0){
+			ticket = transfers[i].ticket = (long) random;
+			strcpy(transfers[i].filename, filename);
+			strncpy(transfers[i].device, device, MAX_DEVICES_SIZE - 1);
+			transfers[i].partition = partition;
+			transfers[i].start = start;
+			transfers[i].length = length;
+			transfers[i].created = now;
+			worker_load(WORKERS, WORKER, 1, (long) length); // until the transfer ends, see serve_transfer()
+		}
+	}
+	pthread_mutex_unlock(&transfers_lock);
+	return ticket;
+}
+
+/// removes a transfer from the waiting list
+/// @param ticket the ticket sent by the client
+/// @param transfer where the transfer is copied
+/// @returns 1 on success, 0 if there is no transfer with such ticket
+int take_transfer(long ticket, struct transfer* transfer){
+	int result = FALSE;
+	pthread_mutex_lock(&transfers_lock);
+	for(int i = 0;i < MAX_TRANSFERS && ticket != 0;i++){
+		if(transfers[i].ticket == 0 || CRYPTO_memcmp(&transfers[i].ticket, &ticket, sizeof(long)) != 0) continue; // constant time
+		*transfer = transfers[i];
+		transfers[i].ticket = 0;
+		result = TRUE;
+		break;
+	}
+	pthread_mutex_unlock(&transfers_lock);
+	return result;
+}
+
+/// creates the socket in which clients connect for file transfers, and the thread that accepts them
+void setup_transfer_socket(){
 	FD_client = socket(AF_INET, SOCK_STREAM, 0); // TCP
 	if(FD_client == INEX){
 		fprintf(stderr, "ERROR: creating FD_client socket (%s)\n", strerror(errno));
@@ -280,55 +659,106 @@ void transfer_file(int file_id, const char* device){
 	if(setsockopt(FD_client, SOL_SOCKET, SO_REUSEADDR, &(int) {1}, sizeof(int)) < 0){
 		fprintf(stderr, "ERROR: setsockopt() in socket FD_client (%s)\n", strerror(errno));
 	}
-	int FD_transfer;
 	// setup server_address
 	struct sockaddr_in server_address;
 	memset((char*) &server_address, 0, sizeof(server_address));
 	server_address.sin_family = AF_INET;
 	server_address.sin_addr.s_addr = INADDR_ANY;
-	server_address.sin_port = htons(SERVER_FILE_PORT);
-
+	server_address.sin_port = htons((uint16_t) (SERVER_FILE_PORT + WORKER));
 	// bind to socket
 	if(bind(FD_client, (struct sockaddr*) &server_address, sizeof(server_address)) < 0){
 		fprintf(stderr, "ERROR: binding socket (%s)\n", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
-	// setup client_address and start listening
-	struct sockaddr_in client_address;
-	int client_length = sizeof(client_address);
-	printf("[SERVER_FILE]: waiting for client for transfer...\n");
-	listen(FD_client, 1);
-	send_msg(SERVER_MAIN_MSG_TYPE, START_FILE_TRANSFER_MSG);// send msg to SERVER_MAIN -> CLIENT to get ready for download
-	FD_transfer = accept(FD_client, (struct sockaddr*) &client_address, (socklen_t*) &client_length);
-	if(FD_transfer < 0){
-		fprintf(stderr, "ERROR: accept incoming conenction (%s)\n", strerror(errno));
+	listen(FD_client, MAX_TRANSFERS);
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, accept_transfers, NULL) != 0){
+		fprintf(stderr, "ERROR: creating transfer thread (%s)\n", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
-	printf("[SERVER_FILE]: accepted connection from [CLIENT]\n");
-	char filename[MAX_FILENAME_SIZE];
-	if(get_filename(file_id, filename) == FALSE){ // invalid file_id, close connection
-		close(FD_client);
-		close(FD_transfer);
-		return;
+	pthread_detach(thread);
+}
+
+/// accepts clients for file transfers, each of them is served on its own thread
+///
+/// anyone can connect, so there are at most MAX_TRANSFERS of them at once, and each one has TRANSFER_TIMEOUT seconds
+/// to send its ticket (and every answer after it)
+/// @param arg unused
+void* accept_transfers(void* arg){
+	(void) arg;
+	while(TRUE){
+		struct sockaddr_in client_address;
+		socklen_t client_length = sizeof(client_address);
+		int FD_transfer = accept(FD_client, (struct sockaddr*) &client_address, &client_length);
+		if(FD_transfer < 0){
+			fprintf(stderr, "ERROR: accept incoming conenction (%s)\n", strerror(errno));
+			continue;
+		}
+		pthread_mutex_lock(&transfers_lock);
+		int full = serving >= MAX_TRANSFERS;
+		if(!full) serving++;
+		pthread_mutex_unlock(&transfers_lock);
+		if(full){
+			printf("[SERVER_FILE]: too many [CLIENT]s connected for a transfer, closing the new one\n");
+			close(FD_transfer);
+			continue;
+		}
+		struct timeval timeout = {TRANSFER_TIMEOUT, 0};
+		if(setsockopt(FD_transfer, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout)) < 0){
+			fprintf(stderr, "ERROR: setsockopt() in socket FD_transfer (%s)\n", strerror(errno));
+		}
+		pthread_t thread;
+		if(pthread_create(&thread, NULL, serve_transfer, (void*) (intptr_t) FD_transfer) != 0){
+			fprintf(stderr, "ERROR: creating transfer thread (%s)\n", strerror(errno));
+			close(FD_transfer);
+			pthread_mutex_lock(&transfers_lock);
+			serving--;
+			pthread_mutex_unlock(&transfers_lock);
+			continue;
+		}
+		pthread_detach(thread);
 	}
-/*
-	printf("[SERVER_FILE]: transfering file [%s]...\n", filename);
-	// let client know the filename
-	if(send(FD_transfer, filename, MAX_FILENAME_SIZE, 0) < 0){ // SEND filename
-		fprintf(stderr, "ERROR: sending filename to [CLIENT] (%s)\n", strerror(errno));
-		close(FD_client);
+	return NULL;
+}
+
+/// serves a client connected for a file transfer: reads its ticket and transfers the requested file
+/// @param arg the socket of the client
+void* serve_transfer(void* arg){
+	int FD_transfer = (int) (intptr_t) arg;
+	char ticket[32];
+	memset(ticket, '\0', sizeof(ticket));
+	struct transfer transfer;
+	if(recv(FD_transfer, ticket, sizeof(ticket) - 1, 0) <= 0 || take_transfer(strtol(ticket, NULL, 10), &transfer) == FALSE){
+		printf("[SERVER_FILE]: [CLIENT] connected with an invalid ticket [%s]\n", ticket);
 		close(FD_transfer);
-		return;
+	}else{
+		printf("[SERVER_FILE]: accepted connection from [CLIENT] for transfer [%s]\n", ticket);
+		transfer_file(FD_transfer, &transfer);
+		close(FD_transfer);
+		worker_load(WORKERS, WORKER, -1, -(long) transfer.length);
 	}
-#ifdef verbose
-	printf("[SERVER_FILE]: sent filename [%s]...\n", filename);
-#endif
-*/
-	// see if client has permission to write
-	if(send(FD_transfer, device, strlen(device), 0) < 0){ // SEND device
+	pthread_mutex_lock(&transfers_lock);
+	serving--;
+	pthread_mutex_unlock(&transfers_lock);
+	return NULL;
+}
+
+/// transfer a file (or one of its partitions) to the client
+/// @param FD_transfer the socket of the client
+/// @param transfer the transfer, as registered by add_transfer()
+void transfer_file(int FD_transfer, const struct transfer* transfer){
+	const char* filename = transfer->filename;
+	const char* device = transfer->device; // the target(s) in which file will be saved on the client's side (done so for simplicity of comms)
+	printf("[SERVER_FILE]: setting up transfer for file: %s (partition %d, %lu bytes)\n", filename, transfer->partition, transfer->length);
+	char file_path[BUFFER_SIZE];
+	snprintf(file_path, sizeof(file_path), "%s/%s/%s", get_current_dir(), FILES_FOLDER, filename);
+	// see if client has permission to write: "<size> <MD5> <partition> <target> [target...]"
+	char header[BUFFER_SIZE];
+	char MD5[2 * MD5_DIGEST_LENGTH + 1];
+	if(get_digest(filename, file_path, transfer->start, transfer->length, MD5) == FALSE) return;
+	snprintf(header, sizeof(header), "%lu %s %d %s", transfer->length, MD5, transfer->partition, device);
+	if(send(FD_transfer, header, strlen(header), MSG_NOSIGNAL) < 0){ // SEND size and devices
 		fprintf(stderr, "ERROR: sending device to [CLIENT] (%s)\n", strerror(errno));
-		close(FD_client);
-		close(FD_transfer);
 		return;
 	}
 #ifdef verbose
@@ -336,52 +766,52 @@ void transfer_file(int file_id, const char* device){
 #endif
 	char buffer[BUFFER_SIZE];
 	memset(buffer, '\0', sizeof(buffer)); // reset buffer
-	if(recv(FD_transfer, buffer, BUFFER_SIZE, 0) < 0){ // GET OK
+	if(recv(FD_transfer, buffer, BUFFER_SIZE - 1, 0) < 0){ // GET OK
 		fprintf(stderr, "ERROR: receiving OK from [CLIENT] (%s)\n", strerror(errno));
-		close(FD_client);
-		close(FD_transfer);
 		return;
 	}
 #ifdef verbose
 	printf("[SERVER_FILE]: receiving confirmation\n");
 #endif
-	if(strcmp(buffer, OK) != 0){
+	if(strcmp(buffer, CACHED) == 0){
+		printf("[SERVER_FILE]: [CLIENT] already has [%s] cached\n", filename);
+		return;
+	}
+	if(strncmp(buffer, OK, strlen(OK)) != 0){
 		printf("[SERVER_FILE]: [CLIENT] unable to write on [%s]\n", device);
-		close(FD_client);
-		close(FD_transfer);
 		return;
 	}
+	unsigned long offset = strtoul(buffer + strlen(OK), NULL, 10); // bytes the client already has
+	if(offset > transfer->length) offset = transfer->length;
 #ifdef verbose
 	printf("[SERVER_FILE]: received OK\n");
 	printf("[SERVER_FILE]: opening file for transfer\n");
 #endif
 	FILE* file_ptr;
-	char file_path[BUFFER_SIZE];
-	sprintf(file_path, "%s/%s/%s", get_current_dir(), FILES_FOLDER, filename);
 	if((file_ptr = fopen(file_path, "rb")) == NULL){ // file does not exist
 		fprintf(stderr, "ERROR: opening transfer file [%s] (%s)\n", file_path, strerror(errno));
-		exit(EXIT_FAILURE);
+		return;
 	}
+	if(offset > 0){
+		printf("[SERVER_FILE]: resuming transfer from byte %lu\n", offset);
+	}
+	fseek(file_ptr, (long) (transfer->start + offset), SEEK_SET);
+	unsigned long left = transfer->length - offset;
 	size_t read = 0;
-	memset(buffer, '0', sizeof(buffer)); // reset buffer
+	char chunk[65536];
 #ifdef verbose
 	printf("[SERVER_FILE]: starting transfer\n");
 #endif
-	// read file in chunks of BUFFER_SIZE and send
-	while((read = fread(buffer, 1, sizeof(buffer) - 1, file_ptr)) > 0){
-		// send chunck of BUFFER_SIZE to client
-		//if(send(FD_transfer, buffer, read, MSG_ZEROCOPY) < 0){
-		if(send(FD_transfer, buffer, read, 0) < 0){
+	// read file in chunks and send
+	while(left > 0 && (read = fread(chunk, 1, left < sizeof(chunk) ? left : sizeof(chunk), file_ptr)) > 0){
+		//if(send(FD_transfer, chunk, read, MSG_ZEROCOPY) < 0){
+		if(send(FD_transfer, chunk, read, MSG_NOSIGNAL) < 0){ // client may cancel, do not die on SIGPIPE
 			fprintf(stderr, "ERROR: transfering file to [CLIENT] (%s)\n", strerror(errno));
 			fclose(file_ptr);
-			close(FD_client);
-			close(FD_transfer);
 			return;
 		}
-		memset(buffer, '\0', sizeof(buffer));
+		left -= read;
 	}
 	fclose(file_ptr);
-	close(FD_client);
-	close(FD_transfer);
 	printf("[SERVER_FILE]: file transfer complete\n");
 }
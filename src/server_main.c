@@ -12,33 +12,271 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
 #include <sys/msg.h>
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/un.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
 #include <unistd.h>
 #include <global.h>
 #include <message.h>
+#include <session.h>
+#include <frame.h>
+#include <generation.h>
+#include <workers.h>
+#include <token.h>
 #include <signal.h>
 
 #define MAX_ADDRESS_LENGTH 22 ///< maximum IP address length
-#define MAX_CONNECTIONS 1 ///< maximum amount of simultaneous connections
+#define MAX_CONNECTIONS 4096 ///< maximum amount of simultaneous connections
+#define MAX_EVENTS 256 ///< maximum amount of events handled on each epoll_wait()
+#define INPUT_SIZE (BUFFER_SIZE * 4) ///< size of the input buffer of each connection
+#define MAX_IN_FLIGHT 32 ///< maximum amount of backend requests in flight, the rest wait in the backend queue
+#define MAX_SHARDS 64 ///< maximum amount of shards (event loops)
+#define SHARDS_ENV "OS_IMAGE_SHARDS" ///< environment variable that overrides the amount of shards, one per core by default
+#define LIMITS_ENV "OS_IMAGE_LIMITS" ///< environment variable that overrides the limits, e.g. "clients=100,idle=60", see setup_limits()
+#define MAX_BACKLOG 256 ///< default maximum amount of backend requests waiting to be sent
+#define IDLE_TIMEOUT 600 ///< default seconds a client may stay idle
+#define LOGIN_TIMEOUT 30 ///< default seconds a client has to log in
+#define OUTPUT_LIMIT (BUFFER_SIZE * 64) ///< default bytes waiting to be sent to a client before its input is no longer processed
+#define REAP_INTERVAL 1 ///< seconds between checks for timed out clients
+#define SERVER_BUSY "[SERVER_MAIN]: server busy, try again later\n" ///< answer to clients (and commands) over the limits
+#define RELOAD_FLAG "--reload" ///< command line flag of a SERVER_MAIN taking over from the running one
+#define RELOAD_SOCKET "/tmp/os_image_tool_reload" ///< UNIX socket through which the running SERVER_MAIN hands over to a new one
+#define HANDOFF_REQUEST 0 ///< request ID (never used by a backend request) that tells a shard to stop listening, see hand_over()
+#define MAX_CACHED 32 ///< maximum amount of backend responses kept in memory
 #define SHOW_HELP 2 ///< special return code for process_command()
+#define COMMAND_FAILED 3 ///< special return code for process_command(), the client is answered but the command failed
+#define BACKEND_PENDING 4 ///< special return code for process_command(), the client is answered once the backend responds
+#define BACKEND_EXPIRED 5 ///< result passed to a backend_callback when the backend did not respond in time
+#define BACKEND_TIMEOUT 30 ///< default seconds a backend has to respond to a request
 
 #define verbose ///< verbose mode
 
-int FD_socket;
-int FD_comms_socket;
-unsigned short USER_LOGGED_IN = FALSE;
-unsigned short CONNECTIONS = 0;
+_Static_assert(SERVER_FILE_MSG_TYPE + MAX_FILE_WORKERS <= RING_COUNT, "every SERVER_FILE worker needs its own ring");
 
-int process_command(char* command);
-char* recv_client(char* buffer);
-void send_client(const char* buffer);
-void setup_client_connection(int argc, char* argv[]);
+/*
+ * clients are served by one shard (event loop) per core, each on its own thread:
+ *
+ *   epoll_wait() -> client readable  -> recv_client() -> process_command() -> send_reply()
+ *                                                                          -> backend_request() -> [backend queue]
+ *                -> client writable  -> flush_client()
+ *                -> backend readable -> backend_reply() -> done() -> send_reply()
+ *
+ * every shard has its own listening socket on the same port (SO_REUSEPORT, so the kernel spreads
+ * new clients among them), its own epoll instance and its own connection slots, and a client stays
+ * on the shard that accepted it. Shards only share the backend queue and in-flight table
+ * (backend_lock), the cached responses (cache_lock) and the session pool (see session.c).
+ * sockets are non-blocking and every connection has its own input and output buffers.
+ * msgrcv() can not be polled, so a listener thread blocks on it and forwards every response
+ * through the pipe of the shard its client belongs to. Every backend request carries its own ID, so up to
+ * MAX_IN_FLIGHT requests (to any backend) are in flight at once and each response is routed
+ * back to its connection with a single lookup in the in-flight table.
+ * A request in flight is either its request or its response sitting in the queue, so the limit
+ * is lowered to what the queue holds (see setup_message_queue()): otherwise requests could fill
+ * it and leave the backends blocked on msgsnd() with their responses. MAX_IN_FLIGHT responses
+ * also fit in the pipe, so the listener never blocks on it
+ *
+ * SERVER_FILE requests are queued for SERVER_FILE_MSG_TYPE and sent, once dispatched, to the least
+ * loaded SERVER_FILE worker (see workers.h). Transfer tickets are only known by the worker that
+ * handed them out, so the client is told which port to connect to along with its ticket
+ *
+ * one bad client can not degrade everyone else (see struct limits): clients over the limit and
+ * commands that would overflow the backend queue are told the server is busy instead of being
+ * queued, clients that do not log in or stay idle for too long are closed, and the commands of a
+ * client that does not read its replies are no longer processed (nor its input read) while too
+ * much output is waiting for it, so TCP pushes back on the client
+ *
+ * server_main --reload takes over from the running SERVER_MAIN without refusing a single client:
+ *
+ *   new: connect(RELOAD_SOCKET)                      old: accept -> sendmsg(listening sockets, SCM_RIGHTS)
+ *   new: epoll on the inherited sockets, ack   ->    old: shards stop listening, clients are drained
+ *                                                    old: exits once no client is left, leaving the IPC as is
+ *
+ * the listening sockets never close, so connections waiting to be accepted are taken by whichever
+ * process gets to them. The queue (or rings) and shared memory regions are attached by name. Backend
+ * responses reach the right process because each one reads its own message type, SERVER_MAIN_MSG_TYPE
+ * or SERVER_MAIN_RELOAD_MSG_TYPE, alternating with every reload, and each takes its sessions from its
+ * own slots (see session.h). A reload is refused while the previous SERVER_MAIN is still draining
+ *
+ * listings ('file ls', 'file parts', 'user ls') are kept in memory along with the generation of
+ * the backend data they were built from (see generation.h), and served without a backend request
+ * while that generation stays the same. The generation is read when the request is queued, so a
+ * change that races with the request leaves an entry that is already stale
+ *
+ * backend requests are asynchronous: process_command() queues the request along with the
+ * callback that completes the command (see backend_callback) and returns BACKEND_PENDING, and the
+ * shard goes on serving every other client. The callback runs on the shard of the client when the
+ * response arrives, or when the request times out (LIMITS.backend seconds after it was queued,
+ * checked by reap_clients()). A request that times out while in flight keeps its slot in the
+ * in-flight table, as its request or response still takes room in the queue, until the late
+ * response arrives and is discarded. The commands of a client are still answered in order, so
+ * the rest of its commands wait for the callback
+ */
+
+struct connection;
+
+/// completes a command once its backend request is over, on the shard of the client
+/// @param connection the client
+/// @param response the backend response (or the timeout notice), which the callback may rewrite, **LISTING_SIZE bytes long**
+/// @param result TRUE if the backend responded, COMMAND_FAILED if it reported an error, BACKEND_EXPIRED if it did not respond in time
+/// @returns what the client is answered with, see process_command()
+typedef int (*backend_callback)(struct connection* connection, char* response, int result);
+
+/// a client connection and its buffers
+struct connection{
+	int used; ///< FALSE if the slot is free
+	int FD; ///< client socket, INEX once closed
+	char input[INPUT_SIZE]; ///< bytes received from the client but not yet processed
+	size_t input_length;
+	char* output; ///< bytes waiting to be sent to the client
+	size_t output_length;
+	size_t output_sent;
+	size_t output_size;
+	uint32_t events; ///< epoll events currently registered
+	int framed; ///< protocol version negotiated with the client, 0 for the text protocol (see frame.h)
+	long seq; ///< sequence number of the command being processed, INEX for interactive (untagged) commands
+	int busy; ///< waiting for a backend response, no other command is processed meanwhile
+	int closing; ///< close once the output is sent
+	struct session* session; ///< login state of the client
+	char address[INET_ADDRSTRLEN]; ///< address of the client, failed logins are counted by it (see throttle.h)
+	char login_user[MAX_USERNAME_SIZE]; ///< user of the pending login request
+	char token[TOKEN_SIZE]; ///< token the session was resumed with, empty if it logged in through SERVER_AUTH
+	long request_id; ///< ID of the pending backend request, once sent
+	int request_type; ///< message type of the pending backend request
+	char request[MESSAGE_SIZE]; ///< pending backend request
+	backend_callback done; ///< completes the command of the pending backend request
+	time_t deadline; ///< when the pending backend request times out, 0 for never
+	unsigned long cache_generation; ///< generation read when the pending request was queued, 0 if it is not cached
+	struct connection* next; ///< next connection in the backend queue (or the free list)
+	struct shard* shard; ///< shard serving the client
+	time_t connected; ///< when the client connected
+	time_t active; ///< last time something was received from (or sent to) the client
+};
+
+/// an event loop with its own listening socket
+struct shard{
+	int index;
+	int FD_socket;
+	int FD_epoll;
+	int FD_backend[2]; ///< pipe through which backend responses reach the event loop
+	struct connection* free_connections; ///< free list of the connection slots of the shard
+	_Atomic int connections; ///< clients connected, see get_stats()
+	_Atomic unsigned long accepted; ///< clients accepted since launch
+	time_t reaped; ///< last time timed out clients were closed, see reap_clients()
+};
+
+/// what the running SERVER_MAIN hands over along with its listening sockets
+struct handoff{
+	int port;
+	int shards; ///< amount of listening sockets passed
+	long reply_type; ///< message type read by the running SERVER_MAIN
+	pid_t pid; ///< process ID of the running SERVER_MAIN
+};
+
+/// admission limits and timeouts, see setup_limits()
+struct limits{
+	int clients; ///< maximum amount of connected clients, the rest are told the server is busy
+	int backlog; ///< maximum amount of backend requests waiting to be sent, further commands are told the server is busy
+	int idle; ///< seconds a client may stay idle, 0 for no limit
+	int login; ///< seconds a client has to log in, 0 for no limit
+	int output; ///< bytes waiting to be sent to a client before its input is no longer processed
+	int backend; ///< seconds a backend has to respond to a request, 0 for no limit
+};
+
+/// a backend request in flight
+struct backend_call{
+	long id; ///< <generation> * MAX_IN_FLIGHT + <slot>, 0 if the slot is free
+	int type; ///< message type the request was sent to
+	struct connection* connection; ///< NULL once the request timed out, see backend_expire()
+};
+
+/// a backend response kept in memory
+struct cached_response{
+	unsigned long generation; ///< generation the response was built from, 0 if the entry is free
+	int which; ///< GENERATION_FILE or GENERATION_AUTH
+	char request[MESSAGE_SIZE];
+	char response[LISTING_SIZE];
+};
+
+/// a backend response, as forwarded by backend_listener()
+struct backend_response{
+	long request;
+	char* string; ///< as put together by receive_large(), freed by the shard (NULL for HANDOFF_REQUEST)
+};
+
+struct shard shards[MAX_SHARDS];
+int SHARDS = 1; ///< amount of shards, see setup_shards()
+struct connection connections[MAX_CONNECTIONS]; ///< split among the shards, slot i belongs to shard i % SHARDS
+pthread_mutex_t backend_lock = PTHREAD_MUTEX_INITIALIZER; ///< protects the backend queue and the in-flight table
+int backend_waiting = 0; ///< requests in the backend queue, not yet sent
+struct limits LIMITS = {MAX_CONNECTIONS, MAX_BACKLOG, IDLE_TIMEOUT, LOGIN_TIMEOUT, OUTPUT_LIMIT, BACKEND_TIMEOUT};
+_Atomic int CLIENTS = 0; ///< clients connected to every shard
+int PORT = SERVER_MAIN_PORT; ///< port clients connect to
+long MAIN_MSG_TYPE = SERVER_MAIN_MSG_TYPE; ///< message type backend responses to this process go to
+int FD_reload = INEX; ///< UNIX socket on which a new SERVER_MAIN asks to take over
+int FD_handoff = INEX; ///< connection to the SERVER_MAIN being taken over, until the takeover is acknowledged
+pid_t previous = 0; ///< SERVER_MAIN this process took over from, while it may still be draining
+int OWNS_IPC = FALSE; ///< the IPC is removed on exit, FALSE once handed over (or until taken over)
+_Atomic int HANDED_OFF = FALSE; ///< another SERVER_MAIN took over, this one is draining its clients
+struct connection* backend_head = NULL; ///< connections waiting to send a backend request
+struct connection* backend_tail = NULL;
+struct backend_call backend_calls[MAX_IN_FLIGHT]; ///< backend requests in flight
+int backend_in_flight = 0;
+int backend_abandoned = 0; ///< requests in flight that timed out, waiting for their late response
+unsigned long backend_expired = 0; ///< requests that timed out since launch, see get_stats()
+int backend_limit = MAX_IN_FLIGHT; ///< maximum amount of requests in flight, bounded by the queue size
+long backend_generation = 1; ///< increased with every request sent, see backend_dispatch()
+struct cached_response cached_responses[MAX_CACHED]; ///< backend listings, see cached_request()
+int cached_next = 0; ///< next entry replaced when every entry is in use
+pthread_mutex_t cache_lock = PTHREAD_MUTEX_INITIALIZER; ///< protects cached_responses
+struct generations* GENERATIONS = NULL; ///< generation numbers published by SERVER_FILE and SERVER_AUTH
+struct worker_table* WORKERS = NULL; ///< SERVER_FILE workers and their load
+struct token_key* TOKENS = NULL; ///< key of the session tokens, shared with SERVER_AUTH
+
+int process_command(struct connection* connection, char* command);
+void* event_loop(void* arg);
+void accept_clients(struct shard* shard);
+void reap_clients(struct shard* shard);
+void setup_limits();
+void recv_client(struct connection* connection);
+void process_input(struct connection* connection);
+void answer_client(struct connection* connection, char* buffer, int result);
+void send_client(struct connection* connection, const char* buffer);
+void send_bytes(struct connection* connection, const char* data, size_t length);
+int recv_frame(struct connection* connection, char* command);
+void send_reply(struct connection* connection, const char* buffer, int status);
+void flush_client(struct connection* connection);
+void update_events(struct connection* connection);
+void close_client(struct connection* connection);
+int backend_request(struct connection* connection, int type, const char* message, backend_callback done);
+int backend_command(struct connection* connection, int type, const char* message, char* command, backend_callback done);
+int backend_done(struct connection* connection, char* response, int result);
+int login_done(struct connection* connection, char* response, int result);
+int cached_done(struct connection* connection, char* response, int result);
+void backend_expire(struct shard* shard, time_t now);
+void backend_dispatch();
+long file_worker();
+int cached_request(struct connection* connection, int type, const char* message, char* command);
+void cache_response(int which, unsigned long generation, const char* request, const char* response);
+void backend_reply(long request, const char* message);
+void* backend_listener(void* arg);
+int backend_failed(const char* message);
+char* get_help(char* buffer);
+char* get_stats(char* buffer);
+int get_port(int argc, char* argv[]);
+int setup_listener(int port);
+void setup_shards(int port, const int* listeners, int count);
+int take_over(int* listeners);
+void setup_reload_socket();
+void hand_over();
 void SIGKILL_handler();
 void close_FDs();
-void setup_message_queue();
+void setup_message_queue(int attach);
 void delete_message_queue();
 
 /// main server program entrypoint
@@ -56,51 +294,87 @@ int main(int argc, char* argv[]){
 		fprintf(stderr, "ERROR: registering exit handler (%s)\n", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
-	// create systemV message queue
-	setup_message_queue();
-	// setup socket
-	setup_client_connection(argc, argv);
-	// setup client_address and start listening
-	struct sockaddr_in client_address;
-	int client_length = sizeof(client_address);
-	listen(FD_socket, MAX_CONNECTIONS); // MAX_CONNECTIONS = 1
-	char command[BUFFER_SIZE];
-	while(TRUE){
-		FD_comms_socket = accept(FD_socket, (struct sockaddr*) &client_address, (socklen_t*) &client_length);
-		send_client(OK); // confirm connection to client
-		printf("[SERVER_MAIN]: new connection ACCEPTED\n");
-		while(TRUE){
-			// get message
-			recv_client(command);
-			int result = process_command(command);
-			if(result == FALSE){
-				printf("[SERVER_MAIN]: client disconnected\n");
-				send_client(command); // responds to client
-				break; // break inner loop and wait for new client
-			}else if(result == SHOW_HELP){
-				sprintf(command, "> available commands:\n");
-				strcat(command, TAB "clear\n");
-				strcat(command, TAB "login <user> <pass>\n");
-				strcat(command, TAB "user ls\n");
-				strcat(command, TAB "user <pass>\n");
-				strcat(command, TAB "file ls\n");
-				strcat(command, TAB "file down <image_ID> <target>\n");
-				strcat(command, TAB "exit\n\n");
-			}
-			send_client(command); // responds to client
-		}
-		CONNECTIONS--; // client left
-		if(close(FD_comms_socket) < 0){ // close socket and wait for new client
-			fprintf(stderr, "ERROR: closing FD_comms_socket (%s)\n", strerror(errno));
-			continue;
+	setup_limits();
+	int reload = argc == 2 && strcmp(argv[1], RELOAD_FLAG) == 0;
+	int listeners[MAX_SHARDS] = {0};
+	int count = 0;
+	if(reload){
+		count = take_over(listeners); // listening sockets of the running SERVER_MAIN
+	}else{
+		PORT = get_port(argc, argv);
+		OWNS_IPC = TRUE;
+	}
+	session_instance((int) MAIN_MSG_TYPE - SERVER_MAIN_MSG_TYPE);
+	// create systemV message queue (or attach to the one in use)
+	setup_message_queue(reload);
+	// setup one listening socket, epoll instance and thread per shard, and the backend listener
+	setup_shards(PORT, listeners, count);
+	setup_reload_socket();
+	if(reload){ // the running SERVER_MAIN stops listening and leaves the IPC to this one
+		if(send(FD_handoff, OK, strlen(OK), MSG_NOSIGNAL) < 0){
+			fprintf(stderr, "ERROR: acknowledging takeover (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
 		}
+		close(FD_handoff);
+		OWNS_IPC = TRUE;
+		printf("[SERVER_MAIN]: took over from process %d\n", previous);
 	}
+	event_loop(&shards[0]); // shard 0 runs on the main thread
 	printf("> Closing [SERVER_MAIN]\n\n");
 	return EXIT_SUCCESS;
 }
 
-/// handles connection between server and client
-void setup_client_connection(int argc, char* argv[]){
+/// serves the clients of a shard
+/// @param arg the shard
+void* event_loop(void* arg){
+	struct shard* shard = (struct shard*) arg;
+	struct epoll_event events[MAX_EVENTS];
+	while(TRUE){
+		int count = epoll_wait(shard->FD_epoll, events, MAX_EVENTS, REAP_INTERVAL * 1000);
+		if(count < 0){
+			if(errno == EINTR) continue;
+			fprintf(stderr, "ERROR: waiting for events (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		for(int i = 0;i < count;i++){
+			if(events[i].data.ptr == &shard->FD_socket){ // new client(s)
+				accept_clients(shard);
+				continue;
+			}
+			if(events[i].data.ptr == &FD_reload){ // a new SERVER_MAIN wants to take over
+				hand_over();
+				continue;
+			}
+			if(events[i].data.ptr == shard->FD_backend){ // backend response(s)
+				struct backend_response response;
+				while(read(shard->FD_backend[0], &response, sizeof(response)) == sizeof(response)){
+					if(response.request == HANDOFF_REQUEST){ // the socket stays open for the new SERVER_MAIN
+						epoll_ctl(shard->FD_epoll, EPOLL_CTL_DEL, shard->FD_socket, NULL);
+						close(shard->FD_socket);
+						shard->FD_socket = INEX;
+						continue;
+					}
+					backend_reply(response.request, response.string);
+					free(response.string);
+				}
+				continue;
+			}
+			struct connection* connection = events[i].data.ptr;
+			if(connection->FD == INEX) continue; // closed by a previous event
+			if(events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) recv_client(connection);
+			if(connection->FD != INEX && events[i].events & EPOLLOUT){
+				flush_client(connection);
+				process_input(connection); // commands held back while the client was not reading
+			}
+		}
+		if(time(NULL) - shard->reaped >= REAP_INTERVAL) reap_clients(shard);
+	}
+	return NULL;
+}
+
+/// obtains the port clients connect to
+/// @returns the port given on the command line, SERVER_MAIN_PORT if none
+int get_port(int argc, char* argv[]){
 	int port;
 	if(argc > 2){
 		fprintf(stderr, "> use: %s [port]\n", argv[0]);
@@ -116,8 +390,20 @@ void setup_client_connection(int argc, char* argv[]){
 		printf("[SERVER_MAIN]: WARNING -> invalid port, using default SERVER_MAIN_PORT (%d)\n", SERVER_MAIN_PORT);
 		port = SERVER_MAIN_PORT;
 	}
-	// create socket
-	FD_socket = socket(AF_INET, SOCK_STREAM, 0); // TCP
+#ifdef verbose
+	printf("> verbose defined:\n");
+	printf(TAB "server process ID:    %d\n", getpid());
+	printf(TAB "serverport:          %d\n\n", port);
+	// htonl, htons, ntohl, ntohs - convert values between host and network byte orde
+#endif
+	return port;
+}
+
+/// creates a non-blocking listening socket on *port*, shared with the other shards
+/// @param port the port clients connect to
+/// @returns the socket
+int setup_listener(int port){
+	int FD_socket = socket(AF_INET, SOCK_STREAM, 0); // TCP
 	if(FD_socket == INEX){
 		fprintf(stderr, "ERROR: creating FD_socket (%s)\n", strerror(errno));
 		exit(EXIT_FAILURE);
@@ -128,6 +414,11 @@ void setup_client_connection(int argc, char* argv[]){
 	if(setsockopt(FD_socket, SOL_SOCKET, SO_REUSEADDR, &(int) {1}, sizeof(int)) < 0){
 		fprintf(stderr, "ERROR: setsockopt() in socket FD_client (%s)\n", strerror(errno));
 	}
+	// every shard binds the same port, the kernel spreads new connections among them
+	if(setsockopt(FD_socket, SOL_SOCKET, SO_REUSEPORT, &(int) {1}, sizeof(int)) < 0){
+		fprintf(stderr, "ERROR: setsockopt() in socket FD_socket (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
 	// setup server_address
 	struct sockaddr_in server_address;
 	memset((char*) &server_address, 0, sizeof(server_address));
@@ -139,45 +430,655 @@ void setup_client_connection(int argc, char* argv[]){
 		fprintf(stderr, "ERROR: binding socket (%s)\n", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
-#ifdef verbose
-	printf("> verbose defined:\n");
-	printf(TAB "server process ID:    %d\n", getpid());
-	printf(TAB "serverport:          %d\n\n", ntohs(server_address.sin_port));
-	// htonl, htons, ntohl, ntohs - convert values between host and network byte orde
-#endif
+	if(listen(FD_socket, SOMAXCONN) < 0){
+		fprintf(stderr, "ERROR: listening on FD_socket (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	fcntl(FD_socket, F_SETFL, fcntl(FD_socket, F_GETFL) | O_NONBLOCK);
+	return FD_socket;
+}
+
+/// sets up every shard (listening socket, epoll instance, connection slots and thread) and the thread that listens for backend responses
+/// @param port the port clients connect to
+/// @param listeners listening sockets inherited from another SERVER_MAIN, one per shard
+/// @param count amount of inherited sockets, 0 to create them (one shard per core)
+void setup_shards(int port, const int* listeners, int count){
+	SHARDS = (int) sysconf(_SC_NPROCESSORS_ONLN);
+	char* env = getenv(SHARDS_ENV);
+	if(env != NULL) SHARDS = (int) strtol(env, NULL, 10);
+	if(count > 0) SHARDS = count; // every inherited socket must be served
+	if(SHARDS < 1) SHARDS = 1;
+	if(SHARDS > MAX_SHARDS) SHARDS = MAX_SHARDS;
+	printf("[SERVER_MAIN]: serving clients from %d shard(s)\n", SHARDS);
+	for(int i = MAX_CONNECTIONS - 1;i >= 0;i--){
+		struct shard* shard = &shards[i % SHARDS];
+		connections[i].FD = INEX;
+		connections[i].shard = shard;
+		connections[i].next = shard->free_connections;
+		shard->free_connections = &connections[i];
+	}
+	for(int i = 0;i < SHARDS;i++){
+		struct shard* shard = &shards[i];
+		shard->index = i;
+		if((shard->FD_epoll = epoll_create1(0)) < 0){
+			fprintf(stderr, "ERROR: creating epoll instance (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		// listening socket
+		shard->FD_socket = count > 0 ? listeners[i] : setup_listener(port);
+		struct epoll_event event = {.events = EPOLLIN, .data.ptr = &shard->FD_socket};
+		if(epoll_ctl(shard->FD_epoll, EPOLL_CTL_ADD, shard->FD_socket, &event) < 0){
+			fprintf(stderr, "ERROR: adding FD_socket to epoll (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		// backend responses
+		if(pipe(shard->FD_backend) < 0){
+			fprintf(stderr, "ERROR: creating backend pipe (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		fcntl(shard->FD_backend[0], F_SETFL, fcntl(shard->FD_backend[0], F_GETFL) | O_NONBLOCK);
+		event.data.ptr = shard->FD_backend;
+		if(epoll_ctl(shard->FD_epoll, EPOLL_CTL_ADD, shard->FD_backend[0], &event) < 0){
+			fprintf(stderr, "ERROR: adding backend pipe to epoll (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, backend_listener, NULL) != 0){
+		fprintf(stderr, "ERROR: creating backend listener (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	pthread_detach(thread);
+	for(int i = 1;i < SHARDS;i++){ // shard 0 runs on the main thread
+		if(pthread_create(&thread, NULL, event_loop, &shards[i]) != 0){
+			fprintf(stderr, "ERROR: creating shard %d (%s)\n", i, strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		pthread_detach(thread);
+	}
+}
+
+/// accepts every pending client, giving each of them a connection slot
+/// @param shard the shard whose listening socket is readable
+void accept_clients(struct shard* shard){
+	struct sockaddr_in client_address;
+	socklen_t client_length = sizeof(client_address);
+	int FD_client;
+	while((FD_client = accept(shard->FD_socket, (struct sockaddr*) &client_address, &client_length)) >= 0){
+		if(shard->free_connections == NULL || CLIENTS >= LIMITS.clients){
+			fprintf(stderr, "ERROR: too many connections (max: %d), client REJECTED\n", shard->free_connections == NULL ? MAX_CONNECTIONS / SHARDS : LIMITS.clients);
+			send(FD_client, SERVER_BUSY, strlen(SERVER_BUSY), MSG_DONTWAIT | MSG_NOSIGNAL); // instead of an OK, best effort
+			close(FD_client);
+			continue;
+		}
+		fcntl(FD_client, F_SETFL, fcntl(FD_client, F_GETFL) | O_NONBLOCK);
+		struct connection* connection = shard->free_connections;
+		shard->free_connections = connection->next;
+		char* output = connection->output; // output buffers are kept between connections
+		size_t output_size = connection->output_size;
+		memset(connection, 0, sizeof(struct connection));
+		connection->used = TRUE;
+		connection->FD = FD_client;
+		connection->output = output;
+		connection->output_size = output_size;
+		connection->shard = shard;
+		inet_ntop(AF_INET, &client_address.sin_addr, connection->address, sizeof(connection->address));
+		connection->connected = connection->active = time(NULL);
+		connection->seq = INEX;
+		connection->events = EPOLLIN;
+		struct epoll_event event = {.events = EPOLLIN, .data.ptr = connection};
+		if((connection->session = session_open()) == NULL || epoll_ctl(shard->FD_epoll, EPOLL_CTL_ADD, FD_client, &event) < 0){
+			fprintf(stderr, "ERROR: adding client to epoll (%s)\n", strerror(errno));
+			session_close(connection->session);
+			close(FD_client);
+			connection->used = FALSE;
+			connection->FD = INEX;
+			connection->next = shard->free_connections;
+			shard->free_connections = connection;
+			continue;
+		}
+		shard->accepted++;
+		CLIENTS++;
+		printf("[SERVER_MAIN]: new connection ACCEPTED on shard %d (%d connected)\n", shard->index, ++shard->connections);
+		send_client(connection, OK); // confirm connection to client
+	}
+	if(errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR){
+		fprintf(stderr, "ERROR: accepting client (%s)\n", strerror(errno));
+	}
 }
 
-/// sends a message to the connected client
+/// receive whatever the client sent and process it
 ///
-/// sends a message to the connected client using TCP socket
+/// receive whatever the client sent using TCP socket, without blocking, and queues it in the connection's input buffer
+/// @param connection the client
+void recv_client(struct connection* connection){
+	while(connection->input_length < INPUT_SIZE){
+		ssize_t io_count = recv(connection->FD, connection->input + connection->input_length, INPUT_SIZE - connection->input_length, 0);
+		if(io_count < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK) break;
+			if(errno == EINTR) continue;
+			if(errno != ECONNRESET) fprintf(stderr, "ERROR: reading client socket (%s)\n", strerror(errno));
+			close_client(connection);
+			return;
+		}
+		if(io_count == 0){ // client disconnected
+			printf("[SERVER_MAIN]: client disconnected\n");
+			close_client(connection);
+			return;
+		}
+		connection->input_length += (size_t) io_count;
+		connection->active = time(NULL);
+	}
+	process_input(connection);
+}
+
+/// processes every complete command in the input buffer of a connection
+///
+/// three kinds of commands are accepted: frames (see frame.h), and with the text protocol interactive commands, where
+/// one recv() is one command, and pipelined commands ("#<seq> <command>\n"). Frames and pipelined commands may arrive
+/// split or several at once. Commands are processed in order, one at a time: while a command waits for a backend the
+/// rest stay in the buffer
+/// @param connection the client
+void process_input(struct connection* connection){
+	char command[LISTING_SIZE]; // holds the response afterwards, cached listings are answered in place
+	while(connection->FD != INEX && !connection->busy && !connection->closing && connection->input_length > 0
+			&& connection->output_length - connection->output_sent < (size_t) LIMITS.output){ // backpressure
+		memset(command, 0, BUFFER_SIZE);
+		connection->seq = INEX;
+		if(connection->framed || (unsigned char) connection->input[0] == FRAME_MAGIC){
+			int result = recv_frame(connection, command);
+			if(result == INEX){ // protocol error
+				close_client(connection);
+				return;
+			}
+			if(result == FALSE) break; // incomplete frame
+			if(strcmp(command, "") == 0) continue; // hello, already answered
+		}else if(connection->input[0] != BATCH_TAG[0]){ // interactive command
+			size_t length = connection->input_length < BUFFER_SIZE - 1 ? connection->input_length : BUFFER_SIZE - 1;
+			memcpy(command, connection->input, length);
+			connection->input_length = 0;
+		}else{
+			char* newline = memchr(connection->input, '\n', connection->input_length);
+			if(newline == NULL){ // incomplete pipelined command
+				if(connection->input_length == INPUT_SIZE){ // no newline in sight, drop it
+					fprintf(stderr, "ERROR: pipelined command too long, discarding\n");
+					connection->input_length = 0;
+				}
+				break;
+			}
+			*newline = '\0';
+			char* start;
+			connection->seq = strtol(connection->input + 1, &start, 10);
+			if(*start == ' ') start++;
+			strncpy(command, start, BUFFER_SIZE - 1);
+			size_t used = (size_t) (newline - connection->input) + 1;
+			memmove(connection->input, newline + 1, connection->input_length - used);
+			connection->input_length -= used;
+		}
+		int result = process_command(connection, command);
+		if(result == BACKEND_PENDING) break; // answered by backend_reply()
+		answer_client(connection, command, result);
+	}
+	update_events(connection);
+}
+
+/// takes the next frame out of the input buffer of a connection
+///
+/// hellos are answered right away with the version both sides speak, commands are stored in *command*
+/// @param connection the client
+/// @param command the buffer in which to store the command (empty for hellos), **must be at least BUFFER_SIZE bytes long**
+/// @returns TRUE if a frame was taken, FALSE if it is not complete yet, INEX if it is malformed
+int recv_frame(struct connection* connection, char* command){
+	struct frame_header header;
+	int decoded = frame_decode(connection->input, connection->input_length, &header);
+	if(decoded == FALSE && connection->input_length < INPUT_SIZE) return FALSE;
+	if(decoded != TRUE || header.length > BUFFER_SIZE - 1 || (header.type != FRAME_HELLO && header.type != FRAME_COMMAND)
+			|| (header.type == FRAME_HELLO && header.length != 2)){
+		fprintf(stderr, "ERROR: malformed frame from client, closing connection\n");
+		return INEX;
+	}
+	char* payload = connection->input + FRAME_HEADER_SIZE;
+	if(header.type == FRAME_HELLO){
+		uint16_t version;
+		memcpy(&version, payload, 2);
+		version = ntohs(version);
+		if(version > FRAME_VERSION) version = FRAME_VERSION;
+		if(version == 0) version = 1;
+		connection->framed = version;
+		char hello[FRAME_HEADER_SIZE + 2];
+		frame_encode(hello, FRAME_HELLO, 0, header.seq, 2);
+		version = htons(version);
+		memcpy(hello + FRAME_HEADER_SIZE, &version, 2);
+		send_bytes(connection, hello, sizeof(hello));
+	}else{
+		memcpy(command, payload, header.length);
+		command[header.length] = '\0';
+		connection->seq = header.seq;
+	}
+	size_t used = FRAME_HEADER_SIZE + header.length;
+	memmove(connection->input, connection->input + used, connection->input_length - used);
+	connection->input_length -= used;
+	return TRUE;
+}
+
+/// answers a processed command
+/// @param connection the client
+/// @param buffer the response (or the command, if it needs no response), **must be at least BUFFER_SIZE bytes long**
+/// @param result the result of process_command()
+void answer_client(struct connection* connection, char* buffer, int result){
+	if(result == FALSE){
+		printf("[SERVER_MAIN]: client disconnected\n");
+		connection->closing = TRUE; // closed once the response is sent
+	}else if(result == SHOW_HELP){
+		get_help(buffer);
+	}
+	send_reply(connection, buffer, result == COMMAND_FAILED ? REPLY_FAILED : REPLY_OK); // responds to client
+}
+
+/// queues a message for the client and sends as much of it as possible
+/// @param connection the client
 /// @param buffer the message to be sent
-void send_client(const char* buffer){
-	ssize_t io_count = send(FD_comms_socket, buffer, strlen(buffer), 0); // responds to client
-	if(io_count < 0){
-		fprintf(stderr, "ERROR: writing FD_comms_socket (%s)\n", strerror(errno));
-		exit(EXIT_FAILURE);
+void send_client(struct connection* connection, const char* buffer){
+	send_bytes(connection, buffer, strlen(buffer));
+}
+
+/// queues *length* bytes for the client and sends as much of them as possible
+/// @param connection the client
+/// @param data the bytes to be sent
+/// @param length amount of bytes
+void send_bytes(struct connection* connection, const char* data, size_t length){
+	if(connection->FD == INEX) return; // client already left
+	if(connection->output_length + length > connection->output_size){
+		size_t size = connection->output_size > 0 ? connection->output_size : BUFFER_SIZE;
+		while(size < connection->output_length + length) size *= 2;
+		char* output = realloc(connection->output, size);
+		if(output == NULL){
+			fprintf(stderr, "ERROR: allocating output buffer (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+		connection->output = output;
+		connection->output_size = size;
 	}
+	memcpy(connection->output + connection->output_length, data, length);
+	connection->output_length += length;
+	flush_client(connection);
 }
 
-/// receive a message from the connected client
+/// answers the command being processed
 ///
-/// receive a message from the connected client using TCP socket
-/// @param buffer the buffer in which to store the message, **the buffer must be at least BUFFER_SIZE bytes long**
+/// framed clients get a FRAME_REPLY, with the text protocol interactive commands are answered as-is and
+/// pipelined commands get a "#<seq> <status> <length>\n" header, so the client can match every reply to its command
+/// @param connection the client
+/// @param buffer the response to be sent
+/// @param status REPLY_OK or REPLY_FAILED
+void send_reply(struct connection* connection, const char* buffer, int status){
+	if(connection->framed){
+		char header[FRAME_HEADER_SIZE];
+		frame_encode(header, FRAME_REPLY, (uint16_t) status, (uint32_t) connection->seq, (uint32_t) strlen(buffer));
+		send_bytes(connection, header, sizeof(header));
+	}else if(connection->seq != INEX){
+		char header[64];
+		sprintf(header, BATCH_TAG "%ld %d %lu\n", connection->seq, status, (unsigned long) strlen(buffer));
+		send_client(connection, header);
+	}
+	send_client(connection, buffer);
+}
+
+/// sends as much of the output buffer as the socket takes without blocking
+/// @param connection the client
+void flush_client(struct connection* connection){
+	while(connection->output_sent < connection->output_length){
+		ssize_t io_count = send(connection->FD, connection->output + connection->output_sent,
+				connection->output_length - connection->output_sent, MSG_NOSIGNAL);
+		if(io_count < 0){
+			if(errno == EAGAIN || errno == EWOULDBLOCK) break; // wait for EPOLLOUT
+			if(errno == EINTR) continue;
+			if(errno != EPIPE && errno != ECONNRESET){ // client already left, not worth complaining
+				fprintf(stderr, "ERROR: writing client socket (%s)\n", strerror(errno));
+			}
+			close_client(connection);
+			return;
+		}
+		connection->output_sent += (size_t) io_count;
+		connection->active = time(NULL);
+	}
+	if(connection->output_sent == connection->output_length){
+		connection->output_sent = connection->output_length = 0;
+		if(connection->closing){
+			close_client(connection);
+			return;
+		}
+	}
+	update_events(connection);
+}
+
+/// registers the events the connection is waiting for: input while there is room for it, output while there is something to send
+/// @param connection the client
+void update_events(struct connection* connection){
+	if(connection->FD == INEX) return;
+	uint32_t events = 0;
+	if(connection->input_length < INPUT_SIZE && !connection->closing
+			&& connection->output_length - connection->output_sent < (size_t) LIMITS.output) events |= EPOLLIN;
+	if(connection->output_sent < connection->output_length) events |= EPOLLOUT;
+	if(events == connection->events) return;
+	struct epoll_event event = {.events = events, .data.ptr = connection};
+	if(epoll_ctl(connection->shard->FD_epoll, EPOLL_CTL_MOD, connection->FD, &event) < 0){
+		fprintf(stderr, "ERROR: updating client events (%s)\n", strerror(errno));
+	}
+	connection->events = events;
+}
+
+/// closes the client socket, the slot is released once no backend request is pending for it
+/// @param connection the client
+void close_client(struct connection* connection){
+	if(connection->FD != INEX){
+		epoll_ctl(connection->shard->FD_epoll, EPOLL_CTL_DEL, connection->FD, NULL);
+		if(close(connection->FD) < 0){
+			fprintf(stderr, "ERROR: closing client socket (%s)\n", strerror(errno));
+		}
+		connection->FD = INEX;
+		connection->shard->connections--; // client left
+		CLIENTS--;
+	}
+	if(connection->busy || !connection->used) return;
+	if(connection->session->auth_time != 0){ // let AUTH forget the session, the slot is released with its response
+		char message[MESSAGE_SIZE];
+		sprintf(message, "AUTH END %ld", connection->session->id);
+		connection->session->auth_time = 0;
+		backend_request(connection, SERVER_AUTH_MSG_TYPE, message, backend_done);
+		connection->deadline = 0; // never expires, AUTH would keep the session logged in (read by backend_expire() on this thread)
+		return;
+	}
+	session_close(connection->session);
+	connection->session = NULL;
+	connection->used = FALSE;
+	connection->next = connection->shard->free_connections;
+	connection->shard->free_connections = connection;
+}
+
+/// queues a backend request, the client is answered by *done* once the backend responds or the request times out
+/// @param connection the client
+/// @param type message type of the backend (SERVER_AUTH_MSG_TYPE or SERVER_FILE_MSG_TYPE)
+/// @param message the request
+/// @param done the callback that completes the command, see backend_callback
+/// @returns BACKEND_PENDING
+int backend_request(struct connection* connection, int type, const char* message, backend_callback done){
+	connection->busy = TRUE;
+	connection->cache_generation = 0;
+	connection->request_type = type;
+	connection->request_id = 0;
+	connection->done = done;
+	connection->deadline = LIMITS.backend > 0 ? time(NULL) + LIMITS.backend : 0;
+	strcpy(connection->request, message);
+	connection->next = NULL;
+	pthread_mutex_lock(&backend_lock);
+	if(backend_tail == NULL) backend_head = connection;
+	else backend_tail->next = connection;
+	backend_tail = connection;
+	backend_waiting++;
+	backend_dispatch();
+	pthread_mutex_unlock(&backend_lock);
+	return BACKEND_PENDING;
+}
+
+/// queues a backend request for a command, unless the backend queue is over its limit
+/// @param connection the client
+/// @param type message type of the backend (SERVER_AUTH_MSG_TYPE or SERVER_FILE_MSG_TYPE)
+/// @param message the request
+/// @param command the buffer in which to store the answer if the server is busy, **must be at least BUFFER_SIZE bytes long**
+/// @param done the callback that completes the command, see backend_callback
+/// @returns BACKEND_PENDING, COMMAND_FAILED if the server is busy
+int backend_command(struct connection* connection, int type, const char* message, char* command, backend_callback done){
+	pthread_mutex_lock(&backend_lock);
+	int busy = backend_waiting >= LIMITS.backlog;
+	pthread_mutex_unlock(&backend_lock);
+	if(busy){
+		sprintf(command, SERVER_BUSY);
+		return COMMAND_FAILED;
+	}
+	return backend_request(connection, type, message, done);
+}
+
+/// completes a command with the backend response as it is
+/// @param connection unused
+/// @param response unused
+/// @param result the outcome of the request
+/// @returns 1 if the backend responded, COMMAND_FAILED otherwise
+int backend_done(__attribute__((unused)) struct connection* connection, __attribute__((unused)) char* response, int result){
+	return result == TRUE ? TRUE : COMMAND_FAILED;
+}
+
+/// completes a login, logging the session in or counting a strike
+/// @param connection the client
+/// @param response the SERVER_AUTH response
+/// @param result the outcome of the request
+/// @returns 1 on success, COMMAND_FAILED on failure, 0 if the client struck out
+int login_done(struct connection* connection, char* response, int result){
+	struct session* session = connection->session;
+	if(result == BACKEND_EXPIRED) return COMMAND_FAILED; // the password was never checked, not a strike
+	// "[SERVER_AUTH]: incorrect user and/or password, try again\n"
+	if(strncmp("[SERVER_AUTH]: incorrect", response, strlen("[SERVER_AUTH]: incorrect")) == 0){
+		if(++session->strikes > 2){
+			sprintf(response, "[SERVER_MAIN]: incorrent AGAIN, you are now BANNED (not really)\n");
+			session_logout(session);
+			return FALSE;
+		}
+	}else if(result == TRUE){ // successful login, SERVER_AUTH may also be too busy to check it
+		session_login(session, connection->login_user);
+	}
+	return backend_done(connection, response, result);
+}
+
+/// completes a listing, keeping it in memory along with the generation read when it was queued (see cached_request())
+/// @param connection the client
+/// @param response the backend response
+/// @param result the outcome of the request
+/// @returns 1 if the backend responded, COMMAND_FAILED otherwise
+int cached_done(struct connection* connection, char* response, int result){
+	if(connection->cache_generation != 0 && result == TRUE){
+		int which = connection->request_type == SERVER_AUTH_MSG_TYPE ? GENERATION_AUTH : GENERATION_FILE;
+		cache_response(which, connection->cache_generation, connection->request, response);
+	}
+	return backend_done(connection, response, result);
+}
+
+/// answers a listing from memory if the backend data did not change since it was cached, otherwise queues a backend request
+/// @param connection the client
+/// @param type message type of the backend (SERVER_AUTH_MSG_TYPE or SERVER_FILE_MSG_TYPE)
+/// @param message the request
+/// @param command the buffer in which the cached response is stored, **must be at least LISTING_SIZE bytes long**
+/// @returns 1 if answered from memory, BACKEND_PENDING if queued, COMMAND_FAILED if the server is busy
+int cached_request(struct connection* connection, int type, const char* message, char* command){
+	int which = type == SERVER_AUTH_MSG_TYPE ? GENERATION_AUTH : GENERATION_FILE;
+	unsigned long generation = generation_get(GENERATIONS, which);
+	pthread_mutex_lock(&cache_lock);
+	for(int i = 0;generation != 0 && i < MAX_CACHED;i++){
+		struct cached_response* cached = &cached_responses[i];
+		if(cached->generation != generation || cached->which != which || strcmp(cached->request, message) != 0) continue;
+		strcpy(command, cached->response);
+		pthread_mutex_unlock(&cache_lock);
+		return TRUE;
+	}
+	pthread_mutex_unlock(&cache_lock);
+	int result = backend_command(connection, type, message, command, cached_done);
+	if(result == BACKEND_PENDING) connection->cache_generation = generation; // read by cached_done(), which runs on this thread after this returns
+	return result;
+}
+
+/// keeps a backend response in memory, replacing a previous response to the same request
+/// @param which GENERATION_FILE or GENERATION_AUTH
+/// @param generation generation read when the request was queued
+/// @param request the request
+/// @param response the backend response
+void cache_response(int which, unsigned long generation, const char* request, const char* response){
+	struct cached_response* cached = NULL;
+	pthread_mutex_lock(&cache_lock);
+	for(int i = 0;i < MAX_CACHED;i++){
+		if(cached_responses[i].generation != 0 && cached_responses[i].which == which && strcmp(cached_responses[i].request, request) == 0){
+			cached = &cached_responses[i];
+			break;
+		}
+	}
+	if(cached == NULL){
+		cached = &cached_responses[cached_next];
+		cached_next = (cached_next + 1) % MAX_CACHED;
+	}
+	cached->generation = generation;
+	cached->which = which;
+	strcpy(cached->request, request);
+	strcpy(cached->response, response);
+	pthread_mutex_unlock(&cache_lock);
+}
+
+/// sends queued backend requests while there is room in the in-flight table
+/// @note the caller must hold backend_lock
+void backend_dispatch(){
+	while(backend_head != NULL && backend_in_flight < backend_limit){
+		struct connection* connection = backend_head;
+		backend_head = backend_head->next;
+		if(backend_head == NULL) backend_tail = NULL;
+		backend_waiting--;
+		if(connection->request_type == SERVER_FILE_MSG_TYPE) connection->request_type = (int) file_worker(); // any worker will do
+		int slot = 0;
+		while(backend_calls[slot].id != 0) slot++;
+		backend_calls[slot].id = backend_generation++ * MAX_IN_FLIGHT + slot;
+		backend_calls[slot].type = connection->request_type;
+		backend_calls[slot].connection = connection;
+		backend_in_flight++;
+		connection->request_id = backend_calls[slot].id;
+		session_add_request(connection->session, connection->request_id);
+		send_request(connection->request_type, connection->request_id, MAIN_MSG_TYPE, connection->request); // send the querry to the backend
+	}
+}
+
+/// picks the SERVER_FILE worker for the next request, see worker_pick()
+/// @returns the message type of the least loaded worker, SERVER_FILE_MSG_TYPE (worker 0) if no worker is registered
+/// @note the caller must hold backend_lock
+long file_worker(){
+	int pending[MAX_FILE_WORKERS] = {0};
+	for(int i = 0;i < MAX_IN_FLIGHT;i++){
+		if(backend_calls[i].id == 0) continue;
+		int worker = backend_calls[i].type - SERVER_FILE_MSG_TYPE; // requests that timed out still load their worker
+		if(worker >= 0 && worker < MAX_FILE_WORKERS) pending[worker]++;
+	}
+	int worker = worker_pick(WORKERS, pending);
+	return SERVER_FILE_MSG_TYPE + (worker == INEX ? 0 : worker);
+}
+
+/// answers the client whose backend request was answered, and sends the next queued requests
+/// @param request the request ID the response belongs to
+/// @param message the backend response
+void backend_reply(long request, const char* message){
+	pthread_mutex_lock(&backend_lock);
+	struct backend_call* call = &backend_calls[request % MAX_IN_FLIGHT];
+	if(request <= 0 || call->id != request){ // should NEVER happen
+		pthread_mutex_unlock(&backend_lock);
+		fprintf(stderr, "ERROR: unexpected backend response (request %ld), discarding\n", request);
+		return;
+	}
+	struct connection* connection = call->connection;
+	call->id = 0;
+	call->connection = NULL;
+	backend_in_flight--;
+	if(connection == NULL){ // timed out, its client was already answered
+		backend_abandoned--;
+		backend_dispatch();
+		pthread_mutex_unlock(&backend_lock);
+		printf("[SERVER_MAIN]: discarding late backend response (request %ld)\n", request);
+		return;
+	}
+	session_remove_request(connection->session, request);
+	pthread_mutex_unlock(&backend_lock);
+	connection->busy = FALSE;
+	char buffer[LISTING_SIZE];
+	snprintf(buffer, sizeof(buffer), "%s", message); // copy response to buffer, which will be sent to client
+	int result = connection->done(connection, buffer, backend_failed(message) ? COMMAND_FAILED : TRUE);
+	if(connection->FD == INEX){ // client left while waiting
+		close_client(connection);
+	}else{
+		answer_client(connection, buffer, result);
+		process_input(connection); // commands that arrived meanwhile
+	}
+	pthread_mutex_lock(&backend_lock);
+	backend_dispatch();
+	pthread_mutex_unlock(&backend_lock);
+}
+
+/// listener thread: blocks on the message queue and forwards every backend response to the shard of its client
+void* backend_listener(__attribute__((unused)) void* arg){
+	struct backend_response response;
+	while(TRUE){
+		size_t length;
+		if((response.string = receive_large(MAIN_MSG_TYPE, &response.request, NULL, &length)) == NULL) continue; // get AUTH/FILE response, listings come in parts
+		pthread_mutex_lock(&backend_lock);
+		struct backend_call* call = &backend_calls[response.request % MAX_IN_FLIGHT];
+		struct shard* shard = response.request > 0 && call->id == response.request && call->connection != NULL ? call->connection->shard : &shards[0];
+		pthread_mutex_unlock(&backend_lock); // unexpected and late responses are handled by backend_reply() on shard 0
+		// sizeof(response) <= PIPE_BUF, so every response is written (and read) as a whole
+		if(write(shard->FD_backend[1], &response, sizeof(response)) != sizeof(response)){
+			fprintf(stderr, "ERROR: forwarding backend response (%s)\n", strerror(errno));
+			exit(EXIT_FAILURE);
+		}
+	}
+	return NULL;
+}
+
+/// checks if a backend response reports an error
+/// @param message the response from SERVER_AUTH or SERVER_FILE
+/// @returns 1 if the request failed, 0 otherwise
+int backend_failed(const char* message){
+	return strstr(message, "ERROR") != NULL || strstr(message, "incorrect") != NULL;
+}
+
+/// stores the list of available commands in *buffer*
+/// @param buffer the buffer in which to store the help, **must be at least BUFFER_SIZE bytes long**
 /// @returns a pointer to the provided buffer
-char* recv_client(char* buffer){
-	memset(buffer, 0, BUFFER_SIZE);
-	ssize_t io_count = recv(FD_comms_socket, buffer, BUFFER_SIZE - 1, 0); // read command
-	if(io_count < 0){
-		fprintf(stderr, "ERROR: reading FD_comms_socket (%s)\n", strerror(errno));
-		exit(EXIT_FAILURE);
+char* get_help(char* buffer){
+	sprintf(buffer, "> available commands:\n");
+	strcat(buffer, TAB "clear\n");
+	strcat(buffer, TAB "login <user> <pass>\n");
+	strcat(buffer, TAB "token <token>\n");
+	strcat(buffer, TAB "user ls\n");
+	strcat(buffer, TAB "user stats\n");
+	strcat(buffer, TAB "user <pass>\n");
+	strcat(buffer, TAB "file ls\n");
+	strcat(buffer, TAB "file parts <image_ID>\n");
+	strcat(buffer, TAB "file down <image_ID>[:<partition>] <target> [target...]\n");
+	strcat(buffer, TAB "stats\n");
+	strcat(buffer, TAB "jobs\n");
+	strcat(buffer, TAB "wait [job_ID]\n");
+	strcat(buffer, TAB "cancel <job_ID>\n");
+	strcat(buffer, TAB "exit\n\n");
+	return buffer;
+}
+
+/// stores the connection counts of every shard and the backend requests in *buffer*
+/// @param buffer the buffer in which to store the counts, **must be at least BUFFER_SIZE bytes long**
+/// @returns a pointer to the provided buffer
+char* get_stats(char* buffer){
+	char tmp[BUFFER_SIZE];
+	sprintf(buffer, "> shards:\n");
+	sprintf(tmp, TAB "%-10s %-15s %-15s\n", "shard", "connected", "accepted");
+	strcat(buffer, tmp);
+	for(int i = 0;i < SHARDS && strlen(buffer) < BUFFER_SIZE - 256;i++){ // room for the backend requests
+		sprintf(tmp, TAB "%-10d %-15d %-15lu\n", i, shards[i].connections, shards[i].accepted);
+		strcat(buffer, tmp);
 	}
+	pthread_mutex_lock(&backend_lock);
+	sprintf(tmp, "> backend requests:\n" TAB "%-10s %-15s %-15s %-15s\n" TAB "%-10d %-15d %-15d %-15lu\n", "waiting", "in flight",
+			"late", "timed out", backend_waiting, backend_in_flight - backend_abandoned, backend_abandoned, backend_expired);
+	pthread_mutex_unlock(&backend_lock);
+	strcat(buffer, tmp);
+	strcat(buffer, "\n");
 	return buffer;
 }
 
 /*
  help
  login <user> <password>
+ token <token>
  user ls
+ user stats
  user passwd <new_pass>
  file ls
  file down <image_name> [opt1] [opt2] [opt3]
@@ -186,61 +1087,68 @@ char* recv_client(char* buffer){
 
 /// processes a command
 ///
-/// processes a command obtained from the client through recv_client() and stores the response in the same buffer (command)
+/// processes a command obtained from the client through process_input() and stores the response in the same buffer (command)
+/// @param connection the client that sent the command
 /// @param command the command to be processed
-/// @returns 1 if client is allowed another command, 0 if the client disconnects or is no longer allowed to type commands, 2 if client needs to be shown command help
-int process_command(char* command){
-	static unsigned short login_strikes = 0;
+/// @returns 1 if client is allowed another command, 0 if the client disconnects or is no longer allowed to type commands, 2 if client needs to be shown command help,
+/// 3 if the command failed (the client is still answered with the response), 4 if the command was handed to a backend (the client is answered by backend_reply())
+int process_command(struct connection* connection, char* command){
+	struct session* session = connection->session;
 	if(command == NULL || strcmp(command, "") == 0){
-		USER_LOGGED_IN = FALSE;
-		login_strikes = 0;
-		return FALSE; // break inner loop and wait for new client
+		session_logout(session);
+		return FALSE; // close the connection
 	}
 	printf("[SERVER_MAIN]: processing command [%s]\n", command);
 	if(strcmp("clear", command) == 0){
 		sprintf(command, "\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n\n");
 		return TRUE;
 	}else if(strcmp("exit", command) == 0){
-		USER_LOGGED_IN = FALSE;
-		login_strikes = 0;
-		return FALSE; // break inner loop and wait for new client
+		return FALSE; // close the connection, AUTH forgets the session in close_client()
 	}
 	char message[MESSAGE_SIZE];
 	char* arg = strtok(command, " ");
-	if(USER_LOGGED_IN == FALSE){
+	if(arg == NULL){ // only spaces
+		if(session->logged_in) return SHOW_HELP;
+		sprintf(command, "[SERVER_MAIN]: use login <user> <pass> before other commands\n");
+		return COMMAND_FAILED;
+	}
+	if(session->logged_in == FALSE){
+		if(strcmp("token", arg) == 0){ // resume a session, checked here without asking SERVER_AUTH
+			char* token = strtok(NULL, " ");
+			char user[MAX_USERNAME_SIZE];
+			if(token_verify(TOKENS, token, user) == FALSE){
+				sprintf(command, "[SERVER_MAIN]: invalid or expired token, use login <user> <pass>\n");
+				return COMMAND_FAILED;
+			}
+			strcpy(connection->token, token); // SERVER_AUTH never saw this session log in, see 'user passwd'
+			session_login(session, user);
+			sprintf(command, "[SERVER_MAIN]: welcome back %s! (session resumed)\n", user);
+			return TRUE;
+		}
 		if(strcmp("login", arg) != 0){
 			sprintf(command, "[SERVER_MAIN]: use login <user> <pass> before other commands\n");
-			return TRUE;
+			return COMMAND_FAILED;
 		}
 		char* user = strtok(NULL, " ");
 		char* pass = strtok(NULL, " ");
 		if(user == NULL || pass == NULL){
 			sprintf(command, "[SERVER_AUTH]: empty user and/or password, try again\n");
-			return TRUE;
+			return COMMAND_FAILED;
 		}
 		printf("[SERVER_MAIN]: delegating login to [SERVER_AUTH]\n");
-		sprintf(message, "AUTH LOG %s %s", user, pass); // ask AUTH to login user
-		send_msg(SERVER_AUTH_MSG_TYPE, message); // send the querry to AUTH
-		get_msg(SERVER_MAIN_MSG_TYPE, message); // get AUTH response
-		// "[SERVER_AUTH]: incorrect user and/or password, try again\n"
-		if(strncmp("[SERVER_AUTH]: incorrect", message, strlen("[SERVER_AUTH]: incorrect")) == 0){
-			if(++login_strikes > 2){
-				sprintf(command, "[SERVER_MAIN]: incorrent AGAIN, you are now BANNED (not really)\n");
-				return FALSE;
-			}
-		}else{ // successful login
-			USER_LOGGED_IN = TRUE;
-			login_strikes = 0;
-		}
-		strcpy(command, message); // copy response to buffer, which will be sent to client
-		return TRUE; // return to loop where client will be answered
+		sprintf(message, "AUTH LOG %ld %s %s %s", session->id, user, pass, connection->address); // ask AUTH to login user
+		strncpy(connection->login_user, user, MAX_USERNAME_SIZE - 1);
+		return backend_command(connection, SERVER_AUTH_MSG_TYPE, message, command, login_done); // send the querry to AUTH, strikes are counted by login_done()
 	}else{ // user is logged in
 		if(strcmp("login", arg) == 0){
 			sprintf(command, "[SERVER_MAIN]: you are already logged in\n");
-			return TRUE;
+			return COMMAND_FAILED;
 		}
 		if(strcmp("help", arg) == 0){
 			return SHOW_HELP;
+		}else if(strcmp("stats", arg) == 0){
+			get_stats(command);
+			return TRUE;
 		}else if(strcmp("user", arg) == 0){
 			arg = strtok(NULL, " ");
 			if(arg == NULL){
@@ -248,20 +1156,17 @@ int process_command(char* command){
 			}
 			if(strcmp("ls", arg) == 0){
 				sprintf(message, "AUTH LS"); // ask auth server for LS
-				send_msg(SERVER_AUTH_MSG_TYPE, message); // ask AUTH to list users
-				get_msg(SERVER_MAIN_MSG_TYPE, message); // get AUTH response
-				strcpy(command, message); // copy response to buffer, which will be sent to client
-				return TRUE; // return to loop where client will be answered
+				return cached_request(connection, SERVER_AUTH_MSG_TYPE, message, command); // ask AUTH to list users, unless cached
 			}else if(strcmp("passwd", arg) == 0){
 				arg = strtok(NULL, " ");
 				if(arg == NULL){
 					return SHOW_HELP;
 				}
-				sprintf(message, "AUTH PASS %s", arg); // ask AUTH for password change
-				send_msg(SERVER_AUTH_MSG_TYPE, message); // send the querry to AUTH
-				get_msg(SERVER_MAIN_MSG_TYPE, message); // get AUTH response
-				strcpy(command, message);  // copy response to buffer, which will be sent to client
-				return TRUE; // return to loop where client will be answered
+				sprintf(message, "AUTH PASS %ld %s %s", session->id, arg, connection->token); // ask AUTH for password change
+				return backend_command(connection, SERVER_AUTH_MSG_TYPE, message, command, backend_done); // send the querry to AUTH
+			}else if(strcmp("stats", arg) == 0){
+				sprintf(message, "AUTH STATS"); // ask AUTH for the state of its KDF workers and login latency
+				return backend_command(connection, SERVER_AUTH_MSG_TYPE, message, command, backend_done); // send the querry to AUTH
 			}
 		}else if(strcmp("file", arg) == 0){
 			arg = strtok(NULL, " ");
@@ -270,25 +1175,247 @@ int process_command(char* command){
 			}
 			if(strcmp("ls", arg) == 0){
 				sprintf(message, "FILE LS"); // ask FILE to list files
-				send_msg(SERVER_FILE_MSG_TYPE, message); // send the querry to FILE
-				get_msg(SERVER_MAIN_MSG_TYPE, message); // get FILE response
-				strcpy(command, message); // copy response to buffer, which will be sent to client
-				return TRUE; // return to loop where client will be answered
+				return cached_request(connection, SERVER_FILE_MSG_TYPE, message, command); // send the querry to FILE, unless cached
+			}else if(strcmp("parts", arg) == 0){
+				arg = strtok(NULL, " ");
+				if(arg == NULL){
+					return SHOW_HELP;
+				}
+				sprintf(message, "FILE PARTS %s", arg); // ask FILE for the partition table of an image
+				return cached_request(connection, SERVER_FILE_MSG_TYPE, message, command); // send the querry to FILE, unless cached
 			}else if(strcmp("down", arg) == 0){
 				sprintf(message, "FILE DOWN "); // ask FILE for FILE TRANSFER
 				strcat(message, command + strlen("FILE DOWN ")); // transfer args to SERVER_FILE
-				send_msg(SERVER_FILE_MSG_TYPE, message); // send the querry to FILE
-				get_msg(SERVER_MAIN_MSG_TYPE, message); // get FILE response
-				strcpy(command, message);  // copy response to buffer, which will be sent to client
-				return TRUE; // return to loop where client will be answered
+				return backend_command(connection, SERVER_FILE_MSG_TYPE, message, command, backend_done); // send the querry to FILE
 			}
 		}
 		sprintf(command, "[SERVER_MAIN]: command does not exist, use 'help' to see available commands\n");
-		return TRUE;
+		return COMMAND_FAILED;
 	}
 	return TRUE;
 }
 
+/// reads the limits from LIMITS_ENV ("<name>=<value>,..."), every limit not given keeps its default
+///
+/// names: clients, backlog, idle (seconds), login (seconds), output (bytes), backend (seconds)
+void setup_limits(){
+	char* env = getenv(LIMITS_ENV);
+	if(env != NULL){
+		char limits[BUFFER_SIZE];
+		strncpy(limits, env, BUFFER_SIZE - 1);
+		limits[BUFFER_SIZE - 1] = '\0';
+		for(char* limit = strtok(limits, ",");limit != NULL;limit = strtok(NULL, ",")){
+			char* value = strchr(limit, '=');
+			int number = value == NULL ? INEX : (int) strtol(value + 1, NULL, 10);
+			if(value != NULL) *value = '\0';
+			if(number < 0) fprintf(stderr, "ERROR: invalid limit [%s], ignoring\n", limit);
+			else if(strcmp(limit, "clients") == 0) LIMITS.clients = number;
+			else if(strcmp(limit, "backlog") == 0) LIMITS.backlog = number;
+			else if(strcmp(limit, "idle") == 0) LIMITS.idle = number;
+			else if(strcmp(limit, "login") == 0) LIMITS.login = number;
+			else if(strcmp(limit, "output") == 0) LIMITS.output = number;
+			else if(strcmp(limit, "backend") == 0) LIMITS.backend = number;
+			else fprintf(stderr, "ERROR: unknown limit [%s], ignoring\n", limit);
+		}
+	}
+	if(LIMITS.clients > MAX_CONNECTIONS) LIMITS.clients = MAX_CONNECTIONS;
+	if(LIMITS.output < BUFFER_SIZE) LIMITS.output = BUFFER_SIZE; // room for at least one reply
+	printf("[SERVER_MAIN]: limits -> clients: %d, backlog: %d, idle: %ds, login: %ds, output: %dB, backend: %ds\n",
+			LIMITS.clients, LIMITS.backlog, LIMITS.idle, LIMITS.login, LIMITS.output, LIMITS.backend);
+}
+
+/// takes over the listening sockets of the running SERVER_MAIN (server_main --reload)
+///
+/// the takeover is acknowledged once this process is ready to serve, see hand_over()
+/// @param listeners where the listening sockets are stored, **must be MAX_SHARDS long**
+/// @returns the amount of listening sockets received
+int take_over(int* listeners){
+	FD_handoff = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(FD_handoff < 0){
+		fprintf(stderr, "ERROR: creating reload socket (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	strncpy(address.sun_path, RELOAD_SOCKET, sizeof(address.sun_path) - 1);
+	if(connect(FD_handoff, (struct sockaddr*) &address, sizeof(address)) < 0){
+		fprintf(stderr, "ERROR: connecting to the running [SERVER_MAIN] (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if(send(FD_handoff, RELOAD_FLAG, strlen(RELOAD_FLAG), MSG_NOSIGNAL) < 0){
+		fprintf(stderr, "ERROR: asking to take over (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	struct handoff handoff;
+	char control[CMSG_SPACE(sizeof(int) * MAX_SHARDS)];
+	struct iovec vector = {.iov_base = &handoff, .iov_len = sizeof(handoff)};
+	struct msghdr header = {.msg_iov = &vector, .msg_iovlen = 1, .msg_control = control, .msg_controllen = sizeof(control)};
+	ssize_t R = recvmsg(FD_handoff, &header, MSG_WAITALL);
+	struct cmsghdr* rights = CMSG_FIRSTHDR(&header);
+	if(R != sizeof(handoff) || rights == NULL || rights->cmsg_type != SCM_RIGHTS || handoff.shards < 1){
+		fprintf(stderr, "ERROR: the running [SERVER_MAIN] refused to hand over (is it still taking over itself?)\n");
+		exit(EXIT_FAILURE);
+	}
+	int count = (int) ((rights->cmsg_len - CMSG_LEN(0)) / sizeof(int));
+	memcpy(listeners, CMSG_DATA(rights), sizeof(int) * (size_t) count);
+	PORT = handoff.port;
+	previous = handoff.pid;
+	MAIN_MSG_TYPE = handoff.reply_type == SERVER_MAIN_MSG_TYPE ? SERVER_MAIN_RELOAD_MSG_TYPE : SERVER_MAIN_MSG_TYPE;
+	printf("[SERVER_MAIN]: taking over %d listening socket(s) on port %d from process %d\n", count, PORT, previous);
+	return count;
+}
+
+/// listens on RELOAD_SOCKET for a SERVER_MAIN that wants to take over, see hand_over()
+void setup_reload_socket(){
+	FD_reload = socket(AF_UNIX, SOCK_STREAM, 0);
+	if(FD_reload < 0){
+		fprintf(stderr, "ERROR: creating reload socket (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	struct sockaddr_un address = {.sun_family = AF_UNIX};
+	strncpy(address.sun_path, RELOAD_SOCKET, sizeof(address.sun_path) - 1);
+	unlink(RELOAD_SOCKET); // left by a previous SERVER_MAIN, or the one being taken over
+	if(bind(FD_reload, (struct sockaddr*) &address, sizeof(address)) < 0 || listen(FD_reload, 1) < 0){
+		printf("[SERVER_MAIN]: WARNING -> unable to listen on %s, server_main %s will not work (%s)\n", RELOAD_SOCKET, RELOAD_FLAG, strerror(errno));
+		close(FD_reload);
+		FD_reload = INEX;
+		return;
+	}
+	struct epoll_event event = {.events = EPOLLIN, .data.ptr = &FD_reload};
+	if(epoll_ctl(shards[0].FD_epoll, EPOLL_CTL_ADD, FD_reload, &event) < 0){
+		fprintf(stderr, "ERROR: adding reload socket to epoll (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+}
+
+/// hands the listening sockets over to a new SERVER_MAIN and starts draining the clients of this one
+///
+/// nothing changes until the new SERVER_MAIN acknowledges, if it fails this one keeps serving
+void hand_over(){
+	int FD = accept(FD_reload, NULL, NULL);
+	if(FD < 0) return;
+	struct timeval timeout = {.tv_sec = 5};
+	setsockopt(FD, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	char request[sizeof(RELOAD_FLAG)] = "";
+	if(recv(FD, request, sizeof(request) - 1, 0) <= 0 || strcmp(request, RELOAD_FLAG) != 0){
+		close(FD);
+		return;
+	}
+	if(HANDED_OFF || previous != 0){ // its message type and sessions would be taken twice
+		printf("[SERVER_MAIN]: refusing takeover, process %d is still draining\n", HANDED_OFF ? getpid() : previous);
+		close(FD);
+		return;
+	}
+	struct handoff handoff = {.port = PORT, .shards = SHARDS, .reply_type = MAIN_MSG_TYPE, .pid = getpid()};
+	char control[CMSG_SPACE(sizeof(int) * MAX_SHARDS)];
+	memset(control, 0, sizeof(control));
+	struct iovec vector = {.iov_base = &handoff, .iov_len = sizeof(handoff)};
+	struct msghdr header = {.msg_iov = &vector, .msg_iovlen = 1, .msg_control = control,
+			.msg_controllen = CMSG_SPACE(sizeof(int) * (size_t) SHARDS)};
+	struct cmsghdr* rights = CMSG_FIRSTHDR(&header);
+	rights->cmsg_level = SOL_SOCKET;
+	rights->cmsg_type = SCM_RIGHTS;
+	rights->cmsg_len = CMSG_LEN(sizeof(int) * (size_t) SHARDS);
+	for(int i = 0;i < SHARDS;i++){
+		memcpy(CMSG_DATA(rights) + sizeof(int) * (size_t) i, &shards[i].FD_socket, sizeof(int));
+	}
+	if(sendmsg(FD, &header, MSG_NOSIGNAL) != sizeof(handoff)){
+		fprintf(stderr, "ERROR: handing over listening sockets (%s)\n", strerror(errno));
+		close(FD);
+		return;
+	}
+	timeout.tv_sec = 30; // time to set up the new SERVER_MAIN
+	setsockopt(FD, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+	char ack[sizeof(OK)] = "";
+	if(recv(FD, ack, sizeof(ack) - 1, MSG_WAITALL) <= 0 || strcmp(ack, OK) != 0){
+		printf("[SERVER_MAIN]: WARNING -> takeover failed, still serving\n");
+		close(FD);
+		return;
+	}
+	close(FD);
+	OWNS_IPC = FALSE;
+	HANDED_OFF = TRUE;
+	epoll_ctl(shards[0].FD_epoll, EPOLL_CTL_DEL, FD_reload, NULL);
+	close(FD_reload); // RELOAD_SOCKET now belongs to the new SERVER_MAIN
+	FD_reload = INEX;
+	struct backend_response stop = {.request = HANDOFF_REQUEST};
+	for(int i = 0;i < SHARDS;i++){
+		if(write(shards[i].FD_backend[1], &stop, sizeof(stop)) < 0){
+			fprintf(stderr, "ERROR: stopping shard %d (%s)\n", i, strerror(errno));
+		}
+	}
+	printf("[SERVER_MAIN]: handed over to a new process, draining %d client(s)\n", CLIENTS);
+}
+
+/// closes the clients of a shard that did not log in, or stayed idle, for too long, and times out their backend requests
+///
+/// clients waiting for a backend are not idle, clients that do not read their replies are
+/// @param shard the shard
+void reap_clients(struct shard* shard){
+	time_t now = time(NULL);
+	shard->reaped = now;
+	backend_expire(shard, now);
+	if(previous != 0 && kill(previous, 0) < 0) previous = 0; // done draining, may be taken over again
+	if(HANDED_OFF && shard->index == 0 && CLIENTS == 0){
+		pthread_mutex_lock(&backend_lock);
+		int pending = backend_in_flight - backend_abandoned + backend_waiting; // late responses are not waited for
+		pthread_mutex_unlock(&backend_lock);
+		if(pending == 0){
+			printf("[SERVER_MAIN]: every client drained, exiting\n");
+			exit(EXIT_SUCCESS);
+		}
+	}
+	for(int i = shard->index;i < MAX_CONNECTIONS;i += SHARDS){
+		struct connection* connection = &connections[i];
+		if(!connection->used || connection->FD == INEX) continue;
+		if(LIMITS.login > 0 && !connection->session->logged_in && now - connection->connected > LIMITS.login){
+			printf("[SERVER_MAIN]: client did not log in within %ds, closing connection\n", LIMITS.login);
+			close_client(connection);
+		}else if(LIMITS.idle > 0 && !connection->busy && now - connection->active > LIMITS.idle){
+			printf("[SERVER_MAIN]: client idle for more than %ds, closing connection\n", LIMITS.idle);
+			close_client(connection);
+		}
+	}
+}
+
+/// completes the commands of a shard whose backend request did not complete within LIMITS.backend seconds
+///
+/// requests still queued are dropped, requests in flight are left to be discarded when they are answered (see backend_reply())
+/// @param shard the shard
+/// @param now the current time
+void backend_expire(struct shard* shard, time_t now){
+	for(int i = shard->index;i < MAX_CONNECTIONS;i += SHARDS){
+		struct connection* connection = &connections[i];
+		if(!connection->used || !connection->busy || connection->deadline == 0 || now < connection->deadline) continue;
+		pthread_mutex_lock(&backend_lock);
+		struct backend_call* call = &backend_calls[connection->request_id % MAX_IN_FLIGHT];
+		if(connection->request_id != 0 && call->id == connection->request_id && call->connection == connection){ // in flight
+			call->connection = NULL;
+			backend_abandoned++;
+			session_remove_request(connection->session, connection->request_id);
+		}else{ // still queued
+			struct connection* before = NULL;
+			for(struct connection* queued = backend_head;queued != connection;queued = queued->next) before = queued;
+			if(before == NULL) backend_head = connection->next;
+			else before->next = connection->next;
+			if(backend_tail == connection) backend_tail = before;
+			backend_waiting--;
+		}
+		backend_expired++;
+		pthread_mutex_unlock(&backend_lock);
+		printf("[SERVER_MAIN]: backend request timed out after %ds (message type %d)\n", LIMITS.backend, connection->request_type);
+		connection->busy = FALSE;
+		char buffer[LISTING_SIZE];
+		sprintf(buffer, "[SERVER_MAIN]: no response from the server within %ds, try again later\n", LIMITS.backend);
+		int result = connection->done(connection, buffer, BACKEND_EXPIRED);
+		if(connection->FD == INEX){ // client left while waiting
+			close_client(connection);
+		}else{
+			answer_client(connection, buffer, result);
+			process_input(connection); // commands that arrived meanwhile
+		}
+	}
+}
+
 /// handles the ctrl+C signal, closing the program properly
 void SIGKILL_handler(){
 	exit(EXIT_SUCCESS);
@@ -297,34 +1424,80 @@ void SIGKILL_handler(){
 void close_FDs(){
 	printf("[SERVER_MAIN]: closing file descriptors...\n");
 	// ASK: necesario ver errores de esto?
-	close(FD_socket);
-	close(FD_comms_socket);
+	for(int i = 0;i < SHARDS;i++){
+		close(shards[i].FD_socket);
+		close(shards[i].FD_epoll);
+	}
+	for(int i = 0;i < MAX_CONNECTIONS;i++){
+		if(connections[i].FD != INEX) close(connections[i].FD);
+	}
 	/*
 	 if(close(FD_socket) < 0){
 	 fprintf(stderr, "ERROR: closing socket FD_socket (%s)\n", strerror(errno));
 	 exit(EXIT_FAILURE);
 	 }
-	 if(close(FD_comms_socket) < 0){
-	 fprintf(stderr, "ERROR: closing socket FD_comms_socket (%s)\n", strerror(errno));
+	 if(close(FD_epoll) < 0){
+	 fprintf(stderr, "ERROR: closing FD_epoll (%s)\n", strerror(errno));
 	 exit(EXIT_FAILURE);
 	 }
 	 */
 }
 /// starts a systemV message queue for communication with SERVER_AUTH and SERVER_FILE
-void setup_message_queue(){
+/// @param attach TRUE to attach to the queue and shared memory regions of the SERVER_MAIN being taken over
+void setup_message_queue(int attach){
 	key_t key;
-	printf("[SERVER_MAIN]: launching message queue...\n");
+	printf("[SERVER_MAIN]: %s message queue...\n", attach ? "attaching to" : "launching");
 	if((key = ftok(MESSAGE_QUEUE_KEY, 66)) < 0){
 		fprintf(stderr, "ERROR: getting systemV queue key (%s)\n", strerror(errno));
 		exit(EXIT_FAILURE);
 	}
-	Q_ID = msgget(key, 0666 | IPC_CREAT);
+	Q_ID = msgget(key, attach ? 0666 : 0666 | IPC_CREAT);
+	if(Q_ID < 0){
+		fprintf(stderr, "ERROR: getting systemV queue (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if((GENERATIONS = attach ? generation_attach() : generation_create()) == NULL){ // listings are not cached without it
+		printf("[SERVER_MAIN]: WARNING -> backend responses will not be cached\n");
+	}
+	if((WORKERS = attach ? workers_attach() : workers_create()) == NULL){ // every request goes to worker 0 without it
+		printf("[SERVER_MAIN]: WARNING -> SERVER_FILE workers will not be balanced\n");
+	}
+	if((TOKENS = attach ? token_attach() : token_create()) == NULL){ // clients log in every time without it
+		printf("[SERVER_MAIN]: WARNING -> session tokens will not be issued\n");
+	}
+	if(setup_transport(!attach)){ // one ring per message type, requests and responses never compete for room
+		printf("[SERVER_MAIN]: using shared memory transport\n");
+		return;
+	}
+	// make room for every request in flight (plus one AUTH END), if allowed to
+	struct msqid_ds queue;
+	if(msgctl(Q_ID, IPC_STAT, &queue) < 0){
+		fprintf(stderr, "ERROR: reading systemV queue size (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	msglen_t size = MESSAGE_HEADER + MESSAGE_SIZE; // worst case, most messages only take their header and the bytes in use
+	if(queue.msg_qbytes < (MAX_IN_FLIGHT + 1) * size){
+		queue.msg_qbytes = (MAX_IN_FLIGHT + 1) * size;
+		if(msgctl(Q_ID, IPC_SET, &queue) < 0){
+			printf("[SERVER_MAIN]: WARNING -> unable to grow message queue (%s)\n", strerror(errno));
+		}
+		msgctl(Q_ID, IPC_STAT, &queue);
+	}
+	backend_limit = (int) (queue.msg_qbytes / size) - 1;
+	if(backend_limit > MAX_IN_FLIGHT) backend_limit = MAX_IN_FLIGHT;
+	if(backend_limit < 1) backend_limit = 1;
+	printf("[SERVER_MAIN]: up to %d backend requests in flight\n", backend_limit);
 }
 
 /// removes the systemV message queue for communication with SERVER_AUTH and SERVER_FILE
 /// @note this will terminate both SERVER_AUTH and SERVER_FILE
 void delete_message_queue(){
+	if(!OWNS_IPC) return; // handed over, the new SERVER_MAIN keeps using it
 	printf("\n[SERVER_MAIN]: removing message queue...\n");
+	generation_destroy(GENERATIONS);
+	workers_destroy(WORKERS);
+	token_destroy(TOKENS);
+	ring_destroy(RINGS, RING_NAME); // wakes up the backend listener, which exits
 	if(msgctl(Q_ID, IPC_RMID, NULL) < 0){
 		fprintf(stderr, "ERROR: deleting systemV queue (%s)\n", strerror(errno));
 		exit(EXIT_FAILURE);
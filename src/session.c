@@ -0,0 +1,127 @@
+/*
+ * session.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <pthread.h>
+#include <session.h>
+
+static struct session sessions[SESSION_SLOTS]; ///< session table, SERVER_MAIN takes its pool from MAX_SESSIONS of them
+static struct session* free_sessions = NULL;
+static long generation = 1; ///< increased every time a slot is reused, see session_open()
+static int initialized = FALSE;
+static int first_slot = 0; ///< first slot of the pool, see session_instance()
+static pthread_mutex_t sessions_lock = PTHREAD_MUTEX_INITIALIZER; ///< protects the free list, SERVER_MAIN opens sessions from every shard
+
+/// builds the free list of the session pool
+static void session_init(){
+	for(int i = first_slot + MAX_SESSIONS - 1;i >= first_slot;i--){
+		sessions[i].next = free_sessions;
+		free_sessions = &sessions[i];
+	}
+	initialized = TRUE;
+}
+
+/// selects the slots the pool is taken from, must be called before the first session_open()
+/// @param instance 0 to SESSION_INSTANCES - 1, different for every SERVER_MAIN running at once
+void session_instance(int instance){
+	first_slot = instance * MAX_SESSIONS;
+}
+
+/// takes a session from the pool
+/// @returns the new session, NULL if there are already MAX_SESSIONS open
+struct session* session_open(){
+	pthread_mutex_lock(&sessions_lock);
+	if(!initialized) session_init();
+	struct session* session = free_sessions;
+	if(session == NULL){
+		pthread_mutex_unlock(&sessions_lock);
+		fprintf(stderr, "ERROR: too many sessions (max: %d)\n", MAX_SESSIONS);
+		return NULL;
+	}
+	free_sessions = session->next;
+	memset(session, 0, sizeof(struct session));
+	session->id = generation++ * SESSION_SLOTS + (session - sessions);
+	pthread_mutex_unlock(&sessions_lock);
+	return session;
+}
+
+/// looks up a session by its ID
+/// @param id the session ID
+/// @returns the session, NULL if it is not open
+struct session* session_find(long id){
+	if(id <= 0) return NULL;
+	struct session* session = &sessions[id % SESSION_SLOTS];
+	return session->id == id ? session : NULL;
+}
+
+/// gets the session with an ID given by another process (SERVER_MAIN), opening it if needed
+///
+/// the slot is taken from the ID itself, so an old session in the same slot is replaced
+/// @param id the session ID
+/// @returns the session, NULL if the ID is not valid
+struct session* session_attach(long id){
+	if(id <= 0) return NULL;
+	struct session* session = &sessions[id % SESSION_SLOTS];
+	if(session->id != id){
+		memset(session, 0, sizeof(struct session));
+		session->id = id;
+	}
+	return session;
+}
+
+/// returns a session to the pool
+/// @param session the session
+void session_close(struct session* session){
+	if(session == NULL || session->id == 0) return;
+	pthread_mutex_lock(&sessions_lock);
+	session->id = 0;
+	if(initialized){ // attached sessions are not part of the free list
+		session->next = free_sessions;
+		free_sessions = session;
+	}
+	pthread_mutex_unlock(&sessions_lock);
+}
+
+/// marks a session as logged in
+/// @param session the session
+/// @param user the user that logged in
+void session_login(struct session* session, const char* user){
+	strncpy(session->user, user, MAX_USERNAME_SIZE - 1);
+	session->logged_in = TRUE;
+	session->strikes = 0;
+	session->auth_time = time(NULL);
+}
+
+/// marks a session as logged out
+/// @param session the session
+void session_logout(struct session* session){
+	memset(session->user, '\0', MAX_USERNAME_SIZE);
+	session->logged_in = FALSE;
+	session->strikes = 0;
+}
+
+/// registers a backend request in flight for a session
+/// @param session the session
+/// @param request the request ID
+/// @returns 1 on success, 0 if the session already has MAX_SESSION_REQUESTS requests in flight
+int session_add_request(struct session* session, long request){
+	if(session->request_count == MAX_SESSION_REQUESTS) return FALSE;
+	session->requests[session->request_count++] = request;
+	return TRUE;
+}
+
+/// removes a backend request that is no longer in flight
+/// @param session the session
+/// @param request the request ID
+void session_remove_request(struct session* session, long request){
+	for(int i = 0;i < session->request_count;i++){
+		if(session->requests[i] != request) continue;
+		session->requests[i] = session->requests[--session->request_count];
+		return;
+	}
+}
@@ -0,0 +1,53 @@
+/*
+ * session.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#ifndef SESSION_H_
+#define SESSION_H_
+
+#include <time.h>
+#include <global.h>
+
+/*
+ * per-connection login state, shared by SERVER_MAIN and SERVER_AUTH:
+ *
+ *   SERVER_MAIN  session_open() on accept, session_close() once the connection is gone
+ *   SERVER_AUTH  session_attach() on every request, with the session ID sent by SERVER_MAIN
+ *
+ * sessions are taken from a fixed pool, a session ID is <generation> * SESSION_SLOTS + <slot>, so
+ * session_find() is a single array access and stale IDs of reused slots are never matched.
+ * While a SERVER_MAIN hands over to another (server_main --reload) both are running, so each
+ * of them takes its sessions from its own MAX_SESSIONS slots (see session_instance()) and their
+ * IDs never share a slot in SERVER_AUTH
+ */
+
+#define MAX_SESSIONS 4096 ///< maximum amount of simultaneous sessions
+#define SESSION_INSTANCES 2 ///< SERVER_MAIN processes running at once, each with its own slots
+#define SESSION_SLOTS (MAX_SESSIONS * SESSION_INSTANCES) ///< size of the session table
+#define MAX_SESSION_REQUESTS 8 ///< maximum amount of backend requests in flight for a single session
+
+struct session{
+	long id; ///< 0 if the slot is free
+	char user[MAX_USERNAME_SIZE]; ///< logged in user, empty if none
+	int logged_in;
+	unsigned short strikes; ///< failed logins in a row
+	time_t auth_time; ///< time of the last successful login
+	long requests[MAX_SESSION_REQUESTS]; ///< IDs of the backend requests in flight
+	int request_count;
+	struct session* next; ///< next free session
+};
+
+void session_instance(int instance);
+struct session* session_open();
+struct session* session_find(long id);
+struct session* session_attach(long id);
+void session_close(struct session* session);
+void session_login(struct session* session, const char* user);
+void session_logout(struct session* session);
+int session_add_request(struct session* session, long request);
+void session_remove_request(struct session* session, long request);
+
+#endif /* SESSION_H_ */
@@ -0,0 +1,280 @@
+/*
+ * tee.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <tee.h>
+
+/// gets the read position of the slowest target still writing
+/// @returns the position of the slowest target, or the head if every target failed
+/// @note the caller must hold tee->lock
+static unsigned long tee_slowest(struct tee* tee){
+	unsigned long slowest = tee->head;
+	for(int i = 0;i < tee->count;i++){
+		if(tee->targets[i].failed) continue;
+		if(tee->targets[i].tail < slowest) slowest = tee->targets[i].tail;
+	}
+	return slowest;
+}
+
+/// calculates the MD5 hash of the first *length* bytes of *target*
+///
+/// unlike get_MD5() this does not rely on stat(), which reports 0 bytes for block devices
+/// @param target the file or device to be hashed
+/// @param length amount of bytes to hash
+/// @param MD5 the buffer in which to store the hash, **must be MD5_DIGEST_LENGTH bytes long**
+/// @returns 1 on success, 0 on failure
+static int tee_get_MD5(const char* target, unsigned long length, unsigned char* MD5){
+	int FD = open(target, O_RDONLY);
+	if(FD < 0){
+		fprintf(stderr, "ERROR: opening %s for verification (%s)\n", target, strerror(errno));
+		return FALSE;
+	}
+	char buffer[TEE_CHUNK_SIZE];
+	MD5_CTX CTX;
+	MD5_Init(&CTX);
+	while(length > 0){
+		size_t chunk = length < sizeof(buffer) ? length : sizeof(buffer);
+		ssize_t R = read(FD, buffer, chunk);
+		if(R <= 0){
+			fprintf(stderr, "ERROR: reading %s for verification (%s)\n", target, R < 0 ? strerror(errno) : "short read");
+			close(FD);
+			return FALSE;
+		}
+		MD5_Update(&CTX, buffer, (unsigned long) R);
+		length -= (unsigned long) R;
+	}
+	MD5_Final(MD5, &CTX);
+	close(FD);
+	return TRUE;
+}
+
+/// writer thread, one per target: writes every committed slot to its target and verifies it once the stream is closed
+/// @param arg the tee_target handled by this thread
+static void* tee_writer(void* arg){
+	struct tee_target* target = (struct tee_target*) arg;
+	struct tee* tee = target->tee;
+	while(TRUE){
+		pthread_mutex_lock(&tee->lock);
+		while(target->tail == tee->head && !tee->closed){
+			pthread_cond_wait(&tee->not_empty, &tee->lock);
+		}
+		if(target->tail == tee->head){ // closed and drained
+			pthread_mutex_unlock(&tee->lock);
+			break;
+		}
+		unsigned long slot = target->tail % TEE_SLOTS;
+		size_t length = tee->lengths[slot];
+		pthread_mutex_unlock(&tee->lock);
+		// the slot can not be reused until this target moves its tail forward, so no lock is needed here
+		if(fwrite(tee->slots + slot * TEE_CHUNK_SIZE, 1, length, target->file) != length){
+			fprintf(stderr, "\nERROR: writing %s (%s)\n", target->path, strerror(errno));
+			pthread_mutex_lock(&tee->lock);
+			target->failed = TRUE;
+			pthread_cond_broadcast(&tee->not_full); // do not keep the other targets waiting for this one
+			pthread_mutex_unlock(&tee->lock);
+			break;
+		}
+		pthread_mutex_lock(&tee->lock);
+		target->tail++;
+		target->written += length;
+		pthread_cond_broadcast(&tee->not_full);
+		pthread_mutex_unlock(&tee->lock);
+	}
+	// flush to the device itself, otherwise verification would only read back the page cache
+	fflush(target->file);
+	fsync(fileno(target->file));
+	fclose(target->file);
+	target->file = NULL;
+	if(target->failed) return NULL;
+	unsigned char MD5[MD5_DIGEST_LENGTH];
+	if(tee_get_MD5(target->path, target->written, MD5) == FALSE) return NULL;
+	target->verified = memcmp(MD5, tee->digest, MD5_DIGEST_LENGTH) == 0;
+	return NULL;
+}
+
+/// opens every target and starts one writer thread for each of them
+///
+/// targets that can not be opened are reported and skipped, the download goes on with the rest
+/// @param tee the tee to be initialized
+/// @param targets the files or devices to write to
+/// @param count amount of targets (at most TEE_MAX_TARGETS)
+/// @param expected amount of bytes announced by SERVER_FILE, used for progress (0 if unknown)
+/// @param quiet 1 not to print progress (background jobs), set before the writers start
+/// @returns the amount of targets opened, 0 if none could be opened (or their writers could not be started)
+int tee_open(struct tee* tee, char* targets[], int count, unsigned long expected, int quiet){
+	memset(tee, 0, sizeof(struct tee));
+	if(count > TEE_MAX_TARGETS){
+		fprintf(stderr, "ERROR: too many targets (max: %d)\n", TEE_MAX_TARGETS);
+		return 0;
+	}
+	tee->expected = expected;
+	tee->quiet = quiet;
+	int opened = 0;
+	for(int i = 0;i < count;i++){
+		struct tee_target* target = &tee->targets[tee->count];
+		strncpy(target->path, targets[i], MAX_FILENAME_SIZE - 1);
+		if((target->file = fopen(target->path, "wb")) == NULL){
+			switch(errno){
+				case EACCES: {/* Permission denied */
+					fprintf(stderr, "ERROR: no permission on client to write on %s, restart with sudo\n", target->path);
+					break;
+				}
+				case EISDIR: {/* Is a directory */
+					fprintf(stderr, "ERROR: no filename specified for %s\n", target->path);
+					fprintf(stderr, TAB TAB "example: file down 3 /home/user/Desktop/test_file\n");
+					fprintf(stderr, TAB TAB "example: file down 1 /dev/sdc /dev/sdd\n");
+					break;
+				}
+				default: {
+					fprintf(stderr, "ERROR: unable to open %s (%s)\n", target->path, strerror(errno));
+					break;
+				}
+			}
+			continue;
+		}
+		target->tee = tee;
+		tee->count++;
+		opened++;
+	}
+	if(opened == 0) return 0;
+	if((tee->slots = malloc(TEE_SLOTS * TEE_CHUNK_SIZE)) == NULL){
+		fprintf(stderr, "ERROR: allocating transfer buffer (%s)\n", strerror(errno));
+		for(int i = 0;i < tee->count;i++) fclose(tee->targets[i].file);
+		return 0;
+	}
+	pthread_mutex_init(&tee->lock, NULL);
+	pthread_cond_init(&tee->not_full, NULL);
+	pthread_cond_init(&tee->not_empty, NULL);
+	MD5_Init(&tee->CTX);
+	for(int i = 0;i < tee->count;i++){
+		int error = pthread_create(&tee->targets[i].thread, NULL, tee_writer, &tee->targets[i]);
+		if(error != 0){ // pthread_create() does not set errno
+			fprintf(stderr, "ERROR: creating writer for %s (%s)\n", tee->targets[i].path, strerror(error));
+			pthread_mutex_lock(&tee->lock); // only this download fails, stop the writers already started
+			tee->closed = TRUE;
+			pthread_cond_broadcast(&tee->not_empty);
+			pthread_mutex_unlock(&tee->lock);
+			for(int j = 0;j < i;j++) pthread_join(tee->targets[j].thread, NULL); // they close their own target
+			for(int j = i;j < tee->count;j++) fclose(tee->targets[j].file);
+			pthread_mutex_destroy(&tee->lock);
+			pthread_cond_destroy(&tee->not_full);
+			pthread_cond_destroy(&tee->not_empty);
+			free(tee->slots);
+			tee->slots = NULL;
+			return 0;
+		}
+	}
+	return opened;
+}
+
+/// hands *length* bytes of the incoming stream to every target
+///
+/// blocks only while the slowest target is TEE_SLOTS chunks behind
+/// @param tee the tee to write to
+/// @param data the received bytes
+/// @param length amount of received bytes
+/// @returns 1 on success, 0 if every target has failed
+int tee_write(struct tee* tee, const char* data, size_t length){
+	MD5_Update(&tee->CTX, data, length);
+	tee->total += length;
+	while(length > 0){
+		if(tee->fill == 0){ // starting a new slot, wait until every target is done with it
+			pthread_mutex_lock(&tee->lock);
+			while(tee_slowest(tee) + TEE_SLOTS <= tee->head){
+				pthread_cond_wait(&tee->not_full, &tee->lock);
+			}
+			int alive = FALSE;
+			for(int i = 0;i < tee->count;i++){
+				if(!tee->targets[i].failed) alive = TRUE;
+			}
+			pthread_mutex_unlock(&tee->lock);
+			if(!alive) return FALSE;
+		}
+		size_t copy = TEE_CHUNK_SIZE - tee->fill;
+		if(copy > length) copy = length;
+		memcpy(tee->slots + (tee->head % TEE_SLOTS) * TEE_CHUNK_SIZE + tee->fill, data, copy);
+		tee->fill += copy;
+		data += copy;
+		length -= copy;
+		if(tee->fill == TEE_CHUNK_SIZE){ // commit slot
+			pthread_mutex_lock(&tee->lock);
+			tee->lengths[tee->head % TEE_SLOTS] = tee->fill;
+			tee->head++;
+			tee->fill = 0;
+			pthread_cond_broadcast(&tee->not_empty);
+			pthread_mutex_unlock(&tee->lock);
+			tee_print_progress(tee);
+		}
+	}
+	return TRUE;
+}
+
+/// prints the progress of every target on a single line (at most once per second)
+/// @param tee the tee to report
+void tee_print_progress(struct tee* tee){
+	time_t now = time(NULL);
+	if(tee->quiet || now == tee->progress) return;
+	tee->progress = now;
+	printf("\r[CLIENT]: progress:");
+	pthread_mutex_lock(&tee->lock);
+	for(int i = 0;i < tee->count;i++){
+		struct tee_target* target = &tee->targets[i];
+		if(target->failed) printf(" | %s FAILED", target->path);
+		else if(tee->expected > 0) printf(" | %s %3lu%%", target->path, target->written * 100 / tee->expected);
+		else printf(" | %s %lu B", target->path, target->written);
+	}
+	pthread_mutex_unlock(&tee->lock);
+	fflush(stdout);
+}
+
+/// ends the stream, waits for every writer to finish and verify its target, and prints the results
+/// @param tee the tee to close
+/// @returns the amount of targets that failed to be written or verified
+int tee_close(struct tee* tee){
+	pthread_mutex_lock(&tee->lock);
+	if(tee->fill > 0){ // commit last (partial) slot
+		tee->lengths[tee->head % TEE_SLOTS] = tee->fill;
+		tee->head++;
+		tee->fill = 0;
+	}
+	MD5_Final(tee->digest, &tee->CTX);
+	tee->closed = TRUE;
+	pthread_cond_broadcast(&tee->not_empty);
+	pthread_mutex_unlock(&tee->lock);
+	int failed = 0;
+	for(int i = 0;i < tee->count;i++){
+		pthread_join(tee->targets[i].thread, NULL);
+	}
+	if(!tee->quiet){
+		tee->progress = 0;
+		tee_print_progress(tee);
+		printf("\n");
+	}
+	printf("[CLIENT]: transfer %s, total: [%lu] bytes, MD5 is [", tee->total < tee->expected ? "interrupted" : "complete", tee->total);
+	for(int i = 0;i < MD5_DIGEST_LENGTH;i++){
+		printf("%02x", tee->digest[i]);
+	}
+	printf("]\n");
+	for(int i = 0;i < tee->count;i++){
+		struct tee_target* target = &tee->targets[i];
+		if(target->failed || !target->verified) failed++;
+		printf(TAB "%-30s %-15lu %s\n", target->path, target->written,
+				target->failed ? "WRITE FAILED" : (target->verified ? "verified" : "VERIFICATION FAILED"));
+	}
+	pthread_mutex_destroy(&tee->lock);
+	pthread_cond_destroy(&tee->not_full);
+	pthread_cond_destroy(&tee->not_empty);
+	free(tee->slots);
+	tee->slots = NULL;
+	return failed;
+}
@@ -0,0 +1,69 @@
+/*
+ * tee.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#ifndef TEE_H_
+#define TEE_H_
+
+#include <stdio.h>
+#include <time.h>
+#include <pthread.h>
+#include <openssl/md5.h>
+#include <global.h>
+
+/*
+ * one incoming stream is written to several targets at once:
+ *
+ *   recv() -> tee_write() -> [slot 0][slot 1]...[slot TEE_SLOTS-1] -> writer 1 -> /dev/sdb
+ *                                                                   -> writer 2 -> /dev/sdc
+ *                                                                   -> ...
+ *
+ * every target has its own writer thread and its own read position in the ring, so a slow
+ * device only throttles the download once it falls TEE_SLOTS chunks behind the fastest one
+ */
+
+#define TEE_MAX_TARGETS 16 ///< maximum amount of targets for a single download
+#define TEE_CHUNK_SIZE 65536 ///< size of each ring slot (bytes)
+#define TEE_SLOTS 32 ///< amount of ring slots, bounds how far a target can fall behind
+
+struct tee;
+
+struct tee_target{
+	char path[MAX_FILENAME_SIZE];
+	FILE* file;
+	pthread_t thread;
+	unsigned long tail; ///< next slot to be written by this target
+	unsigned long written; ///< bytes written so far
+	int failed;
+	int verified;
+	struct tee* tee;
+};
+
+struct tee{
+	struct tee_target targets[TEE_MAX_TARGETS];
+	int count;
+	char* slots; ///< TEE_SLOTS * TEE_CHUNK_SIZE bytes
+	size_t lengths[TEE_SLOTS];
+	unsigned long head; ///< slot being filled by tee_write()
+	size_t fill; ///< bytes already in the head slot
+	int closed;
+	unsigned long total; ///< bytes received
+	unsigned long expected; ///< bytes announced by SERVER_FILE (0 if unknown)
+	int quiet; ///< do not print progress (background jobs)
+	time_t progress; ///< last time tee_print_progress() printed something
+	pthread_mutex_t lock;
+	pthread_cond_t not_full;
+	pthread_cond_t not_empty;
+	MD5_CTX CTX;
+	unsigned char digest[MD5_DIGEST_LENGTH]; ///< MD5 of the stream, valid once closed
+};
+
+int tee_open(struct tee* tee, char* targets[], int count, unsigned long expected, int quiet);
+int tee_write(struct tee* tee, const char* data, size_t length);
+int tee_close(struct tee* tee);
+void tee_print_progress(struct tee* tee);
+
+#endif /* TEE_H_ */
@@ -0,0 +1,238 @@
+/*
+ * throttle.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <throttle.h>
+
+/// failures of a key in the current and the previous window
+struct throttle_entry{
+	char key[THROTTLE_KEY_SIZE]; ///< empty if the slot is free
+	long window; ///< current window (time / window length)
+	unsigned int current;
+	unsigned int previous;
+};
+
+/// the failures counted for one kind of key
+struct throttle_table{
+	int limit; ///< failures within the window that block the key
+	unsigned long blocked; ///< logins turned down so far
+	struct throttle_entry entries[THROTTLE_SLOTS];
+};
+
+static struct throttle_table tables[THROTTLE_COUNT];
+static int window_length = THROTTLE_WINDOW; ///< seconds
+static int dirty = FALSE; ///< the tables changed since the last snapshot
+static pthread_mutex_t throttle_lock = PTHREAD_MUTEX_INITIALIZER; ///< protects tables and dirty
+
+/// FNV-1a hash of a key
+/// @param key the key
+/// @returns the hash
+static unsigned long throttle_hash(const char* key){
+	unsigned long hash = 14695981039346656037UL;
+	for(const unsigned char* ptr = (const unsigned char*) key;*ptr != '\0';ptr++){
+		hash ^= *ptr;
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+/// estimates the failures of an entry in the last window_length seconds
+/// @param entry the entry
+/// @param now the current time
+/// @returns the estimated failures
+/// @note the caller must hold throttle_lock
+static unsigned int throttle_count(const struct throttle_entry* entry, time_t now){
+	long window = now / window_length;
+	unsigned long remaining = (unsigned long) (window_length - now % window_length); // part of the previous window still in it
+	if(entry->window == window) return entry->current + (unsigned int) (entry->previous * remaining / (unsigned long) window_length);
+	if(entry->window == window - 1) return (unsigned int) (entry->current * remaining / (unsigned long) window_length);
+	return 0;
+}
+
+/// finds the entry of a key
+/// @param table the table
+/// @param key the key
+/// @param now the current time
+/// @param create 1 to take a slot for the key if it has none (forgetting the key with the fewest failures), 0 otherwise
+/// @returns the entry, NULL if the key has none and *create* is 0
+/// @note the caller must hold throttle_lock
+static struct throttle_entry* throttle_find(struct throttle_table* table, const char* key, time_t now, int create){
+	unsigned long position = throttle_hash(key);
+	struct throttle_entry* victim = NULL;
+	unsigned int fewest = UINT_MAX;
+	for(int i = 0;i < THROTTLE_PROBES;i++){
+		struct throttle_entry* entry = &table->entries[(position + (unsigned long) i) & (THROTTLE_SLOTS - 1)];
+		if(strcmp(entry->key, key) == 0) return entry;
+		unsigned int count = strcmp(entry->key, "") == 0 ? 0 : throttle_count(entry, now);
+		if(count < fewest){
+			victim = entry;
+			fewest = count;
+		}
+	}
+	if(!create) return NULL;
+	memset(victim, 0, sizeof(struct throttle_entry));
+	strncpy(victim->key, key, THROTTLE_KEY_SIZE - 1);
+	victim->window = now / window_length;
+	return victim;
+}
+
+/// writes the tables to THROTTLE_TMP and renames it to THROTTLE_FILE, if they changed
+static void throttle_save(){
+	static struct throttle_table snapshot[THROTTLE_COUNT]; // only used by one thread at a time, see throttle_writer()
+	pthread_mutex_lock(&throttle_lock);
+	if(!dirty){
+		pthread_mutex_unlock(&throttle_lock);
+		return;
+	}
+	memcpy(snapshot, tables, sizeof(tables));
+	dirty = FALSE;
+	pthread_mutex_unlock(&throttle_lock);
+	FILE* file_ptr;
+	if((file_ptr = fopen(THROTTLE_TMP, "w")) == NULL){
+		fprintf(stderr, "ERROR: saving login throttling (%s)\n", strerror(errno));
+		return;
+	}
+	int result = fwrite(THROTTLE_MAGIC, strlen(THROTTLE_MAGIC), 1, file_ptr) == 1 && fwrite(snapshot, sizeof(snapshot), 1, file_ptr) == 1;
+	if(fclose(file_ptr) != 0) result = FALSE; // not synced, losing the latest failures in a crash is harmless
+	if(result == FALSE || rename(THROTTLE_TMP, THROTTLE_FILE) < 0){
+		fprintf(stderr, "ERROR: saving login throttling (%s)\n", strerror(errno));
+		remove(THROTTLE_TMP);
+	}
+}
+
+/// reads the tables saved by a previous SERVER_AUTH, if any
+static void throttle_load(){
+	FILE* file_ptr;
+	if((file_ptr = fopen(THROTTLE_FILE, "r")) == NULL) return;
+	char magic[sizeof(THROTTLE_MAGIC)] = "";
+	static struct throttle_table saved[THROTTLE_COUNT];
+	if(fread(magic, strlen(THROTTLE_MAGIC), 1, file_ptr) != 1 || strcmp(magic, THROTTLE_MAGIC) != 0
+			|| fread(saved, sizeof(saved), 1, file_ptr) != 1){
+		fprintf(stderr, "ERROR: reading %s [out of format], ignoring\n", THROTTLE_FILE);
+		fclose(file_ptr);
+		return;
+	}
+	fclose(file_ptr);
+	for(int i = 0;i < THROTTLE_COUNT;i++){ // the limits may have changed since
+		memcpy(tables[i].entries, saved[i].entries, sizeof(tables[i].entries));
+		tables[i].blocked = saved[i].blocked;
+	}
+}
+
+/// writer thread: saves the tables every THROTTLE_SNAPSHOT_DELAY seconds
+/// @param arg unused
+static void* throttle_writer(void* arg){
+	(void) arg;
+	while(TRUE){
+		sleep(THROTTLE_SNAPSHOT_DELAY);
+		throttle_save();
+	}
+	return NULL;
+}
+
+/// reads the limits from THROTTLE_ENV ("<name>=<value>,..."), loads the last snapshot and starts the writer thread
+///
+/// names: user, address (failures), window (seconds)
+void throttle_start(){
+	tables[THROTTLE_USER].limit = THROTTLE_USER_LIMIT;
+	tables[THROTTLE_ADDRESS].limit = THROTTLE_ADDRESS_LIMIT;
+	char* env = getenv(THROTTLE_ENV);
+	if(env != NULL){
+		char settings[BUFFER_SIZE];
+		strncpy(settings, env, BUFFER_SIZE - 1);
+		settings[BUFFER_SIZE - 1] = '\0';
+		char* save;
+		for(char* setting = strtok_r(settings, ",", &save);setting != NULL;setting = strtok_r(NULL, ",", &save)){
+			char* value = strchr(setting, '=');
+			int number = value == NULL ? INEX : (int) strtol(value + 1, NULL, 10);
+			if(value != NULL) *value = '\0';
+			if(number < 1) fprintf(stderr, "ERROR: invalid throttling setting [%s], ignoring\n", setting);
+			else if(strcmp(setting, "user") == 0) tables[THROTTLE_USER].limit = number;
+			else if(strcmp(setting, "address") == 0) tables[THROTTLE_ADDRESS].limit = number;
+			else if(strcmp(setting, "window") == 0) window_length = number;
+			else fprintf(stderr, "ERROR: unknown throttling setting [%s], ignoring\n", setting);
+		}
+	}
+	throttle_load();
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, throttle_writer, NULL) != 0){
+		fprintf(stderr, "ERROR: creating login throttling writer (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	pthread_detach(thread);
+	atexit(throttle_save);
+	printf("[SERVER_AUTH]: throttling logins -> user: %d, address: %d failures in %ds\n",
+			tables[THROTTLE_USER].limit, tables[THROTTLE_ADDRESS].limit, window_length);
+}
+
+/// checks if a key failed too many times within the window
+/// @param which THROTTLE_USER or THROTTLE_ADDRESS
+/// @param key the user name or client address (NULL is never blocked)
+/// @returns 1 if logins of the key must be turned down, 0 otherwise
+int throttle_blocked(int which, const char* key){
+	if(key == NULL) return FALSE;
+	time_t now = time(NULL);
+	pthread_mutex_lock(&throttle_lock);
+	struct throttle_entry* entry = throttle_find(&tables[which], key, now, FALSE);
+	int blocked = entry != NULL && throttle_count(entry, now) >= (unsigned int) tables[which].limit;
+	if(blocked) tables[which].blocked++;
+	pthread_mutex_unlock(&throttle_lock);
+	return blocked;
+}
+
+/// counts a failed login of a key
+/// @param which THROTTLE_USER or THROTTLE_ADDRESS
+/// @param key the user name or client address (NULL is ignored)
+void throttle_fail(int which, const char* key){
+	if(key == NULL) return;
+	time_t now = time(NULL);
+	long window = now / window_length;
+	pthread_mutex_lock(&throttle_lock);
+	struct throttle_entry* entry = throttle_find(&tables[which], key, now, TRUE);
+	if(entry->window != window){ // slide
+		entry->previous = entry->window == window - 1 ? entry->current : 0;
+		entry->current = 0;
+		entry->window = window;
+	}
+	entry->current++;
+	dirty = TRUE;
+	pthread_mutex_unlock(&throttle_lock);
+}
+
+/// forgets the failures of a key
+/// @param which THROTTLE_USER or THROTTLE_ADDRESS
+/// @param key the user name or client address (NULL is ignored)
+void throttle_clear(int which, const char* key){
+	if(key == NULL) return;
+	pthread_mutex_lock(&throttle_lock);
+	struct throttle_entry* entry = throttle_find(&tables[which], key, time(NULL), FALSE);
+	if(entry != NULL){
+		memset(entry, 0, sizeof(struct throttle_entry));
+		dirty = TRUE;
+	}
+	pthread_mutex_unlock(&throttle_lock);
+}
+
+/// stores the limits and the logins turned down in *buffer*
+/// @param buffer the buffer
+/// @param size size of the buffer
+/// @returns a pointer to the provided buffer
+char* throttle_stats(char* buffer, size_t size){
+	pthread_mutex_lock(&throttle_lock);
+	snprintf(buffer, size, TAB "%-20s %lu (max %d failures in %ds)\n" TAB "%-20s %lu (max %d failures in %ds)\n",
+			"blocked (user)", tables[THROTTLE_USER].blocked, tables[THROTTLE_USER].limit, window_length,
+			"blocked (address)", tables[THROTTLE_ADDRESS].blocked, tables[THROTTLE_ADDRESS].limit, window_length);
+	pthread_mutex_unlock(&throttle_lock);
+	return buffer;
+}
@@ -0,0 +1,53 @@
+/*
+ * throttle.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#ifndef THROTTLE_H_
+#define THROTTLE_H_
+
+#include <stddef.h>
+#include <global.h>
+
+/*
+ * failed logins of SERVER_AUTH, counted in memory over a sliding window, per user and per client address:
+ *
+ *   throttle_blocked()  before the password is checked, so a blocked login costs no hash
+ *   throttle_fail()     after a wrong password (or an unknown user, counted for the address only)
+ *   throttle_clear()    after a successful login, for the user only
+ *
+ * every key is kept in a fixed table (THROTTLE_SLOTS, looked up in at most THROTTLE_PROBES slots),
+ * with the failures of the current and the previous window; the failures in the last *window*
+ * seconds are estimated as current + previous * (the part of the previous window still in it).
+ * When the slots of a key are taken, the key with the fewest failures is forgotten
+ *
+ * nothing is written on the login path: the tables are saved to THROTTLE_FILE every
+ * THROTTLE_SNAPSHOT_DELAY seconds (if they changed) and on exit, and read back on start
+ *
+ * the limits are set with THROTTLE_ENV, e.g. "user=5,address=20,window=300"
+ */
+
+#define THROTTLE_ENV "OS_IMAGE_THROTTLE" ///< environment variable that overrides the defaults, see throttle_start()
+#define THROTTLE_FILE "USER_DDBB.throttle" ///< snapshot of the tables
+#define THROTTLE_TMP ".throttle.tmp" ///< temporary filename used by the snapshot
+#define THROTTLE_MAGIC "OSTHROT1" ///< first bytes of THROTTLE_FILE (not NUL terminated)
+#define THROTTLE_USER 0 ///< failures per user name
+#define THROTTLE_ADDRESS 1 ///< failures per client address
+#define THROTTLE_COUNT 2
+#define THROTTLE_USER_LIMIT 5 ///< default failures of a user within the window before it is blocked
+#define THROTTLE_ADDRESS_LIMIT 20 ///< default failures from an address within the window before it is blocked
+#define THROTTLE_WINDOW 300 ///< default window (seconds)
+#define THROTTLE_SLOTS 4096 ///< keys kept per table (power of 2)
+#define THROTTLE_PROBES 8 ///< slots where a key may be
+#define THROTTLE_KEY_SIZE MAX_USERNAME_SIZE ///< maximum size of a key, including the terminating null byte
+#define THROTTLE_SNAPSHOT_DELAY 30 ///< seconds between snapshots
+
+void throttle_start();
+int throttle_blocked(int which, const char* key);
+void throttle_fail(int which, const char* key);
+void throttle_clear(int which, const char* key);
+char* throttle_stats(char* buffer, size_t size);
+
+#endif /* THROTTLE_H_ */
@@ -0,0 +1,154 @@
+/*
+ * token.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <openssl/crypto.h>
+#include <openssl/evp.h>
+#include <openssl/hmac.h>
+#include <openssl/rand.h>
+#include <token.h>
+
+/// maps the key region
+/// @param flags flags for shm_open()
+/// @returns the key, NULL on failure
+static struct token_key* token_map(int flags){
+	int FD = shm_open(TOKEN_NAME, flags, 0600); // the key must not be readable by other users
+	if(FD < 0){
+		if(errno == ENOENT) return NULL; // SERVER_MAIN is not running, up to the caller
+		fprintf(stderr, "ERROR: opening shared memory %s (%s)\n", TOKEN_NAME, strerror(errno));
+		return NULL;
+	}
+	if((flags & O_CREAT) && ftruncate(FD, sizeof(struct token_key)) < 0){
+		fprintf(stderr, "ERROR: sizing shared memory %s (%s)\n", TOKEN_NAME, strerror(errno));
+		close(FD);
+		return NULL;
+	}
+	void* region = mmap(NULL, sizeof(struct token_key), PROT_READ | PROT_WRITE, MAP_SHARED, FD, 0);
+	close(FD);
+	if(region == MAP_FAILED){
+		fprintf(stderr, "ERROR: mapping shared memory %s (%s)\n", TOKEN_NAME, strerror(errno));
+		return NULL;
+	}
+	return region;
+}
+
+/// signs "<user>:<epoch>:<expiry>"
+/// @param key the key
+/// @param data the signed part of the token
+/// @param length length of *data*
+/// @param MAC where the hex encoded signature is stored, **must be 2 * EVP_MAX_MD_SIZE + 1 bytes long**
+static void token_sign(const struct token_key* key, const char* data, size_t length, char* MAC){
+	unsigned char digest[EVP_MAX_MD_SIZE];
+	unsigned int digest_length = 0;
+	HMAC(EVP_sha256(), key->key, TOKEN_KEY_SIZE, (const unsigned char*) data, length, digest, &digest_length);
+	for(unsigned int i = 0;i < digest_length;i++){
+		sprintf(MAC + 2 * i, "%02x", digest[i]);
+	}
+}
+
+/// creates the key region with a new random key (SERVER_MAIN), every token issued before is no longer valid
+/// @returns the key, NULL on failure
+struct token_key* token_create(){
+	shm_unlink(TOKEN_NAME);
+	struct token_key* key = token_map(O_RDWR | O_CREAT | O_EXCL);
+	if(key == NULL) return NULL;
+	if(RAND_bytes(key->key, TOKEN_KEY_SIZE) != 1){
+		fprintf(stderr, "ERROR: generating token key\n");
+		token_destroy(key);
+		return NULL;
+	}
+	return key;
+}
+
+/// attaches to the key region created by SERVER_MAIN
+/// @returns the key, NULL on failure
+struct token_key* token_attach(){
+	return token_map(O_RDWR);
+}
+
+/// removes the key region
+/// @param key the key
+void token_destroy(struct token_key* key){
+	if(key == NULL) return;
+	munmap(key, sizeof(struct token_key));
+	shm_unlink(TOKEN_NAME);
+}
+
+/// obtains the revocation epoch of a user, its slot is picked by the FNV-1a hash of the name
+/// @param key the key region
+/// @param user the user name
+/// @returns the epoch
+static _Atomic unsigned long* token_epoch(struct token_key* key, const char* user){
+	unsigned long hash = 14695981039346656037UL;
+	for(const unsigned char* ptr = (const unsigned char*) user;*ptr != '\0';ptr++){
+		hash ^= *ptr;
+		hash *= 1099511628211UL;
+	}
+	return &key->epochs[hash % TOKEN_EPOCHS];
+}
+
+/// revokes every token of a user issued so far
+/// @param key the key (NULL if unavailable)
+/// @param user the user name
+void token_revoke(struct token_key* key, const char* user){
+	if(key == NULL) return;
+	atomic_fetch_add(token_epoch(key, user), 1);
+}
+
+/// issues a token for a user, valid for TOKEN_LIFETIME seconds or until it is revoked
+/// @param key the key (NULL if unavailable)
+/// @param user the user that logged in
+/// @param token where the token is stored, **must be TOKEN_SIZE bytes long**
+/// @returns 1 on success, 0 if tokens are unavailable
+int token_issue(struct token_key* key, const char* user, char* token){
+	if(key == NULL) return FALSE;
+	char MAC[2 * EVP_MAX_MD_SIZE + 1];
+	unsigned long epoch = atomic_load(token_epoch(key, user));
+	int length = snprintf(token, TOKEN_SIZE, "%s:%lx:%ld:", user, epoch, (long) time(NULL) + TOKEN_LIFETIME);
+	token_sign(key, token, (size_t) length - 1, MAC); // without the last ':'
+	strncat(token, MAC, TOKEN_SIZE - (size_t) length - 1);
+	return TRUE;
+}
+
+/// checks a token
+///
+/// the user name may contain ':', so the token is split from its end
+/// @param key the key (NULL if unavailable)
+/// @param token the token
+/// @param user where the user of the token is stored, **must be MAX_USERNAME_SIZE bytes long**
+/// @returns 1 if the token is valid, has not expired and was not revoked, 0 otherwise
+int token_verify(struct token_key* key, const char* token, char* user){
+	if(key == NULL || token == NULL || strlen(token) >= TOKEN_SIZE) return FALSE;
+	char copy[TOKEN_SIZE];
+	strcpy(copy, token);
+	char* MAC = strrchr(copy, ':');
+	if(MAC == NULL) return FALSE;
+	*MAC++ = '\0';
+	char* expiry = strrchr(copy, ':');
+	if(expiry == NULL) return FALSE;
+	*expiry = '\0';
+	char* issued = strrchr(copy, ':'); // epoch
+	*expiry = ':';
+	if(issued == NULL || issued == copy || issued - copy >= MAX_USERNAME_SIZE) return FALSE;
+	char expected[2 * EVP_MAX_MD_SIZE + 1];
+	token_sign(key, copy, strlen(copy), expected);
+	if(strlen(MAC) != strlen(expected) || CRYPTO_memcmp(MAC, expected, strlen(expected)) != 0) return FALSE;
+	if(strtol(expiry + 1, NULL, 10) < (long) time(NULL)) return FALSE; // expired
+	unsigned long epoch = strtoul(issued + 1, NULL, 16);
+	*issued = '\0';
+	if(epoch != atomic_load(token_epoch(key, copy))) return FALSE; // revoked
+	strcpy(user, copy);
+	return TRUE;
+}
@@ -0,0 +1,49 @@
+/*
+ * token.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#ifndef TOKEN_H_
+#define TOKEN_H_
+
+#include <global.h>
+
+/*
+ * session tokens, so a client that reconnects does not have to log in through SERVER_AUTH again:
+ *
+ *   SERVER_AUTH  successful login -> TOKEN_PREFIX "<user>:<epoch>:<expiry>:<HMAC-SHA256(user:epoch:expiry)>"
+ *   client       keeps the token (see client.c), and sends 'token <token>' instead of 'login <user> <pass>'
+ *   SERVER_MAIN  checks the HMAC, the expiry and the epoch itself, no backend request is needed
+ *
+ * the key is random, created by SERVER_MAIN in a shared memory region only readable by its user,
+ * so tokens outlive a server_main --reload but not a restart. The region also holds the revocation
+ * epochs: token_revoke() bumps the epoch of a user, and tokens issued with an older epoch are no
+ * longer valid. SERVER_AUTH revokes the tokens of a user when it changes its password, and
+ * `./user_db import` the ones of every imported user (bans are imported). Epochs are shared by
+ * every user whose name hashes to the same slot, so a revocation may also log out a few others.
+ * SERVER_AUTH checks tokens too, for requests of sessions it never saw log in (resumed with a token)
+ */
+
+#define TOKEN_NAME "/os_image_tool_token" ///< name of the shared memory region holding the key
+#define TOKEN_KEY_SIZE 32 ///< size of the key (bytes)
+#define TOKEN_LIFETIME (8 * 60 * 60) ///< seconds a token is valid for
+#define TOKEN_SIZE (MAX_USERNAME_SIZE + 104) ///< maximum size of a token, including the terminating null byte
+#define TOKEN_FIELDS 3 ///< fields after the user name (epoch, expiry and signature), the user name may contain ':'
+#define TOKEN_EPOCHS 4096 ///< revocation epochs, users are hashed into them
+#define TOKEN_PREFIX "[SERVER_AUTH]: session token " ///< line of the login response that carries the token
+
+struct token_key{
+	unsigned char key[TOKEN_KEY_SIZE];
+	_Atomic unsigned long epochs[TOKEN_EPOCHS]; ///< see token_revoke()
+};
+
+struct token_key* token_create();
+struct token_key* token_attach();
+void token_destroy(struct token_key* key);
+void token_revoke(struct token_key* key, const char* user);
+int token_issue(struct token_key* key, const char* user, char* token);
+int token_verify(struct token_key* key, const char* token, char* user);
+
+#endif /* TOKEN_H_ */
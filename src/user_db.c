@@ -0,0 +1,39 @@
+/*
+ * user_db.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <users.h>
+#include <token.h>
+
+struct token_key* TOKENS = NULL; ///< key of the session tokens, if SERVER_MAIN is running
+
+/// revokes the session tokens of an imported user, whose password or ban may have changed
+/// @param name the user name
+static void revoke_tokens(const char* name){
+	token_revoke(TOKENS, name);
+}
+
+/// converts between the text user database (USER_DDBB format) and USER_DDBB_DB, see users.h
+///
+///   ./user_db import <file>    merges the users in <file> into USER_DDBB_DB (bulk load), revoking their session tokens
+///   ./user_db export           prints USER_DDBB_DB in the text format
+int main(int argc, char* argv[]){
+	if(argc == 3 && strcmp(argv[1], "import") == 0){
+		TOKENS = token_attach(); // no tokens to revoke without it
+		int imported = users_import(argv[2], revoke_tokens);
+		if(imported == INEX) return EXIT_FAILURE;
+		printf("[USER_DB]: %d user(s) imported into %s\n", imported, USER_DDBB_DB);
+		return EXIT_SUCCESS;
+	}
+	if(argc == 2 && strcmp(argv[1], "export") == 0){
+		return users_export(stdout) == INEX ? EXIT_FAILURE : EXIT_SUCCESS;
+	}
+	fprintf(stderr, "usage: %s import <file> | export\n", argv[0]);
+	return EXIT_FAILURE;
+}
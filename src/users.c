@@ -0,0 +1,742 @@
+/*
+ * users.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdatomic.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <users.h>
+
+/// users in file order, plus an open addressing index by name
+struct user_table{
+	user* records;
+	int count;
+	int capacity; ///< size of records
+	int* slots; ///< record index of each slot, INEX if empty
+	unsigned long slot_count; ///< power of 2, at least twice count
+	void* map; ///< USER_DDBB_DB while records and slots point into it, NULL once copied to the heap
+	size_t map_size;
+};
+
+/// header of USER_DDBB_DB, followed by records[count] and slots[slot_count] exactly as kept in memory
+struct users_header{
+	char magic[8]; ///< USERS_MAGIC
+	uint32_t count;
+	uint32_t slot_count;
+};
+
+/// a record of USERS_MAGIC_V1 databases
+struct user_v1{
+	char name[MAX_USERNAME_SIZE];
+	char pass[MAX_PASSWORD_SIZE + 1];
+	int strikes;
+	int ban;
+};
+
+static struct user_table users = {NULL, 0, 0, NULL, 0, NULL, 0};
+static struct stat known; ///< USER_DDBB_DB as last read or written, anything else means someone else changed it
+static _Atomic time_t refreshed = 0; ///< last time users_refresh() looked at USER_DDBB_DB
+static int journal = INEX; ///< USER_DDBB_JOURNAL, opened for appending
+static char* pending = NULL; ///< journal entries not yet written
+static size_t pending_length = 0;
+static size_t pending_capacity = 0;
+static unsigned long appended = 0; ///< journal entries added so far
+static unsigned long committed = 0; ///< journal entries written (and synced) so far
+static int journaled = 0; ///< entries in the journal since the last compaction
+static int writing = FALSE; ///< the journal or the snapshot is being written
+static pthread_mutex_t users_lock = PTHREAD_MUTEX_INITIALIZER; ///< protects the journal, taken before users_table_lock
+static pthread_rwlock_t users_table_lock = PTHREAD_RWLOCK_INITIALIZER; ///< protects users and known, lookups only read
+static pthread_cond_t users_changed = PTHREAD_COND_INITIALIZER; ///< signaled when an entry is added
+static pthread_cond_t users_written = PTHREAD_COND_INITIALIZER; ///< broadcast when a commit or compaction ends
+
+/// FNV-1a hash of a user name
+/// @param name the user name
+/// @returns the hash
+static unsigned long users_hash(const char* name){
+	unsigned long hash = 14695981039346656037UL;
+	for(const unsigned char* ptr = (const unsigned char*) name;*ptr != '\0';ptr++){
+		hash ^= *ptr;
+		hash *= 1099511628211UL;
+	}
+	return hash;
+}
+
+/// finds the slot of a user, or the empty slot where it would go
+/// @param table the table (with at least one empty slot)
+/// @param name the user name
+/// @returns the slot position
+static unsigned long users_probe(const struct user_table* table, const char* name){
+	unsigned long mask = table->slot_count - 1;
+	unsigned long position = users_hash(name) & mask;
+	while(table->slots[position] != INEX && strcmp(table->records[table->slots[position]].name, name) != 0){
+		position = (position + 1) & mask; // linear probing
+	}
+	return position;
+}
+
+/// frees a table
+/// @param table the table
+static void users_free(struct user_table* table){
+	if(table->map != NULL){
+		munmap(table->map, table->map_size);
+	}else{
+		free(table->records);
+		free(table->slots);
+	}
+	memset(table, 0, sizeof(struct user_table));
+}
+
+/// copies a mapped table to the heap, so it can grow (changes to existing users do not need it, see users_map())
+/// @param table the table
+/// @returns 1 on success, 0 on failure
+static int users_own(struct user_table* table){
+	if(table->map == NULL) return TRUE;
+	int capacity = table->count < USERS_MIN_SLOTS ? USERS_MIN_SLOTS : table->count;
+	user* records = malloc((size_t) capacity * sizeof(user));
+	int* slots = malloc(table->slot_count * sizeof(int));
+	if(records == NULL || slots == NULL){
+		fprintf(stderr, "ERROR: allocating users (%s)\n", strerror(errno));
+		free(records);
+		free(slots);
+		return FALSE;
+	}
+	memcpy(records, table->records, (size_t) table->count * sizeof(user));
+	memcpy(slots, table->slots, table->slot_count * sizeof(int));
+	munmap(table->map, table->map_size);
+	table->records = records;
+	table->capacity = capacity;
+	table->slots = slots;
+	table->map = NULL;
+	table->map_size = 0;
+	return TRUE;
+}
+
+/// rebuilds the index of a table with *slot_count* slots
+/// @param table the table
+/// @param slot_count the new amount of slots (power of 2, more than twice the users)
+/// @returns 1 on success, 0 on failure
+static int users_rehash(struct user_table* table, unsigned long slot_count){
+	int* slots = malloc(slot_count * sizeof(int));
+	if(slots == NULL){
+		fprintf(stderr, "ERROR: allocating user index (%s)\n", strerror(errno));
+		return FALSE;
+	}
+	for(unsigned long i = 0;i < slot_count;i++) slots[i] = INEX;
+	free(table->slots);
+	table->slots = slots;
+	table->slot_count = slot_count;
+	for(int i = 0;i < table->count;i++){
+		table->slots[users_probe(table, table->records[i].name)] = i;
+	}
+	return TRUE;
+}
+
+/// adds a user to a table
+/// @param table the table
+/// @param record the user
+/// @param replace what to do if the user is already there: 1 to replace it, 0 to keep it (within a text file the first
+/// record of a user wins, as it always did)
+/// @returns 1 on success, 0 on failure
+static int users_insert(struct user_table* table, const user* record, int replace){
+	if(table->slot_count > 0){
+		unsigned long position = users_probe(table, record->name);
+		if(table->slots[position] != INEX){ // duplicated
+			if(replace) table->records[table->slots[position]] = *record;
+			return TRUE;
+		}
+	}
+	if(users_own(table) == FALSE) return FALSE;
+	if((unsigned long) (table->count + 1) * 2 > table->slot_count){
+		unsigned long slot_count = table->slot_count == 0 ? USERS_MIN_SLOTS : table->slot_count * 2;
+		if(users_rehash(table, slot_count) == FALSE) return FALSE;
+	}
+	unsigned long position = users_probe(table, record->name);
+	if(table->count == table->capacity){
+		int capacity = table->capacity == 0 ? USERS_MIN_SLOTS : table->capacity * 2;
+		user* records = realloc(table->records, (size_t) capacity * sizeof(user));
+		if(records == NULL){
+			fprintf(stderr, "ERROR: allocating users (%s)\n", strerror(errno));
+			return FALSE;
+		}
+		table->records = records;
+		table->capacity = capacity;
+	}
+	table->records[table->count] = *record;
+	table->slots[position] = table->count++;
+	return TRUE;
+}
+
+/// reads a text user database ("name pass strikes ban" per line, as USER_DDBB) into a new table
+/// @param table where the table is stored
+/// @param filename the text file
+/// @returns 1 on success, 0 on failure
+static int users_read_text(struct user_table* table, const char* filename){
+	memset(table, 0, sizeof(struct user_table));
+	FILE* file_ptr;
+	if((file_ptr = fopen(filename, "r")) == NULL){ // file does not exist
+		fprintf(stderr, "ERROR: opening %s (%s)\n", filename, strerror(errno));
+		return FALSE;
+	}
+	user record;
+	memset(&record, 0, sizeof(user)); // the records end up in USER_DDBB_DB as they are
+	int io_chars;
+	while((io_chars = fscanf(file_ptr, "%29s %127s %d %d", record.name, record.pass, &record.strikes, &record.ban)) != EOF){
+		if(io_chars != 4){
+			fprintf(stderr, "ERROR: reading user database [out of format]\n");
+			fclose(file_ptr);
+			users_free(table);
+			return FALSE;
+		}
+		if(users_insert(table, &record, FALSE) == FALSE){
+			fclose(file_ptr);
+			users_free(table);
+			return FALSE;
+		}
+	}
+	fclose(file_ptr);
+	return TRUE;
+}
+
+/// checks the records and the index of a mapped USER_DDBB_DB, so a damaged file is turned down instead of read out of
+/// bounds: every name and credential is NUL terminated, every slot is empty or points to a record, and at least one
+/// slot is empty (otherwise users_probe() would never end)
+/// @param records the records
+/// @param record_size size of each record (user or struct user_v1)
+/// @param pass_offset offset of the credential within a record
+/// @param pass_size size of the credential within a record
+/// @param count amount of records
+/// @param slots the index
+/// @param slot_count amount of slots
+/// @returns 1 if they are consistent, 0 otherwise
+static int users_check(const char* records, size_t record_size, size_t pass_offset, size_t pass_size, int count, const int* slots,
+		unsigned long slot_count){
+	int empty = FALSE;
+	for(unsigned long i = 0;i < slot_count;i++){
+		if(slots[i] == INEX) empty = TRUE;
+		else if(slots[i] < 0 || slots[i] >= count) return FALSE;
+	}
+	if(!empty) return FALSE;
+	for(int i = 0;i < count;i++){
+		const char* record = records + (size_t) i * record_size;
+		if(memchr(record, '\0', MAX_USERNAME_SIZE) == NULL || memchr(record + pass_offset, '\0', pass_size) == NULL) return FALSE;
+	}
+	return TRUE;
+}
+
+/// maps USER_DDBB_DB into a new table, only checked (see users_check()) until it is looked up
+///
+/// the mapping is private: changes to existing users stay in memory (and in the journal) until the next compaction
+/// @param table where the table is stored
+/// @param info where the state of USER_DDBB_DB is stored (may be NULL)
+/// @returns 1 on success, 0 if it can not be read, INEX if it does not exist
+static int users_map(struct user_table* table, struct stat* info){
+	memset(table, 0, sizeof(struct user_table));
+	int FD = open(USER_DDBB_DB, O_RDONLY);
+	if(FD < 0){
+		if(errno == ENOENT) return INEX;
+		fprintf(stderr, "ERROR: opening user database (%s)\n", strerror(errno));
+		return FALSE;
+	}
+	struct stat current;
+	if(fstat(FD, &current) < 0){
+		fprintf(stderr, "ERROR: reading user database (%s)\n", strerror(errno));
+		close(FD);
+		return FALSE;
+	}
+	size_t size = (size_t) current.st_size;
+	void* map = size >= sizeof(struct users_header) ? mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_PRIVATE, FD, 0) : MAP_FAILED;
+	close(FD);
+	if(map == MAP_FAILED){
+		fprintf(stderr, "ERROR: mapping user database (%s)\n", size >= sizeof(struct users_header) ? strerror(errno) : "too short");
+		return FALSE;
+	}
+	const struct users_header* header = (const struct users_header*) map;
+	unsigned long slot_count = header->slot_count;
+	int upgrade = memcmp(header->magic, USERS_MAGIC_V1, sizeof(header->magic)) == 0;
+	size_t record_size = upgrade ? sizeof(struct user_v1) : sizeof(user);
+	const char* records = (const char*) map + sizeof(struct users_header);
+	if((!upgrade && memcmp(header->magic, USERS_MAGIC, sizeof(header->magic)) != 0) || slot_count < USERS_MIN_SLOTS
+			|| (slot_count & (slot_count - 1)) != 0 || (unsigned long) header->count * 2 > slot_count
+			|| size != sizeof(struct users_header) + header->count * record_size + slot_count * sizeof(int)
+			|| !users_check(records, record_size, upgrade ? offsetof(struct user_v1, pass) : offsetof(user, pass),
+					upgrade ? sizeof(((struct user_v1*) NULL)->pass) : sizeof(((user*) NULL)->pass), (int) header->count,
+					(const int*) (records + header->count * record_size), slot_count)){
+		fprintf(stderr, "ERROR: reading user database [out of format]\n");
+		munmap(map, size);
+		return FALSE;
+	}
+	if(upgrade){ // copied into the current layout, written as it is by the next compaction
+		const struct user_v1* records = (const struct user_v1*) ((const char*) map + sizeof(struct users_header));
+		table->count = (int) header->count;
+		table->capacity = table->count < USERS_MIN_SLOTS ? USERS_MIN_SLOTS : table->count;
+		table->slot_count = slot_count;
+		table->records = calloc((size_t) table->capacity, sizeof(user));
+		table->slots = malloc(slot_count * sizeof(int));
+		if(table->records == NULL || table->slots == NULL){
+			fprintf(stderr, "ERROR: allocating users (%s)\n", strerror(errno));
+			munmap(map, size);
+			users_free(table);
+			return FALSE;
+		}
+		for(int i = 0;i < table->count;i++){
+			strcpy(table->records[i].name, records[i].name);
+			strcpy(table->records[i].pass, records[i].pass);
+			table->records[i].strikes = records[i].strikes;
+			table->records[i].ban = records[i].ban;
+		}
+		memcpy(table->slots, records + table->count, slot_count * sizeof(int));
+		munmap(map, size);
+		if(info != NULL) *info = current;
+		return TRUE;
+	}
+	madvise(map, size, MADV_RANDOM); // lookups touch one slot and one record, do not read ahead
+	table->records = (user*) ((char*) map + sizeof(struct users_header));
+	table->count = (int) header->count;
+	table->capacity = table->count;
+	table->slots = (int*) (table->records + table->count);
+	table->slot_count = slot_count;
+	table->map = map;
+	table->map_size = size;
+	if(info != NULL) *info = current;
+	return TRUE;
+}
+
+/// writes a table to a temporary file as a binary user database, to be renamed to USER_DDBB_DB
+/// @param table the table (with an index)
+/// @param filename the temporary file (USER_DDBB_TMP or USER_DDBB_IMPORT_TMP)
+/// @returns 1 on success, 0 on failure
+static int users_write(const struct user_table* table, const char* filename){
+	struct users_header header;
+	memset(&header, 0, sizeof(struct users_header));
+	memcpy(header.magic, USERS_MAGIC, sizeof(header.magic));
+	header.count = (uint32_t) table->count;
+	header.slot_count = (uint32_t) table->slot_count;
+	FILE* file_ptr;
+	if((file_ptr = fopen(filename, "w")) == NULL){
+		fprintf(stderr, "ERROR: writing user database (%s)\n", strerror(errno));
+		return FALSE;
+	}
+	int result = fwrite(&header, sizeof(struct users_header), 1, file_ptr) == 1
+			&& fwrite(table->records, sizeof(user), (size_t) table->count, file_ptr) == (size_t) table->count
+			&& fwrite(table->slots, sizeof(int), table->slot_count, file_ptr) == table->slot_count;
+	if(fflush(file_ptr) != 0 || fsync(fileno(file_ptr)) < 0) result = FALSE; // before it replaces USER_DDBB_DB
+	if(fclose(file_ptr) != 0) result = FALSE;
+	if(result == FALSE){
+		fprintf(stderr, "ERROR: writing user database (%s)\n", strerror(errno));
+		remove(filename);
+	}
+	return result;
+}
+
+/// checks if USER_DDBB_DB is still what was last read or written
+/// @param current the current state of USER_DDBB
+/// @returns 1 if it is, 0 if someone else changed it
+/// @note the caller must hold users_table_lock
+static int users_known(const struct stat* current){
+	return current->st_ino == known.st_ino && current->st_size == known.st_size
+			&& current->st_mtim.tv_sec == known.st_mtim.tv_sec && current->st_mtim.tv_nsec == known.st_mtim.tv_nsec;
+}
+
+/// maps USER_DDBB_DB again if someone else changed it, unless there are journal entries not compacted into it
+///
+/// it is only looked at once per second, so lookups do not pay a stat() each
+/// @note the caller must not hold any lock
+static void users_refresh(){
+	time_t now = time(NULL);
+	if(atomic_exchange(&refreshed, now) == now) return;
+	struct stat current;
+	if(stat(USER_DDBB_DB, &current) < 0) return;
+	pthread_rwlock_rdlock(&users_table_lock);
+	int unchanged = users_known(&current);
+	pthread_rwlock_unlock(&users_table_lock);
+	if(unchanged) return;
+	pthread_mutex_lock(&users_lock);
+	if(pending_length == 0 && journaled == 0 && !writing){ // otherwise our changes win, until compacted
+		pthread_rwlock_wrlock(&users_table_lock);
+		struct user_table table;
+		if(!users_known(&current) && users_map(&table, &current) == TRUE){ // otherwise keep serving the users we have
+			users_free(&users);
+			users = table;
+			known = current;
+			printf("[SERVER_AUTH]: user database loaded (%d users)\n", users.count);
+		}
+		pthread_rwlock_unlock(&users_table_lock);
+	}
+	pthread_mutex_unlock(&users_lock);
+}
+
+/// writes every pending journal entry with a single write() and fdatasync() (group commit)
+///
+/// users_lock is released while writing, so entries keep being added meanwhile
+/// @note the caller must hold users_lock
+static void users_commit(){
+	char* buffer = pending;
+	size_t length = pending_length;
+	unsigned long sequence = appended;
+	int entries = (int) (appended - committed);
+	pending = NULL;
+	pending_length = 0;
+	pending_capacity = 0;
+	writing = TRUE;
+	pthread_mutex_unlock(&users_lock);
+	size_t written = 0;
+	while(written < length){
+		ssize_t W = write(journal, buffer + written, length - written);
+		if(W < 0 && errno == EINTR) continue;
+		if(W <= 0) break;
+		written += (size_t) W;
+	}
+	if(written < length || fdatasync(journal) < 0){ // the change stays in memory, the next compaction saves it
+		fprintf(stderr, "ERROR: writing user journal (%s)\n", strerror(errno));
+	}
+	free(buffer);
+	pthread_mutex_lock(&users_lock);
+	committed = sequence;
+	journaled += entries;
+	writing = FALSE;
+	pthread_cond_broadcast(&users_written);
+}
+
+/// replays the journal over a table
+/// @param table the table
+/// @returns the amount of entries replayed
+/// @note the caller must hold users_lock, and users_table_lock if the table is users
+static int users_replay(struct user_table* table){
+	FILE* file_ptr;
+	if((file_ptr = fopen(USER_DDBB_JOURNAL, "r")) == NULL) return 0;
+	user record;
+	memset(&record, 0, sizeof(user));
+	int replayed = 0;
+	while(fscanf(file_ptr, "%29s %127s %d %d", record.name, record.pass, &record.strikes, &record.ban) == 4){ // a torn entry ends it
+		users_insert(table, &record, TRUE);
+		replayed++;
+	}
+	fclose(file_ptr);
+	return replayed;
+}
+
+/// maps USER_DDBB_DB again if someone else changed it (e.g. `./user_db import`), and replays the journal over it
+///
+/// otherwise the compaction would write the users it had over the new ones. Changes that could not be written to the
+/// journal are lost along with the old users
+/// @note the caller must hold users_lock and the flock() of the journal, and nothing can be pending (see users_writer())
+static void users_merge(){
+	struct stat current;
+	if(stat(USER_DDBB_DB, &current) < 0) return;
+	pthread_rwlock_wrlock(&users_table_lock);
+	struct user_table table;
+	if(!users_known(&current) && users_map(&table, &current) == TRUE){ // otherwise keep the users we have
+		int replayed = users_replay(&table);
+		users_free(&users);
+		users = table;
+		known = current;
+		printf("[SERVER_AUTH]: user database changed meanwhile, %d change(s) replayed over it (%d users)\n", replayed, users.count);
+	}
+	pthread_rwlock_unlock(&users_table_lock);
+}
+
+/// writes a snapshot of every user to USER_DDBB_TMP, renames it to USER_DDBB_DB and empties the journal
+///
+/// users_lock is released while writing, so lookups do not wait for the disk. The flock() of the journal is held
+/// throughout, so an import waits for it (and the other way around)
+/// @note the caller must hold users_lock
+static void users_compact(){
+	struct user_table snapshot = {NULL, 0, 0, NULL, 0, NULL, 0};
+	while(flock(journal, LOCK_EX) < 0 && errno == EINTR);
+	users_merge();
+	pthread_rwlock_rdlock(&users_table_lock);
+	snapshot.records = malloc((size_t) (users.count + 1) * sizeof(user));
+	snapshot.slots = malloc((users.slot_count + 1) * sizeof(int));
+	if(snapshot.records == NULL || snapshot.slots == NULL){
+		pthread_rwlock_unlock(&users_table_lock);
+		fprintf(stderr, "ERROR: allocating user snapshot (%s)\n", strerror(errno));
+		users_free(&snapshot);
+		flock(journal, LOCK_UN);
+		return;
+	}
+	snapshot.count = users.count;
+	snapshot.slot_count = users.slot_count;
+	int entries = journaled; // entries committed later are written after the truncation, see users_commit()
+	memcpy(snapshot.records, users.records, (size_t) snapshot.count * sizeof(user));
+	memcpy(snapshot.slots, users.slots, snapshot.slot_count * sizeof(int));
+	pthread_rwlock_unlock(&users_table_lock);
+	writing = TRUE;
+	pthread_mutex_unlock(&users_lock);
+	int result = users_write(&snapshot, USER_DDBB_TMP);
+	users_free(&snapshot);
+	pthread_mutex_lock(&users_lock);
+	if(result && rename(USER_DDBB_TMP, USER_DDBB_DB) < 0){
+		fprintf(stderr, "ERROR: replacing user database (%s)\n", strerror(errno));
+		remove(USER_DDBB_TMP); // retried on the next compaction
+		result = FALSE;
+	}
+	if(result){
+		pthread_rwlock_wrlock(&users_table_lock);
+		stat(USER_DDBB_DB, &known); // our own write, not to be read again
+		pthread_rwlock_unlock(&users_table_lock);
+		if(ftruncate(journal, 0) < 0){ // replaying it again is harmless, every entry holds the whole user
+			fprintf(stderr, "ERROR: emptying user journal (%s)\n", strerror(errno));
+		}else{
+			journaled -= entries;
+		}
+	}
+	flock(journal, LOCK_UN);
+	writing = FALSE;
+	pthread_cond_broadcast(&users_written);
+}
+
+/// writer thread: commits journal entries as they come, and compacts the journal once it grows or goes quiet
+/// @param arg unused
+static void* users_writer(void* arg){
+	(void) arg;
+	int quiet = FALSE;
+	pthread_mutex_lock(&users_lock);
+	while(TRUE){
+		if(writing){ // users_flush()
+			pthread_cond_wait(&users_written, &users_lock);
+		}else if(pending_length > 0){
+			users_commit();
+			quiet = FALSE;
+		}else if(journaled >= USERS_JOURNAL_MAX || (journaled > 0 && quiet)){
+			users_compact();
+		}else{
+			struct timespec deadline;
+			clock_gettime(CLOCK_REALTIME, &deadline);
+			deadline.tv_sec += USERS_COMPACT_DELAY;
+			quiet = pthread_cond_timedwait(&users_changed, &users_lock, &deadline) == ETIMEDOUT;
+		}
+	}
+	return NULL;
+}
+
+/// loads the user database, recovers the journal and starts the writer thread, pending changes are saved on exit
+///
+/// USER_DDBB is converted into USER_DDBB_DB the first time
+/// @returns 1 if the database was loaded, 0 if it could not be read (it is read once it can)
+int users_load(){
+	if(access(USER_DDBB_DB, F_OK) < 0 && access(USER_DDBB_FILE, F_OK) == 0){
+		int imported = users_import(USER_DDBB_FILE, NULL);
+		if(imported != INEX) printf("[SERVER_AUTH]: %d user(s) converted from %s into %s\n", imported, USER_DDBB_FILE, USER_DDBB_DB);
+	}
+	users_refresh();
+	pthread_mutex_lock(&users_lock);
+	int loaded = known.st_ino != 0;
+	pthread_rwlock_wrlock(&users_table_lock);
+	int replayed = users_replay(&users);
+	pthread_rwlock_unlock(&users_table_lock);
+	if((journal = open(USER_DDBB_JOURNAL, O_WRONLY | O_APPEND | O_CREAT, 0644)) < 0){
+		fprintf(stderr, "ERROR: opening user journal (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	if(replayed > 0){ // start over from a clean journal, it may end with a torn entry
+		printf("[SERVER_AUTH]: recovered %d change(s) from the user journal\n", replayed);
+		journaled = replayed;
+		users_compact();
+	}
+	pthread_mutex_unlock(&users_lock);
+	pthread_t thread;
+	if(pthread_create(&thread, NULL, users_writer, NULL) != 0){
+		fprintf(stderr, "ERROR: creating user database writer (%s)\n", strerror(errno));
+		exit(EXIT_FAILURE);
+	}
+	pthread_detach(thread);
+	atexit(users_flush);
+	return loaded;
+}
+
+/// looks for a user
+/// @param name the user name
+/// @param record where the user information is stored
+/// @returns 1 if the user exists, 0 otherwise
+int users_find(const char* name, user* record){
+	int result = FALSE;
+	users_refresh();
+	pthread_rwlock_rdlock(&users_table_lock); // lookups from every worker run at once
+	if(users.count > 0){
+		unsigned long position = users_probe(&users, name);
+		if(users.slots[position] != INEX){
+			*record = users.records[users.slots[position]];
+			result = TRUE;
+		}
+	}
+	pthread_rwlock_unlock(&users_table_lock);
+	return result;
+}
+
+/// updates a user, returning once the change is in the journal
+///
+/// concurrent updates share a single write to the journal, see users_writer()
+/// @param record the user information
+/// @param changed where to store if the user actually changed (may be NULL)
+/// @returns 1 on success, 0 if the user does not exist
+int users_update(const user* record, int* changed){
+	int result = FALSE;
+	if(changed != NULL) *changed = FALSE;
+	users_refresh(); // do not journal changes over stale users
+	pthread_mutex_lock(&users_lock);
+	pthread_rwlock_wrlock(&users_table_lock);
+	char entry[MAX_USERNAME_SIZE + KDF_CREDENTIAL_SIZE + 32] = "";
+	if(users.count > 0){
+		unsigned long position = users_probe(&users, record->name);
+		if(users.slots[position] != INEX){
+			user* current = &users.records[users.slots[position]];
+			result = TRUE;
+			if(strcmp(current->pass, record->pass) != 0 || current->strikes != record->strikes || current->ban != record->ban){
+				strcpy(current->pass, record->pass);
+				current->strikes = record->strikes;
+				current->ban = record->ban;
+				snprintf(entry, sizeof(entry), "%s %s %d %d\n", current->name, current->pass, current->strikes, current->ban);
+			}
+		}
+	}
+	pthread_rwlock_unlock(&users_table_lock);
+	if(strcmp(entry, "") != 0){
+		size_t length = strlen(entry);
+		if(pending_length + length > pending_capacity){
+			size_t capacity = pending_capacity == 0 ? USERS_MIN_SLOTS * sizeof(entry) : pending_capacity * 2;
+			char* buffer = realloc(pending, capacity);
+			if(buffer == NULL){
+				fprintf(stderr, "ERROR: allocating user journal (%s)\n", strerror(errno));
+				exit(EXIT_FAILURE);
+			}
+			pending = buffer;
+			pending_capacity = capacity;
+		}
+		memcpy(pending + pending_length, entry, length);
+		pending_length += length;
+		unsigned long sequence = ++appended;
+		pthread_cond_signal(&users_changed);
+		while(committed < sequence){
+			pthread_cond_wait(&users_written, &users_lock);
+		}
+		if(changed != NULL) *changed = TRUE;
+	}
+	pthread_mutex_unlock(&users_lock);
+	return result;
+}
+
+/// lists every user (as many as fit in the buffer)
+/// @param buffer the buffer in which to store the user list
+/// @param size size of the buffer, at least 128 bytes
+/// @returns a pointer to the provided buffer
+char* users_list(char* buffer, size_t size){
+	size_t length = (size_t) snprintf(buffer, size, "> user list:\n%s%-30s %-10s %-10s\n", TAB, "name", "strikes", "banned");
+	users_refresh();
+	pthread_rwlock_rdlock(&users_table_lock);
+	int listed = 0;
+	for(;listed < users.count;listed++){
+		char line[128];
+		int R = snprintf(line, sizeof(line), "%s%-30s %-10d %-10d\n", TAB, users.records[listed].name, users.records[listed].strikes, users.records[listed].ban);
+		if(length + (size_t) R + 32 > size) break; // keep room for the note below
+		strcpy(buffer + length, line);
+		length += (size_t) R;
+	}
+	if(listed < users.count) length += (size_t) snprintf(buffer + length, size - length, "%s(%d more)\n", TAB, users.count - listed);
+	pthread_rwlock_unlock(&users_table_lock);
+	snprintf(buffer + length, size - length, "\n");
+	return buffer;
+}
+
+/// commits pending journal entries and compacts the journal into USER_DDBB_DB
+void users_flush(){
+	pthread_mutex_lock(&users_lock);
+	while(writing){
+		pthread_cond_wait(&users_written, &users_lock);
+	}
+	if(pending_length > 0) users_commit();
+	if(journaled > 0 && journal != INEX) users_compact();
+	pthread_mutex_unlock(&users_lock);
+}
+
+/// merges a text user database ("name pass strikes ban" per line, as USER_DDBB) into USER_DDBB_DB (bulk load)
+///
+/// users in the file replace the ones already there. The result is written to USER_DDBB_IMPORT_TMP and renamed while
+/// holding the flock() of the journal, so a running SERVER_AUTH maps it on its next lookup, or replays its own changes
+/// over it on its next compaction. If the journal is not empty, the users in the file are appended to it as well, so
+/// older changes to them replayed over USER_DDBB_DB do not undo the import
+/// @param filename the text file
+/// @param imported called with the name of every user in the file once they are imported (may be NULL)
+/// @returns the amount of users in the file, INEX on failure
+int users_import(const char* filename, void (*imported)(const char* name)){
+	struct user_table table;
+	struct user_table text;
+	if(users_read_text(&text, filename) == FALSE) return INEX;
+	int lock = open(USER_DDBB_JOURNAL, O_WRONLY | O_APPEND | O_CREAT, 0644);
+	if(lock < 0 || flock(lock, LOCK_EX) < 0){
+		fprintf(stderr, "ERROR: locking user journal (%s)\n", strerror(errno));
+		if(lock >= 0) close(lock);
+		users_free(&text);
+		return INEX;
+	}
+	int result = users_map(&table, NULL);
+	if(result == FALSE){
+		close(lock); // releases the flock()
+		users_free(&text);
+		return INEX;
+	}
+	unsigned long slot_count = USERS_MIN_SLOTS;
+	while(slot_count < (unsigned long) (table.count + text.count) * 2) slot_count *= 2;
+	result = TRUE;
+	if(slot_count > table.slot_count){ // grow once instead of on every insertion
+		result = users_own(&table) && users_rehash(&table, slot_count);
+	}
+	for(int i = 0;i < text.count && result;i++){
+		result = users_insert(&table, &text.records[i], TRUE);
+	}
+	if(result) result = users_write(&table, USER_DDBB_IMPORT_TMP);
+	users_free(&table);
+	if(result && rename(USER_DDBB_IMPORT_TMP, USER_DDBB_DB) < 0){
+		fprintf(stderr, "ERROR: replacing user database (%s)\n", strerror(errno));
+		remove(USER_DDBB_IMPORT_TMP);
+		result = FALSE;
+	}
+	struct stat info;
+	if(result && fstat(lock, &info) == 0 && info.st_size > 0){ // replayed over the new users, so they must come last
+		for(int i = 0;i < text.count && result;i++){
+			user* record = &text.records[i];
+			result = dprintf(lock, "%s %s %d %d\n", record->name, record->pass, record->strikes, record->ban) > 0;
+		}
+		if(!result || fdatasync(lock) < 0){
+			fprintf(stderr, "ERROR: writing user journal (%s)\n", strerror(errno));
+			result = FALSE;
+		}
+	}
+	close(lock);
+	for(int i = 0;i < text.count && result && imported != NULL;i++){
+		imported(text.records[i].name);
+	}
+	int count = text.count;
+	users_free(&text);
+	return result ? count : INEX;
+}
+
+/// prints USER_DDBB_DB in the text format of USER_DDBB
+/// @param file_ptr where to print it
+/// @returns the amount of users, INEX on failure
+int users_export(FILE* file_ptr){
+	struct user_table table;
+	if(users_map(&table, NULL) != TRUE){
+		fprintf(stderr, "ERROR: no user database to export\n");
+		return INEX;
+	}
+	int count = table.count;
+	for(int i = 0;i < table.count;i++){
+		fprintf(file_ptr, "%s %s %d %d\n", table.records[i].name, table.records[i].pass, table.records[i].strikes, table.records[i].ban);
+	}
+	users_free(&table);
+	return count;
+}
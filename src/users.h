@@ -0,0 +1,68 @@
+/*
+ * users.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#ifndef USERS_H_
+#define USERS_H_
+
+#include <stdio.h>
+#include <global.h>
+#include <kdf.h>
+
+/*
+ * the user database of SERVER_AUTH, kept in memory:
+ *
+ *   USER_DDBB_DB + journal  --users_load()-->  records[] (file order)  <--  slots[] (open addressing, by name)
+ *       ^            ^                                |
+ *       |            +---- commit <-- writer thread <-+  users_update()
+ *       +----------------- compaction <-----+
+ *
+ * USER_DDBB_DB is the table itself: a header, the fixed-size records and the slots, so it is mapped as it is
+ * (nothing is parsed on start) and a lookup reads one slot and one record. The text USER_DDBB is only converted
+ * into it the first time; afterwards users are added in bulk with `./user_db import <file>` and read back with
+ * `./user_db export`
+ *
+ * lookups never read files (only the pages of USER_DDBB_DB they touch). Every change is appended to USER_DDBB_JOURNAL as the whole user
+ * ("name credential strikes ban"), and users_update() returns once it is synced; changes made meanwhile
+ * are committed together with a single write. The journal is compacted into USER_DDBB_DB (written to
+ * USER_DDBB_TMP, then renamed) once it holds USERS_JOURNAL_MAX entries or nothing changed for
+ * USERS_COMPACT_DELAY seconds, and replayed on start if SERVER_AUTH did not exit properly.
+ *
+ * USER_DDBB_DB is only mapped again when someone else changes it, which is noticed by comparing it
+ * with what was last read or written (at most once per second), and only while the journal is empty. Otherwise the compaction
+ * maps it and replays the journal over it, instead of writing the users it had over the new ones.
+ * Imports and compactions hold an exclusive flock() on USER_DDBB_JOURNAL (never renamed, unlike
+ * USER_DDBB_DB), so neither replaces USER_DDBB_DB while the other is reading or writing it
+ */
+
+#define MAX_PASSWORD_SIZE 15 ///< maximum user password length
+#define USER_DDBB_FILE "USER_DDBB" ///< text user database, converted into USER_DDBB_DB the first time
+#define USER_DDBB_DB "USER_DDBB.db" ///< user database filename
+#define USERS_MAGIC "OSUSERS2" ///< first bytes of USER_DDBB_DB (not NUL terminated)
+#define USERS_MAGIC_V1 "OSUSERS1" ///< first bytes of a USER_DDBB_DB from before passwords were hashed, upgraded when mapped
+#define USER_DDBB_TMP ".tmp" ///< temporary filename used by the compaction
+#define USER_DDBB_IMPORT_TMP ".import.tmp" ///< temporary filename used by users_import()
+#define USER_DDBB_JOURNAL "USER_DDBB.journal" ///< changes not yet compacted into USER_DDBB_DB
+#define USERS_JOURNAL_MAX 1024 ///< journal entries that trigger a compaction
+#define USERS_COMPACT_DELAY 5 ///< seconds without changes that trigger a compaction
+#define USERS_MIN_SLOTS 64 ///< initial size of the hash table, grows so it is never more than half full
+
+typedef struct current_user{
+	char name[MAX_USERNAME_SIZE];
+	char pass[KDF_CREDENTIAL_SIZE]; ///< credential (see kdf.h), or the plaintext password until its next login
+	int strikes;
+	int ban;
+} user;
+
+int users_load();
+int users_find(const char* name, user* record);
+int users_update(const user* record, int* changed);
+char* users_list(char* buffer, size_t size);
+void users_flush();
+int users_import(const char* filename, void (*imported)(const char* name));
+int users_export(FILE* file_ptr);
+
+#endif /* USERS_H_ */
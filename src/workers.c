@@ -0,0 +1,127 @@
+/*
+ * workers.c
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <global.h>
+#include <workers.h>
+
+/// maps the worker table
+/// @param flags flags for shm_open()
+/// @returns the table, NULL on failure
+static struct worker_table* workers_map(int flags){
+	int FD = shm_open(WORKERS_NAME, flags, 0666);
+	if(FD < 0){
+		fprintf(stderr, "ERROR: opening shared memory %s (%s)\n", WORKERS_NAME, strerror(errno));
+		return NULL;
+	}
+	if((flags & O_CREAT) && ftruncate(FD, sizeof(struct worker_table)) < 0){
+		fprintf(stderr, "ERROR: sizing shared memory %s (%s)\n", WORKERS_NAME, strerror(errno));
+		close(FD);
+		return NULL;
+	}
+	void* region = mmap(NULL, sizeof(struct worker_table), PROT_READ | PROT_WRITE, MAP_SHARED, FD, 0);
+	close(FD);
+	if(region == MAP_FAILED){
+		fprintf(stderr, "ERROR: mapping shared memory %s (%s)\n", WORKERS_NAME, strerror(errno));
+		return NULL;
+	}
+	return region;
+}
+
+/// checks if a registered worker is still running
+/// @param worker the worker
+/// @returns 1 if its process exists, 0 otherwise
+static int worker_alive(struct worker* worker){
+	pid_t pid = atomic_load(&worker->pid);
+	return pid != 0 && (kill(pid, 0) == 0 || errno != ESRCH);
+}
+
+/// creates an empty worker table (SERVER_MAIN)
+/// @returns the table, NULL on failure
+struct worker_table* workers_create(){
+	shm_unlink(WORKERS_NAME);
+	return workers_map(O_RDWR | O_CREAT | O_EXCL); // zero filled, no worker registered
+}
+
+/// attaches to the worker table created by SERVER_MAIN
+/// @returns the table, NULL on failure
+struct worker_table* workers_attach(){
+	return workers_map(O_RDWR);
+}
+
+/// removes the worker table
+/// @param table the table
+void workers_destroy(struct worker_table* table){
+	if(table == NULL) return;
+	munmap(table, sizeof(struct worker_table));
+	shm_unlink(WORKERS_NAME);
+}
+
+/// registers the calling process as a worker, with no load
+///
+/// the slot of a worker that died without deregistering is taken over
+/// @param table the table
+/// @param index the worker index (lower than MAX_FILE_WORKERS)
+/// @returns 1 on success, 0 if another running process is registered as that worker
+int worker_register(struct worker_table* table, int index){
+	struct worker* worker = &table->workers[index];
+	pid_t pid = atomic_load(&worker->pid);
+	if(pid != 0 && worker_alive(worker)) return FALSE;
+	atomic_store(&worker->transfers, 0);
+	atomic_store(&worker->bytes, 0);
+	return atomic_compare_exchange_strong(&worker->pid, &pid, getpid());
+}
+
+/// deregisters a worker, SERVER_MAIN sends it no more requests
+/// @param table the table (NULL if unavailable)
+/// @param index the worker index
+void worker_deregister(struct worker_table* table, int index){
+	if(table == NULL) return;
+	pid_t pid = getpid();
+	atomic_compare_exchange_strong(&table->workers[index].pid, &pid, 0);
+}
+
+/// updates the load of a worker
+/// @param table the table (NULL if unavailable)
+/// @param index the worker index
+/// @param transfers change in the amount of transfers
+/// @param bytes change in the amount of bytes
+void worker_load(struct worker_table* table, int index, long transfers, long bytes){
+	if(table == NULL) return;
+	atomic_fetch_add(&table->workers[index].transfers, transfers);
+	atomic_fetch_add(&table->workers[index].bytes, bytes);
+}
+
+/// picks the least loaded running worker: the one with the fewest bytes to send, then the fewest
+/// transfers, then the fewest requests in flight
+/// @param table the table (NULL if unavailable)
+/// @param pending requests in flight to each worker, as counted by SERVER_MAIN
+/// @returns the worker index, INEX if no worker is registered
+int worker_pick(struct worker_table* table, const int pending[MAX_FILE_WORKERS]){
+	if(table == NULL) return INEX;
+	int best = INEX;
+	long best_bytes = 0, best_transfers = 0;
+	for(int i = 0;i < MAX_FILE_WORKERS;i++){
+		struct worker* worker = &table->workers[i];
+		if(!worker_alive(worker)) continue;
+		long bytes = atomic_load(&worker->bytes);
+		long transfers = atomic_load(&worker->transfers);
+		if(best == INEX || bytes < best_bytes || (bytes == best_bytes && (transfers < best_transfers
+				|| (transfers == best_transfers && pending[i] < pending[best])))){
+			best = i;
+			best_bytes = bytes;
+			best_transfers = transfers;
+		}
+	}
+	return best;
+}
@@ -0,0 +1,49 @@
+/*
+ * workers.h
+ *
+ *  Created on: Oct 19, 2026
+ *      Author: seba
+ */
+
+#ifndef WORKERS_H_
+#define WORKERS_H_
+
+#include <stdatomic.h>
+#include <sys/types.h>
+
+/*
+ * several SERVER_FILE processes (workers) serve the same images folder:
+ *
+ *   ./server_file 0   reads message type SERVER_FILE_MSG_TYPE + 0, transfers on SERVER_FILE_PORT + 0
+ *   ./server_file 1   reads message type SERVER_FILE_MSG_TYPE + 1, transfers on SERVER_FILE_PORT + 1
+ *   ...
+ *
+ * every worker registers itself in a table shared with SERVER_MAIN, and keeps its load up to date
+ * there: the amount of transfers it has accepted (waiting for their client or running) and the
+ * bytes those transfers move. SERVER_MAIN sends every SERVER_FILE request to the least loaded
+ * registered worker, see worker_pick()
+ */
+
+#define WORKERS_NAME "/os_image_tool_workers" ///< name of the shared memory region
+#define MAX_FILE_WORKERS 8 ///< maximum amount of SERVER_FILE workers
+
+/// a SERVER_FILE worker, as published by itself
+struct worker{
+	_Atomic pid_t pid; ///< 0 if the worker is not registered
+	_Atomic long transfers; ///< transfers accepted and not finished yet
+	_Atomic long bytes; ///< bytes of those transfers
+};
+
+struct worker_table{
+	struct worker workers[MAX_FILE_WORKERS];
+};
+
+struct worker_table* workers_create();
+struct worker_table* workers_attach();
+void workers_destroy(struct worker_table* table);
+int worker_register(struct worker_table* table, int index);
+void worker_deregister(struct worker_table* table, int index);
+void worker_load(struct worker_table* table, int index, long transfers, long bytes);
+int worker_pick(struct worker_table* table, const int pending[MAX_FILE_WORKERS]);
+
+#endif /* WORKERS_H_ */